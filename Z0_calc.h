@@ -42,6 +42,9 @@ public:
     /* 设置物体最小尺寸 */
     virtual void set_precision(float unit = 0.035) {}
     
+    /* 迭代求解的收敛条件 rel_tol为电容的相对精度 max_iter为最大迭代次数 0表示不限制 */
+    virtual void set_convergence(float rel_tol, std::int32_t max_iter) {}
+    
     virtual void set_box_size(float w, float h) {}
     virtual std::uint32_t get_type() = 0;
     
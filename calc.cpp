@@ -17,6 +17,7 @@
 *****************************************************************************/
 
 #include <float.h>
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 #include <complex>
@@ -286,6 +287,134 @@ float calc_arc_len(float radius, float angle)
 }
 
 
+double calc_arc_pos(double x1, double y1, double x2, double y2, double x3, double y3, double x, double y)
+{
+    double cx;
+    double cy;
+    double radius;
+    double angle;
+    calc_arc_center_radius(x1, y1, x2, y2, x3, y3, cx, cy, radius);
+    calc_arc_angle(x1, y1, x2, y2, x3, y3, cx, cy, radius, angle);
+    
+    double a = calc_angle(cx, cy, x, y) - calc_angle(cx, cy, x1, y1);
+    if (angle < 0)
+    {
+        a = -a;
+    }
+    a = fmod(a, 2 * M_PI);
+    if (a < 0)
+    {
+        a += 2 * M_PI;
+    }
+    /* 起点附近的误差可能让角度绕到接近2PI */
+    if (a > fabs(angle) && a > M_PI + fabs(angle) * 0.5)
+    {
+        a = 0;
+    }
+    return radius * a;
+}
+
+
+/* 圆弧的角度范围 [lo, hi] 逆时针方向 */
+static void _arc_angle_range(double x1, double y1, double x2, double y2, double x3, double y3,
+                                double& cx, double& cy, double& radius, double& lo, double& hi)
+{
+    double angle;
+    calc_arc_center_radius(x1, y1, x2, y2, x3, y3, cx, cy, radius);
+    calc_arc_angle(x1, y1, x2, y2, x3, y3, cx, cy, radius, angle);
+    double start = calc_angle(cx, cy, x1, y1);
+    lo = std::min(start, start + angle);
+    hi = std::max(start, start + angle);
+}
+
+
+/* 两条圆弧交叠部分的角度范围 */
+static bool _arcs_overlap_angle(double ax1, double ay1, double ax2, double ay2, double ax3, double ay3,
+                                double bx1, double by1, double bx2, double by2, double bx3, double by3,
+                                double& acx, double& acy, double& ar, double& bcx, double& bcy, double& br,
+                                double& lo, double& hi)
+{
+    double alo;
+    double ahi;
+    double blo;
+    double bhi;
+    _arc_angle_range(ax1, ay1, ax2, ay2, ax3, ay3, acx, acy, ar, alo, ahi);
+    _arc_angle_range(bx1, by1, bx2, by2, bx3, by3, bcx, bcy, br, blo, bhi);
+    if (ar <= 0 || br <= 0)
+    {
+        return false;
+    }
+    
+    /* 角度范围可能相差一圈 */
+    lo = 0;
+    hi = 0;
+    for (std::int32_t k = -1; k <= 1; k++)
+    {
+        double l = std::max(alo, blo + k * 2 * M_PI);
+        double h = std::min(ahi, bhi + k * 2 * M_PI);
+        if (h - l > hi - lo)
+        {
+            lo = l;
+            hi = h;
+        }
+    }
+    return (hi - lo) * std::min(ar, br) > _float_epsilon;
+}
+
+
+bool calc_concentric_arcs_overlap(double ax1, double ay1, double ax2, double ay2, double ax3, double ay3,
+                                    double bx1, double by1, double bx2, double by2, double bx3, double by3,
+                                    double& aox1, double& aoy1, double& aox2, double& aoy2,
+                                    double& box1, double& boy1, double& box2, double& boy2)
+{
+    double acx;
+    double acy;
+    double ar;
+    double bcx;
+    double bcy;
+    double br;
+    double lo;
+    double hi;
+    if (!_arcs_overlap_angle(ax1, ay1, ax2, ay2, ax3, ay3, bx1, by1, bx2, by2, bx3, by3,
+                                acx, acy, ar, bcx, bcy, br, lo, hi))
+    {
+        return false;
+    }
+    
+    /* 坐标系y轴向下 */
+    aox1 = acx + ar * cos(lo);
+    aoy1 = acy - ar * sin(lo);
+    aox2 = acx + ar * cos(hi);
+    aoy2 = acy - ar * sin(hi);
+    
+    box1 = bcx + br * cos(lo);
+    boy1 = bcy - br * sin(lo);
+    box2 = bcx + br * cos(hi);
+    boy2 = bcy - br * sin(hi);
+    return true;
+}
+
+
+double calc_concentric_arcs_overlap_len(double ax1, double ay1, double ax2, double ay2, double ax3, double ay3,
+                                    double bx1, double by1, double bx2, double by2, double bx3, double by3)
+{
+    double acx;
+    double acy;
+    double ar;
+    double bcx;
+    double bcy;
+    double br;
+    double lo;
+    double hi;
+    if (_arcs_overlap_angle(ax1, ay1, ax2, ay2, ax3, ay3, bx1, by1, bx2, by2, bx3, by3,
+                                acx, acy, ar, bcx, bcy, br, lo, hi))
+    {
+        return (hi - lo) * (ar + br) * 0.5;
+    }
+    return 0;
+}
+
+
 void calc_rotation(float cx, float cy, float& x, float& y, float angle)
 {
     float radians = angle * M_PI / 180.;
@@ -296,4 +425,91 @@ void calc_rotation(float cx, float cy, float& x, float& y, float angle)
     std::complex<float> tmp = std::polar(abs(vector), arg(vector) + radians);
     x = (start + tmp).real();
     y = ((start + tmp).imag());
-}
\ No newline at end of file
+}
+
+
+void calc_dist_batch(double x, double y, const double *xs, const double *ys, std::int32_t n, double *dist)
+{
+    #pragma omp simd
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        double dx = xs[i] - x;
+        double dy = ys[i] - y;
+        dist[i] = sqrt(dx * dx + dy * dy);
+    }
+}
+
+
+void calc_p2line_dist_batch(double x1, double y1, double x2, double y2, const double *xs, const double *ys, std::int32_t n, double *dist)
+{
+    /* 叉积除以线段长度 线段退化成点时就是到点的距离 */
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    double len = sqrt(dx * dx + dy * dy);
+    if (len < _float_epsilon)
+    {
+        calc_dist_batch(x1, y1, xs, ys, n, dist);
+        return;
+    }
+    double len_r = 1.0 / len;
+    
+    #pragma omp simd
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        dist[i] = fabs(dx * (ys[i] - y1) - dy * (xs[i] - x1)) * len_r;
+    }
+}
+
+
+void calc_arc_center_radius_batch(const double *x1, const double *y1, const double *x2, const double *y2, const double *x3, const double *y3,
+                                    std::int32_t n, double *x, double *y, double *radius)
+{
+    /* 与calc_arc_center_radius相同 y轴翻转不影响圆心 省掉了 三点共线用掩码代替分支 */
+    #pragma omp simd
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        double a = x1[i] - x2[i];
+        double b = y1[i] - y2[i];
+        double c = x1[i] - x3[i];
+        double d = y1[i] - y3[i];
+        double e = ((x1[i] * x1[i] - x2[i] * x2[i]) + (y1[i] * y1[i] - y2[i] * y2[i])) * 0.5;
+        double f = ((x1[i] * x1[i] - x3[i] * x3[i]) + (y1[i] * y1[i] - y3[i] * y3[i])) * 0.5;
+        double det = b * c - a * d;
+        double ok = (fabs(det) >= 1e-5)? 1.0: 0.0;
+        double det_r = ok / (det + (1.0 - ok));
+        double cx = -(d * e - b * f) * det_r;
+        double cy = -(a * f - c * e) * det_r;
+        x[i] = cx;
+        y[i] = cy;
+        radius[i] = sqrt((x1[i] - cx) * (x1[i] - cx) + (y1[i] - cy) * (y1[i] - cy)) * ok + (ok - 1.0);
+    }
+}
+
+
+void calc_rotation_batch(float cx, float cy, float *xs, float *ys, std::int32_t n, float angle)
+{
+    float radians = angle * M_PI / 180.;
+    float c = cosf(radians);
+    float s = sinf(radians);
+    
+    #pragma omp simd
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        float dx = xs[i] - cx;
+        float dy = ys[i] - cy;
+        xs[i] = cx + dx * c - dy * s;
+        ys[i] = cy + dx * s + dy * c;
+    }
+}
+
+
+void calc_point_rect_dist_batch(double x, double y, const double *cx, const double *cy, const double *hw, const double *hh, std::int32_t n, double *dist)
+{
+    #pragma omp simd
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        double dx = fabs(x - cx[i]) - hw[i];
+        double dy = fabs(y - cy[i]) - hh[i];
+        dist[i] = (dx > dy)? dx: dy;
+    }
+}
@@ -19,6 +19,7 @@
 #ifndef __CALC_H__
 #define __CALC_H__
 #include <math.h>
+#include <cstdint>
 
 /* 计算两点连线倾斜角 */
 double calc_angle(double x1, double y1, double x2, double y2);
@@ -52,7 +53,33 @@ void calc_arc_center_radius(double x1, double y1, double x2, double y2, double x
 void calc_arc_angle(double x1, double y1, double x2, double y2, double x3, double y3, double x, double y, double radius, double& angle);
 float calc_arc_len(float radius, float angle);
 
+/* 圆弧上的点(x, y)沿圆弧方向到起点(x1, y1)的弧长 */
+double calc_arc_pos(double x1, double y1, double x2, double y2, double x3, double y3, double x, double y);
+
+/* 计算两条同心圆弧的交叠区域 (aox1, aoy1) (box1, boy1)在同一条半径上 (aox2, aoy2) (box2, boy2)也是 */
+bool calc_concentric_arcs_overlap(double ax1, double ay1, double ax2, double ay2, double ax3, double ay3,
+                                    double bx1, double by1, double bx2, double by2, double bx3, double by3,
+                                    double& aox1, double& aoy1, double& aox2, double& aoy2,
+                                    double& box1, double& boy1, double& box2, double& boy2);
+
+/* 计算两条同心圆弧的交叠区域长度 按两条圆弧的平均半径 */
+double calc_concentric_arcs_overlap_len(double ax1, double ay1, double ax2, double ay2, double ax3, double ay3,
+                                    double bx1, double by1, double bx2, double by2, double bx3, double by3);
+
 
 
 void calc_rotation(float cx, float cy, float& x, float& y, float angle);
+
+/* 批量计算 点按SoA存放(xs ys各n个) 循环体没有分支 编译器可以向量化 */
+/* 点(x, y)到n个点的距离 */
+void calc_dist_batch(double x, double y, const double *xs, const double *ys, std::int32_t n, double *dist);
+/* n个点到线段或其延长线的垂直距离 */
+void calc_p2line_dist_batch(double x1, double y1, double x2, double y2, const double *xs, const double *ys, std::int32_t n, double *dist);
+/* n条圆弧的圆心和半径 三点共线时半径为-1 */
+void calc_arc_center_radius_batch(const double *x1, const double *y1, const double *x2, const double *y2, const double *x3, const double *y3,
+                                    std::int32_t n, double *x, double *y, double *radius);
+/* n个点绕(cx, cy)旋转angle度 */
+void calc_rotation_batch(float cx, float cy, float *xs, float *ys, std::int32_t n, float angle);
+/* 点(x, y)到n个中心为(cx, cy) 半宽hw 半高hh的矩形的距离(取x y方向较大的一个) <=0时点在矩形内(包括边界) */
+void calc_point_rect_dist_batch(double x, double y, const double *cx, const double *cy, const double *hw, const double *hh, std::int32_t n, double *dist);
 #endif
\ No newline at end of file
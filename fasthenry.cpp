@@ -18,8 +18,10 @@
 
 #include <string.h>
 #include <set>
+#include <algorithm>
 #include <math.h>
 #include "fasthenry.h"
+#include "scratch.h"
 
 #ifdef _WIN32
 #define DEV_NULL " NUL "
@@ -30,13 +32,16 @@
 fasthenry::fasthenry()
     : _conductivity(5.8e7)
     , _freq(1e0)
+    , _fmax(1e0)
+    , _ndec(1)
+    , _dir(scratch::make_subdir("fasthenry"))
 {
 }
 
 
 fasthenry::~fasthenry()
 {
-    remove("Zc.mat");
+    scratch::remove_subdir(_dir);
 }
 
 void fasthenry::clear()
@@ -99,7 +104,7 @@ bool fasthenry::add_wire(const std::string& node1_name, const std::string& node2
         nwinc = 1;
         if (_freq > 1)
         {
-            nwinc = fasthenry::_get_ninc(w, _freq, _conductivity, rw);
+            nwinc = fasthenry::_get_ninc(w, _fmax, _conductivity, rw);
         }
     }
     
@@ -108,7 +113,7 @@ bool fasthenry::add_wire(const std::string& node1_name, const std::string& node2
         nhinc = 1;
         if (_freq > 1)
         {
-            nhinc = fasthenry::_get_ninc(h, _freq, _conductivity, rh);
+            nhinc = fasthenry::_get_ninc(h, _fmax, _conductivity, rh);
         }
     }
     
@@ -173,7 +178,7 @@ bool fasthenry::add_via(const std::string& node1_name, const std::string& node2_
     std::int32_t nwinc = 1;
     if (_freq > 1)
     {
-       nwinc = _get_ninc(via_cu_thick, _freq, _conductivity, rw);
+       nwinc = _get_ninc(via_cu_thick, _fmax, _conductivity, rw);
     }
     
     for (std::uint32_t i = 0; i < inside_points.size(); i++)
@@ -251,15 +256,55 @@ bool fasthenry::add_equiv(const std::string& node1_name, const std::string& node
 
 bool fasthenry::calc_impedance(const std::string& node1_name, const std::string& node2_name, double& r, double& l)
 {
-    _call_fasthenry(node1_name, node2_name);
-    std::vector<impedance_matrix> ims = _read_impedance_matrix();
-    if (ims.empty() || ims[0].values.empty())
+    std::vector<double> r_;
+    std::vector<double> l_;
+    if (!calc_impedance_matrix({std::pair<std::string, std::string>(node1_name, node2_name)}, r_, l_))
+    {
+        return false;
+    }
+    r = r_[0];
+    l = l_[0];
+    return true;
+}
+
+bool fasthenry::calc_impedance_matrix(const std::vector<std::pair<std::string, std::string> >& ports, std::vector<double>& r, std::vector<double>& l)
+{
+    std::uint32_t n = ports.size();
+    std::vector<impedance_matrix> ims;
+    if (!calc_impedance_sweep(ports, ims))
     {
         return false;
     }
-    r = ims[0].values[0].first;
-    l = _calc_inductance(ims[0].freq, ims[0].values[0].second);
     
+    r.resize(n * n);
+    l.resize(n * n);
+    for (std::uint32_t i = 0; i < n * n; i++)
+    {
+        r[i] = ims[0].values[i].first;
+        l[i] = _calc_inductance(ims[0].freq, ims[0].values[i].second);
+    }
+    return true;
+}
+
+bool fasthenry::calc_impedance_sweep(const std::vector<std::pair<std::string, std::string> >& ports, std::vector<impedance_matrix>& ims)
+{
+    std::uint32_t n = ports.size();
+    if (!_call_fasthenry(ports))
+    {
+        return false;
+    }
+    ims = _read_impedance_matrix();
+    if (ims.empty())
+    {
+        return false;
+    }
+    for (const auto& im: ims)
+    {
+        if (im.rows != n || im.cols != n || im.values.size() != n * n)
+        {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -267,13 +312,19 @@ std::string fasthenry::gen_ckt(const char *wire_name, const std::string& name)
 {
     std::list<std::string> wire_names;
     wire_names.push_back(std::string(wire_name));
-    _call_fasthenry(wire_names);
+    if (!_call_fasthenry(wire_names))
+    {
+        return "";
+    }
     return _make_cir(name, 2);
 }
 
 std::string fasthenry::gen_ckt2(std::list<std::string> wire_names, const std::string& name)
 {
-    _call_fasthenry(wire_names);
+    if (!_call_fasthenry(wire_names))
+    {
+        return "";
+    }
     return _make_cir(name, 4);
 }
 
@@ -290,7 +341,7 @@ void fasthenry::dump()
     tmp = buf;
     tmp += _inp;
     
-    sprintf(buf, ".freq fmin=%g fmax=%g ndec=1\n.end\n", _freq, _freq);
+    sprintf(buf, ".freq fmin=%g fmax=%g ndec=%d\n.end\n", _freq, _fmax, _ndec);
     tmp += buf;
     printf("\n\n\n%s\n\n\n", tmp.c_str());
 }
@@ -299,6 +350,11 @@ void fasthenry::dump()
 void fasthenry::calc_wire_lr(float w, float h, float len, float& l, float& r, float conductivity, float freq)
 {
     std::string tmp;
+    std::string dir = scratch::make_subdir("fasthenry");
+    if (dir.empty())
+    {
+        return;
+    }
     
     char buf[512] = {0};
     
@@ -321,7 +377,7 @@ void fasthenry::calc_wire_lr(float w, float h, float len, float& l, float& r, fl
     sprintf(buf, ".freq fmin=%g fmax=%g ndec=1\n.end\n", freq, freq);
     tmp += buf;
     
-    FILE *fp = popen("fasthenry > " DEV_NULL, "w");
+    FILE *fp = popen((scratch::cd_cmd(dir) + "fasthenry > " DEV_NULL).c_str(), "w");
     if (fp)
     {
         fwrite(tmp.c_str(), 1, tmp.length(), fp);
@@ -339,7 +395,7 @@ void fasthenry::calc_wire_lr(float w, float h, float len, float& l, float& r, fl
         
         pclose(fp);
     }
-    fp = popen("ReadOutput Zc.mat", "r");
+    fp = popen(("ReadOutput \"" + scratch::path(dir, "Zc.mat") + "\"").c_str(), "r");
     if (fp)
     {
         buf[sizeof(buf) - 1] = 0;
@@ -358,12 +414,210 @@ void fasthenry::calc_wire_lr(float w, float h, float len, float& l, float& r, fl
                 l = atof(p);
             }
         }
-        fclose(fp);
+        pclose(fp);
+    }
+    scratch::remove_subdir(dir);
+}
+
+double fasthenry::fit_rl_ladder(const std::vector<double>& freq, const std::vector<std::pair<double, double> >& z, std::int32_t sections,
+                                double& r0, double& l0, std::vector<double>& rk, std::vector<double>& lk)
+{
+    std::int32_t m = freq.size();
+    std::int32_t k = std::max(0, sections);
+    std::int32_t n = k + 2;
+    
+    r0 = 0;
+    l0 = 0;
+    rk.clear();
+    lk.clear();
+    if (m == 0)
+    {
+        return 0;
+    }
+    
+    /* 每节的转折频率 */
+    double w_min = 2 * M_PI * *std::min_element(freq.begin(), freq.end());
+    double w_max = 2 * M_PI * *std::max_element(freq.begin(), freq.end());
+    std::vector<double> wk(k);
+    for (std::int32_t i = 0; i < k; i++)
+    {
+        wk[i] = w_min * pow(w_max / w_min, (i + 0.5) / k);
+    }
+    
+    /* 未知量 r0 l0 r1..rk 对每个频点实部虚部各一行 按|Z|归一化为相对误差 */
+    std::vector<double> a(2 * m * n, 0);
+    std::vector<double> b(2 * m, 0);
+    for (std::int32_t i = 0; i < m; i++)
+    {
+        double w = 2 * M_PI * freq[i];
+        double scale = 1. / std::max(hypot(z[i].first, z[i].second), 1e-30);
+        double *re = &a[(2 * i) * n];
+        double *im = &a[(2 * i + 1) * n];
+        re[0] = scale;
+        im[1] = w * scale;
+        for (std::int32_t j = 0; j < k; j++)
+        {
+            double x = w / wk[j];
+            re[j + 2] = x * x / (1 + x * x) * scale;
+            im[j + 2] = x / (1 + x * x) * scale;
+        }
+        b[2 * i] = z[i].first * scale;
+        b[2 * i + 1] = z[i].second * scale;
+    }
+    
+    /* 列归一化 */
+    std::vector<double> col_scale(n, 0);
+    for (std::int32_t j = 0; j < n; j++)
+    {
+        double sum = 0;
+        for (std::int32_t i = 0; i < 2 * m; i++)
+        {
+            sum += a[i * n + j] * a[i * n + j];
+        }
+        col_scale[j] = (sum > 0)? 1. / sqrt(sum): 0;
+        for (std::int32_t i = 0; i < 2 * m; i++)
+        {
+            a[i * n + j] *= col_scale[j];
+        }
+    }
+    
+    /* 非负最小二乘 每次去掉最负的未知量 在剩下的未知量上重新求解正规方程 */
+    std::vector<bool> used(n, true);
+    std::vector<double> x(n, 0);
+    for (std::int32_t j = 0; j < n; j++)
+    {
+        used[j] = (col_scale[j] > 0);
+    }
+    
+    while (1)
+    {
+        std::vector<std::int32_t> cols;
+        for (std::int32_t j = 0; j < n; j++)
+        {
+            if (used[j])
+            {
+                cols.push_back(j);
+            }
+        }
+        std::int32_t nf = cols.size();
+        std::vector<double> ata(nf * (nf + 1), 0);
+        for (std::int32_t p = 0; p < nf; p++)
+        {
+            for (std::int32_t q = 0; q < nf; q++)
+            {
+                double sum = 0;
+                for (std::int32_t i = 0; i < 2 * m; i++)
+                {
+                    sum += a[i * n + cols[p]] * a[i * n + cols[q]];
+                }
+                ata[p * (nf + 1) + q] = sum;
+            }
+            double sum = 0;
+            for (std::int32_t i = 0; i < 2 * m; i++)
+            {
+                sum += a[i * n + cols[p]] * b[i];
+            }
+            ata[p * (nf + 1) + nf] = sum;
+        }
+        
+        /* 列主元高斯消元 */
+        for (std::int32_t p = 0; p < nf; p++)
+        {
+            std::int32_t piv = p;
+            for (std::int32_t q = p + 1; q < nf; q++)
+            {
+                if (fabs(ata[q * (nf + 1) + p]) > fabs(ata[piv * (nf + 1) + p]))
+                {
+                    piv = q;
+                }
+            }
+            for (std::int32_t q = 0; q <= nf; q++)
+            {
+                std::swap(ata[p * (nf + 1) + q], ata[piv * (nf + 1) + q]);
+            }
+            double d = ata[p * (nf + 1) + p];
+            if (fabs(d) < 1e-300)
+            {
+                continue;
+            }
+            for (std::int32_t q = p + 1; q < nf; q++)
+            {
+                double f = ata[q * (nf + 1) + p] / d;
+                for (std::int32_t c = p; c <= nf; c++)
+                {
+                    ata[q * (nf + 1) + c] -= f * ata[p * (nf + 1) + c];
+                }
+            }
+        }
+        std::vector<double> y(nf, 0);
+        for (std::int32_t p = nf - 1; p >= 0; p--)
+        {
+            double sum = ata[p * (nf + 1) + nf];
+            for (std::int32_t q = p + 1; q < nf; q++)
+            {
+                sum -= ata[p * (nf + 1) + q] * y[q];
+            }
+            double d = ata[p * (nf + 1) + p];
+            y[p] = (fabs(d) < 1e-300)? 0: sum / d;
+        }
+        
+        std::int32_t neg = -1;
+        for (std::int32_t p = 0; p < nf; p++)
+        {
+            if (y[p] < 0 && (neg < 0 || y[p] < y[neg]))
+            {
+                neg = p;
+            }
+        }
+        if (neg < 0)
+        {
+            std::fill(x.begin(), x.end(), 0);
+            for (std::int32_t p = 0; p < nf; p++)
+            {
+                x[cols[p]] = y[p] * col_scale[cols[p]];
+            }
+            break;
+        }
+        used[cols[neg]] = false;
+    }
+    
+    r0 = x[0];
+    l0 = x[1];
+    for (std::int32_t j = 0; j < k; j++)
+    {
+        if (x[j + 2] > 0)
+        {
+            rk.push_back(x[j + 2]);
+            lk.push_back(x[j + 2] / wk[j]);
+        }
+    }
+    
+    /* 拟合误差 */
+    double err = 0;
+    for (std::int32_t i = 0; i < m; i++)
+    {
+        double w = 2 * M_PI * freq[i];
+        double re = r0;
+        double im = w * l0;
+        for (std::uint32_t j = 0; j < rk.size(); j++)
+        {
+            double t = w * lk[j] / rk[j];
+            re += rk[j] * t * t / (1 + t * t);
+            im += rk[j] * t / (1 + t * t);
+        }
+        double e = hypot(re - z[i].first, im - z[i].second) / std::max(hypot(z[i].first, z[i].second), 1e-30);
+        err = std::max(err, e);
     }
+    return err;
 }
 
-void fasthenry::_call_fasthenry(std::list<std::string> wire_name)
+bool fasthenry::_call_fasthenry(std::list<std::string> wire_name)
 {
+    if (_dir.empty())
+    {
+        return false;
+    }
+    
     std::string tmp;
     char buf[512];
     
@@ -381,11 +635,11 @@ void fasthenry::_call_fasthenry(std::list<std::string> wire_name)
         tmp += buf;
     }
     
-    sprintf(buf, ".freq fmin=%g fmax=%g ndec=1\n.end\n", _freq, _freq);
+    sprintf(buf, ".freq fmin=%g fmax=%g ndec=%d\n.end\n", _freq, _fmax, _ndec);
     tmp += buf;
     
         
-    FILE *fp = popen("fasthenry > " DEV_NULL, "w");
+    FILE *fp = popen((scratch::cd_cmd(_dir) + "fasthenry > " DEV_NULL).c_str(), "w");
     if (fp)
     {
         fwrite(tmp.c_str(), 1, tmp.length(), fp);
@@ -403,10 +657,16 @@ void fasthenry::_call_fasthenry(std::list<std::string> wire_name)
         
         pclose(fp);
     }
+    return true;
 }
 
-void fasthenry::_call_fasthenry(const std::string& node1_name, const std::string& node2_name)
+bool fasthenry::_call_fasthenry(const std::vector<std::pair<std::string, std::string> >& ports)
 {
+    if (_dir.empty())
+    {
+        return false;
+    }
+    
     std::string tmp;
     char buf[512];
     std::int32_t nwinc = 1;
@@ -419,13 +679,16 @@ void fasthenry::_call_fasthenry(const std::string& node1_name, const std::string
     tmp = buf;
     tmp += _inp;
     
-    sprintf(buf, ".external N%s N%s\n", node1_name.c_str(), node2_name.c_str());
-    tmp += buf;
+    for (const auto& port: ports)
+    {
+        sprintf(buf, ".external N%s N%s\n", port.first.c_str(), port.second.c_str());
+        tmp += buf;
+    }
     
-    sprintf(buf, ".freq fmin=%g fmax=%g ndec=1\n.end\n", _freq, _freq);
+    sprintf(buf, ".freq fmin=%g fmax=%g ndec=%d\n.end\n", _freq, _fmax, _ndec);
     tmp += buf;
     
-    FILE *fp = popen("fasthenry > " DEV_NULL, "w");
+    FILE *fp = popen((scratch::cd_cmd(_dir) + "fasthenry > " DEV_NULL).c_str(), "w");
     if (fp)
     {
         fwrite(tmp.c_str(), 1, tmp.length(), fp);
@@ -444,6 +707,7 @@ void fasthenry::_call_fasthenry(const std::string& node1_name, const std::string
         
         pclose(fp);
     }
+    return true;
 }
 
 
@@ -459,7 +723,7 @@ std::string fasthenry::_make_cir(const std::string& name, std::uint32_t pins)
     }
     cir += "\n";
     
-    FILE *fp = popen("MakeLcircuit Zc.mat", "r");
+    FILE *fp = popen(("MakeLcircuit \"" + scratch::path(_dir, "Zc.mat") + "\"").c_str(), "r");
     while (1)
     {
         if(fgets(buf, sizeof(buf), fp))
@@ -490,7 +754,7 @@ std::vector<fasthenry::impedance_matrix> fasthenry::_read_impedance_matrix()
 #define LINEMAX 4096
     
     char line[LINEMAX];
-    FILE *fp = fopen("Zc.mat", "rb");
+    FILE *fp = fopen(scratch::path(_dir, "Zc.mat").c_str(), "rb");
     if (fp == NULL)
     {
         return {};
@@ -51,7 +51,9 @@ public:
     
 public:
     void clear();
-    void set_freq(float freq) { _freq = freq; }
+    void set_freq(float freq) { _freq = _fmax = freq; _ndec = 1; }
+    /* 扫频 fmin到fmax每十倍频程ndec个点 导体的剖分按fmax的趋肤深度 */
+    void set_freq_sweep(float fmin, float fmax, std::int32_t ndec) { _freq = fmin; _fmax = fmax; _ndec = ndec; }
     void set_conductivity(float conductivity) { _conductivity = conductivity; }
     bool add_node(const std::string& node_name, point p);
     bool add_wire(const char *name, point start, point end, float w, float h);
@@ -63,6 +65,13 @@ public:
     bool add_via(const char *name, point start, point end, float drill, float size);
     bool add_equiv(const std::string& node1_name, const std::string& node2_name);
     bool calc_impedance(const std::string& node1_name, const std::string& node2_name, double& r, double& l);
+    /* 所有端口一次求解 端口i为ports[i].first到ports[i].second
+     * r l按行优先存放 r[i * n + j] l[i * n + j] 对角线为端口自身的电阻电感 其余为互阻互感
+     */
+    bool calc_impedance_matrix(const std::vector<std::pair<std::string, std::string> >& ports, std::vector<double>& r, std::vector<double>& l);
+    /* 返回扫频的每个频点的端口阻抗矩阵 */
+    bool calc_impedance_sweep(const std::vector<std::pair<std::string, std::string> >& ports, std::vector<impedance_matrix>& ims);
+    /* 失败时返回空字符串 */
     std::string gen_ckt(const char *wire_name, const std::string& name);
     
     std::string gen_ckt2(std::list<std::string> wire_names, const std::string& name);
@@ -71,9 +80,16 @@ public:
 public:
     static void calc_wire_lr(float w, float h, float len, float& l, float& r, float conductivity = 5.8e7, float freq = 1e0);
     
+    /* 把扫频阻抗z(实部 虚部)拟合成RL梯形网络 Z = r0 + jwl0 + sum(rk // jwlk)
+     * 每节的转折频率在扫频范围内按对数均匀分布 rk非负保证无源 返回拟合的最大相对误差
+     */
+    static double fit_rl_ladder(const std::vector<double>& freq, const std::vector<std::pair<double, double> >& z, std::int32_t sections,
+                                double& r0, double& l0, std::vector<double>& rk, std::vector<double>& lk);
+    
 private:
-    void _call_fasthenry(std::list<std::string> wire_name);
-    void _call_fasthenry(const std::string& node1_name, const std::string& node2_name);
+    /* 没有独立的临时目录时返回false 不和其他实例共用目录 */
+    bool _call_fasthenry(std::list<std::string> wire_name);
+    bool _call_fasthenry(const std::vector<std::pair<std::string, std::string> >& ports);
     std::string _make_cir(const std::string& name, std::uint32_t pins);
     std::vector<impedance_matrix> _read_impedance_matrix();
     double _calc_inductance(double freq, double imag);
@@ -84,6 +100,10 @@ private:
     std::set<std::string> _equiv;
     float _conductivity;
     float _freq;
+    float _fmax;
+    std::int32_t _ndec;
+    /* 每个实例独立的临时目录 fasthenry总是在当前目录写Zc.mat */
+    std::string _dir;
 };
 
 #endif
\ No newline at end of file
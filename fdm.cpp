@@ -22,18 +22,37 @@
 #endif
 #include <stdio.h>
 #include <math.h>
+#include <cmath>
 #include <set>
+#include <algorithm>
 #include "fdm.h"
 
 #define EPSILON_0 8.854e-12
 
+/* 带状分解允许使用的最大元素个数(double) 超过后退回SOR迭代 */
+#define FDM_DIRECT_MAX_BAND (4 * 1024 * 1024)
+/* 迭代求解时每隔多少次迭代计算一次双精度残差 */
+#define FDM_RESIDUAL_CHECK (16)
+/* 两次检查之间残差至少要下降到这个比例 否则认为停滞 */
+#define FDM_RESIDUAL_STALL (0.99)
+/* 残差小于minR的这个倍数后才做停滞判断 */
+#define FDM_RESIDUAL_FLOOR (100)
+/* 按电荷判断收敛时残差(V 激励为1V)的上限 电荷的相对误差和电位残差不是同一个量
+ * 这里只用来排除SOR电荷暂时停在某个值上的情况 电容的精度由电荷外推的误差保证
+ */
+#define FDM_RESIDUAL_GUARD (1e-4)
+
 fdm::fdm()
     : _h(0)
+    , _uniform(true)
     , _w(1.9)
     , _bc_top(BC_NEUMANN)
     , _bc_bottom(BC_NEUMANN)
     , _bc_left(BC_NEUMANN)
     , _bc_right(BC_NEUMANN)
+    , _direct_solver(true)
+    , _rel_tol(0)
+    , _max_iter(0)
 {
     
 }
@@ -45,8 +64,31 @@ fdm::~fdm()
 void fdm::set_box_size(std::int32_t rows, std::int32_t cols, float h)
 {
     _h = h;
+    _col_w.assign(cols, h);
+    _row_h.assign(rows, h);
+    _uniform = true;
     _material_mat.create(rows, cols);
     _v_mat.create(rows + 1, cols + 1);
+    _invalidate_factor();
+}
+
+void fdm::set_box_size(const std::vector<float>& col_w, const std::vector<float>& row_h)
+{
+    _col_w = col_w;
+    _row_h = row_h;
+    _h = col_w.empty()? 0: col_w[0];
+    _uniform = true;
+    for (auto w: col_w)
+    {
+        _uniform = _uniform && (w == _h);
+    }
+    for (auto h: row_h)
+    {
+        _uniform = _uniform && (h == _h);
+    }
+    _material_mat.create(row_h.size(), col_w.size());
+    _v_mat.create(row_h.size() + 1, col_w.size() + 1);
+    _invalidate_factor();
 }
 
 
@@ -82,12 +124,18 @@ void fdm::update_material(std::uint8_t id, material& material)
 {
     _material_map[id] = material;
     _update_material(id, material);
+    _invalidate_factor();
 }
 
 void fdm::update_metal(std::uint8_t id, float v, std::uint8_t bc)
 {
     if (_material_map[id].type == MATERIAL_METAL)
     {
+        /* 只改变电压时系数矩阵不变 分解结果可以继续使用 */
+        if (_material_map[id].bc != bc)
+        {
+            _invalidate_factor();
+        }
         _material_map[id].v = v;
         _material_map[id].bc = bc;
         _update_material(id, _material_map[id]);
@@ -100,6 +148,7 @@ void fdm::update_dielectric(std::uint8_t id, float er)
     {
         _material_map[id].er = er;
         _update_material(id, _material_map[id]);
+        _ldlt[1].valid = false;
     }
 }
 
@@ -109,97 +158,258 @@ void fdm::set_bc(std::uint8_t top, std::uint8_t bottom, std::uint8_t left, std::
     _bc_bottom = bottom;
     _bc_left = left;
     _bc_right = right;
+    _invalidate_factor();
 }
 
 void fdm::add_point(std::int32_t row, std::int32_t col, std::int8_t id)
 {
     _material_mat.at(row, col) = _material_map[id];
+    _invalidate_factor();
 }
 
 
 void fdm::solver(bool ignore_dielectric)
 {
     _init_voltage();
+    _stats = solver_stats();
     
-    float t = cos(M_PI / _v_mat.rows()) + cos(M_PI / _v_mat.cols());
+    if (_direct_solver && _prepare_direct(ignore_dielectric))
+    {
+        const band_ldlt& f = _ldlt[ignore_dielectric? 0: 1];
+        std::vector<double> x(f.n);
+        _build_rhs(f, ignore_dielectric, x.data(), 1, 0);
+        _direct_solve(f, x.data(), 1);
+        _store_solution(f, x.data(), 1, 0);
+        return;
+    }
+    
+    /* 对称边界时按完整区域的大小计算松弛因子和收敛条件 */
+    std::int32_t cols = (_bc_right == BC_SYMMETRY)? _v_mat.cols() * 2: _v_mat.cols();
+    float t = cos(M_PI / _v_mat.rows()) + cos(M_PI / cols);
     _w = (8 - sqrt(64 - 16 * t *t)) / (t * t);
     //printf("t:%f w:%f\n", t, _w);
     
-    float minR = 1.0 / (_v_mat.rows() * _v_mat.cols());
-    if (ignore_dielectric)
+    /* 需要监视电荷的导体 */
+    std::vector<std::uint8_t> ids;
+    std::vector<double> Q;
+    if (_rel_tol > 0)
     {
-        while (1)
+        for (std::int32_t i = 0; i < 256; i++)
         {
-            float R = _solver_no_er();
-            if (R < minR)
+            if (_material_map[i].type == MATERIAL_METAL && _material_map[i].v != 0)
             {
-                return;
+                ids.push_back(i);
             }
         }
     }
-    else
+    
+    /* 单精度迭代 每次迭代得到的最大修正量只用于快速判断
+     * 每隔FDM_RESIDUAL_CHECK次迭代用双精度计算一次真实残差 小于minR才算收敛
+     * 设置了rel_tol时 导体电荷外推的误差足够小也算收敛 电容只需要电荷 不必等整个电位分布收敛到minR
+     * 设置了max_iter时 超过次数就停止并给出警告
+     * 残差接近minR后连续几次不再下降说明已经到了单精度的极限 再迭代也没有意义
+     */
+    float minR = 1.0 / (_v_mat.rows() * cols);
+    double last = 1e30;
+    double dq_last = 1e30;
+    double est_last = 1e30;
+    std::int32_t stall = 0;
+    _stats.converged = false;
+    _stats.stalled = false;
+    for (std::int32_t iter = 1; ; iter++)
     {
-        while (1)
+        float R = 0;
+        if (!_uniform)
+        {
+            R = _solver_graded(ignore_dielectric);
+        }
+        else if (ignore_dielectric)
+        {
+            R = _solver_no_er();
+        }
+        else
+        {
+            R = _solver_er();
+        }
+        _stats.iterations = iter;
+        
+        bool limit = (_max_iter > 0 && iter >= _max_iter);
+        if (R >= minR && iter % FDM_RESIDUAL_CHECK != 0 && !limit)
         {
-            float R = _solver_er();
-            if (R < minR)
+            continue;
+        }
+        
+        double res = _calc_residual(ignore_dielectric);
+        _stats.residual = res;
+        if (!std::isfinite(res))
+        {
+            printf("warn: fdm: iteration diverged.\n");
+            return;
+        }
+        
+        /* 电荷变化按固定间隔比较 */
+        if (_rel_tol > 0 && iter % FDM_RESIDUAL_CHECK == 0)
+        {
+            /* 电荷按几何级数收敛 用相邻两次的变化量外推剩余的误差 dq^2/(dq_last-dq)
+             * SOR的电荷会有振荡也会暂时停在某个值上 外推值要连续两次小于rel_tol 同时残差也要小于FDM_RESIDUAL_GUARD才算收敛
+             */
+            double dq = _calc_charge_change(ids, Q, ignore_dielectric);
+            double est = (dq < dq_last && dq_last < 1)? dq * dq / (dq_last - dq): 1e30;
+            _stats.dq = std::max(est, est_last);
+            dq_last = dq;
+            est_last = est;
+        }
+        
+        if (res < minR || (_rel_tol > 0 && _stats.dq < _rel_tol && res < std::max((double)minR, FDM_RESIDUAL_GUARD)))
+        {
+            _stats.converged = true;
+            return;
+        }
+        
+        /* 只有残差已经接近minR时才认为是单精度的极限 否则是还没收敛 继续迭代 */
+        stall = (res < last * FDM_RESIDUAL_STALL || res > minR * FDM_RESIDUAL_FLOOR)? 0: stall + 1;
+        last = std::min(last, res);
+        if (stall >= 4)
+        {
+            _stats.stalled = true;
+            if (_rel_tol > 0)
             {
-                return;
+                printf("warn: fdm: stalled after %d iterations above tolerance (residual:%g dq:%g tol:%g).\n", iter, res, _stats.dq, _rel_tol);
             }
+            return;
+        }
+        
+        if (limit)
+        {
+            printf("warn: fdm: not converged after %d iterations (residual:%g dq:%g).\n", iter, res, _stats.dq);
+            return;
         }
     }
 }
 
-float fdm::calc_surface_electric_fields(std::uint8_t id, bool ignore_dielectric)
+double fdm::calc_surface_electric_fields(std::uint8_t id, bool ignore_dielectric)
 {
-    if (ignore_dielectric)
+    double E = 0;
+    if (!_uniform)
     {
-        return _calc_surface_electric_fields_vacuum(id);
+        E = _calc_surface_electric_fields_graded(id, ignore_dielectric);
+    }
+    else if (ignore_dielectric)
+    {
+        E = _calc_surface_electric_fields_vacuum(id);
     }
     else
     {
-        return _calc_surface_electric_fields(id);
+        E = _calc_surface_electric_fields(id);
     }
+    
+    if (_bc_right == BC_SYMMETRY)
+    {
+        E -= _calc_symmetry_axis_fields(id, ignore_dielectric) * 0.5;
+    }
+    return E;
 }
 
 
-float fdm::calc_Q(std::uint8_t id, bool ignore_dielectric)
+double fdm::calc_Q(std::uint8_t id, bool ignore_dielectric)
 {
-    if (ignore_dielectric)
-    {
-        return _calc_surface_electric_fields_vacuum(id) * EPSILON_0;
-    }
-    else
-    {
-        return _calc_surface_electric_fields(id) * EPSILON_0;
-    }
+    return calc_surface_electric_fields(id, ignore_dielectric) * EPSILON_0;
 }
 
 float fdm::calc_capacity(std::uint8_t id1, std::uint8_t id2, bool ignore_dielectric)
 {
     if (ignore_dielectric)
     {
-        float E1 = _calc_surface_electric_fields_vacuum(id1);
-        float E2 = _calc_surface_electric_fields_vacuum(id2);
+        double E1 = _calc_surface_electric_fields_vacuum(id1);
+        double E2 = _calc_surface_electric_fields_vacuum(id2);
         printf("E1:%f E2:%f\n", E1, E2);
-        float Q1 = E1 * EPSILON_0;
-        float Q2 = E2 * EPSILON_0;
+        double Q1 = E1 * EPSILON_0;
+        double Q2 = E2 * EPSILON_0;
         printf("Q1:%g Q2:%g\n", Q1, Q2);
         return Q1 / (_material_map[id1].v - _material_map[id2].v);
     }
     else
     {
-        float E1 = _calc_surface_electric_fields(id1);
-        float E2 = _calc_surface_electric_fields(id2);
+        double E1 = _calc_surface_electric_fields(id1);
+        double E2 = _calc_surface_electric_fields(id2);
         printf("E1:%f E2:%f\n", E1, E2);
-        float Q1 = E1 * EPSILON_0;
-        float Q2 = E2 * EPSILON_0;
+        double Q1 = E1 * EPSILON_0;
+        double Q2 = E2 * EPSILON_0;
         printf("Q1:%g Q2:%g\n", Q1, Q2);
         return Q1 / (_material_map[id1].v - _material_map[id2].v);
     }
     
 }
 
+
+void fdm::calc_capacity_matrix(const std::vector<std::uint8_t>& ids, bool ignore_dielectric, std::vector<double>& C)
+{
+    std::int32_t n = ids.size();
+    C.assign(n * n, 0.);
+    
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        update_metal(ids[i], 0);
+    }
+    
+    _init_voltage();
+    if (_direct_solver && _prepare_direct(ignore_dielectric))
+    {
+        _stats = solver_stats();
+        const band_ldlt& f = _ldlt[ignore_dielectric? 0: 1];
+        std::vector<double> x((std::size_t)f.n * n);
+        
+        /* 每种激励一列右端项 一起回代 */
+        for (std::int32_t k = 0; k < n; k++)
+        {
+            for (std::int32_t i = 0; i < n; i++)
+            {
+                update_metal(ids[i], (i == k)? 1: 0);
+            }
+            _init_voltage();
+            _build_rhs(f, ignore_dielectric, x.data(), n, k);
+        }
+        
+        _direct_solve(f, x.data(), n);
+        
+        for (std::int32_t k = 0; k < n; k++)
+        {
+            for (std::int32_t i = 0; i < n; i++)
+            {
+                update_metal(ids[i], (i == k)? 1: 0);
+            }
+            _init_voltage();
+            _store_solution(f, x.data(), n, k);
+            for (std::int32_t i = 0; i < n; i++)
+            {
+                C[i * n + k] = calc_Q(ids[i], ignore_dielectric);
+            }
+        }
+        return;
+    }
+    
+    /* 统计所有激励 迭代次数累加 残差和误差取最大 */
+    solver_stats total;
+    for (std::int32_t k = 0; k < n; k++)
+    {
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            update_metal(ids[i], (i == k)? 1: 0);
+        }
+        solver(ignore_dielectric);
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            C[i * n + k] = calc_Q(ids[i], ignore_dielectric);
+        }
+        total.iterations += _stats.iterations;
+        total.residual = std::max(total.residual, _stats.residual);
+        total.dq = std::max(total.dq, _stats.dq);
+        total.converged = total.converged && _stats.converged;
+        total.stalled = total.stalled || _stats.stalled;
+    }
+    _stats = total;
+}
+
 void fdm::gen_atlc()
 {
 #if FDM_USE_OPENCV
@@ -479,44 +689,98 @@ void fdm::_init_voltage()
     }
 }
 
+void fdm::_apply_neumann_bc()
+{
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    std::int32_t stride = _v_mat.stride();
+    
+    voltage *top = _v_mat.row_ptr(0);
+    voltage *bottom = _v_mat.row_ptr(rows - 1);
+    for (std::int32_t col = 0; col < cols; col++)
+    {
+        if (top[col].bc == BC_NEUMANN)
+        {
+            top[col].v = top[col + stride].v;
+        }
+        
+        if (bottom[col].bc == BC_NEUMANN)
+        {
+            bottom[col].v = bottom[col - stride].v;
+        }
+    }
+    
+    voltage *mid = _v_mat.row_ptr(0);
+    for (std::int32_t row = 0; row < rows; row++, mid += stride)
+    {
+        if (mid[0].bc == BC_NEUMANN)
+        {
+            mid[0].v = mid[1].v;
+        }
+        if (mid[cols - 1].bc == BC_NEUMANN)
+        {
+            mid[cols - 1].v = mid[cols - 2].v;
+        }
+        else if (mid[cols - 1].bc == BC_SYMMETRY)
+        {
+            mid[cols - 1].v = mid[cols - 3].v;
+        }
+    }
+}
+
 float fdm::_solver_no_er()
 {
     float max_R = 0;
-#if 0
-    float xx = 0.25;
     std::int32_t rows = _v_mat.rows();
     std::int32_t cols = _v_mat.cols();
-    for (std::int32_t row = 1; row < rows - 1; row++)
+    float w = _w;
+    stencil_view<voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
     {
-        voltage *mid = _v_mat.data() + row * cols;
-        voltage *up = mid - cols;
-        voltage *down = mid + cols;
-        
+        const voltage *up = s.up();
+        voltage *mid = s.mid();
+        const voltage *down = s.down();
         for (std::int32_t col = 1; col < cols - 1; col++)
         {
             if (mid[col].bc == BC_NONE)
             {
-                float tmp = (up[col].v + down[col].v + mid[col - 1].v + mid[col + 1].v);
-                float R = tmp / 4 - mid[col].v;
-                mid[col].v = mid[col].v + _w * R;
+                float R = (up[col].v + down[col].v + mid[col - 1].v + mid[col + 1].v) / 4 - mid[col].v;
+                mid[col].v = mid[col].v + w * R;
                 if (R > max_R)
                 {
                     max_R = R;
                 }
             }
-            
         }
     }
-#else
-    for (std::int32_t row = 1; row < _v_mat.rows() - 1; row++)
+    _apply_neumann_bc();
+    return max_R;
+}
+
+float fdm::_solver_er()
+{
+    float max_R = 0;
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    float w = _w;
+    stencil_view<voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
     {
-        for (std::int32_t col = 1; col < _v_mat.cols() - 1; col++)
+        const voltage *up = s.up();
+        voltage *mid = s.mid();
+        const voltage *down = s.down();
+        for (std::int32_t col = 1; col < cols - 1; col++)
         {
-            if (_v_mat.at(row, col).bc == BC_NONE)
+            if (mid[col].bc == BC_NONE)
             {
-                float w = _w;
-                float R = (_v_mat.at(row - 1, col).v + _v_mat.at(row + 1, col).v + _v_mat.at(row, col - 1).v + _v_mat.at(row, col + 1).v) / 4 - _v_mat.at(row, col).v;
-                _v_mat.at(row, col).v = _v_mat.at(row, col).v + w * R;
+                float a0 = mid[col].er + up[col].er + up[col - 1].er + mid[col - 1].er;
+                float a1 = (mid[col].er + up[col].er) * 0.5;
+                float a2 = (up[col].er + up[col - 1].er) * 0.5;
+                float a3 = (up[col - 1].er + mid[col - 1].er) * 0.5;
+                float a4 = (mid[col].er + mid[col - 1].er) * 0.5;
+                
+                float R = (a1 * mid[col + 1].v + a2 * up[col].v + a3 * mid[col - 1].v + a4 * down[col].v) / a0 - mid[col].v;
+                mid[col].v = mid[col].v + w * R;
                 if (R > max_R)
                 {
                     max_R = R;
@@ -524,53 +788,34 @@ float fdm::_solver_no_er()
             }
         }
     }
-#endif
-    for (std::int32_t col = 0; col < _v_mat.cols(); col++)
-    {
-        if (_v_mat.at(0, col).bc == BC_NEUMANN)
-        {
-            _v_mat.at(0, col).v = _v_mat.at(1, col).v;
-        }
-        
-        if (_v_mat.at(_v_mat.rows() - 1, col).bc == BC_NEUMANN)
-        {
-            _v_mat.at(_v_mat.rows() - 1, col).v = _v_mat.at(_v_mat.rows() - 2, col).v;
-        }
-    }
-    
-    for (std::int32_t row = 0; row < _v_mat.rows(); row++)
-    {
-        if (_v_mat.at(row, 0).bc == BC_NEUMANN)
-        {
-            _v_mat.at(row, 1).v = _v_mat.at(row, 1).v;
-        }
-        if (_v_mat.at(row, _v_mat.cols() - 1).bc == BC_NEUMANN)
-        {
-            _v_mat.at(row, _v_mat.cols() - 1).v = _v_mat.at(row, _v_mat.cols() - 2).v;
-        }
-    }
     
+    _apply_neumann_bc();
     return max_R;
 }
 
-float fdm::_solver_er()
+
+float fdm::_solver_graded(bool ignore_dielectric)
 {
     float max_R = 0;
-    for (std::int32_t row = 1; row < _v_mat.rows() - 1; row++)
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    float w = _w;
+    stencil_view<voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
     {
-        for (std::int32_t col = 1; col < _v_mat.cols() - 1; col++)
+        const voltage *up = s.up();
+        voltage *mid = s.mid();
+        const voltage *down = s.down();
+        for (std::int32_t col = 1; col < cols - 1; col++)
         {
-            if (_v_mat.at(row, col).bc == BC_NONE)
+            if (mid[col].bc == BC_NONE)
             {
-                float a0 = _v_mat.at(row, col).er + _v_mat.at(row - 1, col).er + _v_mat.at(row - 1, col - 1).er + _v_mat.at(row, col - 1).er;
-                float a1 = (_v_mat.at(row, col).er + _v_mat.at(row - 1, col).er) * 0.5;
-                float a2 = (_v_mat.at(row - 1, col).er + _v_mat.at(row - 1, col - 1).er) * 0.5;
-                float a3 = (_v_mat.at(row - 1, col - 1).er + _v_mat.at(row, col - 1).er) * 0.5;
-                float a4 = (_v_mat.at(row, col).er + _v_mat.at(row, col - 1).er) * 0.5;
+                float a[4];
+                _node_coeff(row, col, ignore_dielectric, a);
+                float a0 = a[0] + a[1] + a[2] + a[3];
                 
-                float w = _w;
-                float R = (a1 * _v_mat.at(row, col + 1).v + a2 * _v_mat.at(row - 1, col).v + a3 * _v_mat.at(row, col - 1).v + a4 * _v_mat.at(row + 1, col).v) / a0 - _v_mat.at(row, col).v;
-                _v_mat.at(row, col).v = _v_mat.at(row, col).v + w * R;
+                float R = (a[0] * mid[col + 1].v + a[1] * up[col].v + a[2] * mid[col - 1].v + a[3] * down[col].v) / a0 - mid[col].v;
+                mid[col].v = mid[col].v + w * R;
                 if (R > max_R)
                 {
                     max_R = R;
@@ -579,63 +824,95 @@ float fdm::_solver_er()
         }
     }
     
-    for (std::int32_t col = 0; col < _v_mat.cols(); col++)
+    _apply_neumann_bc();
+    return max_R;
+}
+
+double fdm::_calc_residual(bool ignore_dielectric)
+{
+    double max_R = 0;
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    stencil_view<const voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
     {
-        if (_v_mat.at(0, col).bc == BC_NEUMANN)
-        {
-            _v_mat.at(0, col).v = _v_mat.at(1, col).v;
-        }
-        
-        if (_v_mat.at(_v_mat.rows() - 1, col).bc == BC_NEUMANN)
+        const voltage *up = s.up();
+        const voltage *mid = s.mid();
+        const voltage *down = s.down();
+        for (std::int32_t col = 1; col < cols - 1; col++)
         {
-            _v_mat.at(_v_mat.rows() - 1, col).v = _v_mat.at(_v_mat.rows() - 2, col).v;
+            if (mid[col].bc != BC_NONE)
+            {
+                continue;
+            }
+            float a[4];
+            _node_coeff(row, col, ignore_dielectric, a);
+            double a0 = (double)a[0] + a[1] + a[2] + a[3];
+            double R = ((double)a[0] * mid[col + 1].v + (double)a[1] * up[col].v
+                        + (double)a[2] * mid[col - 1].v + (double)a[3] * down[col].v) / a0 - mid[col].v;
+            max_R = std::max(max_R, fabs(R));
         }
     }
+    return max_R;
+}
+
+double fdm::_calc_charge_change(const std::vector<std::uint8_t>& ids, std::vector<double>& Q, bool ignore_dielectric)
+{
+    bool first = Q.empty();
+    Q.resize(ids.size(), 0.);
     
-    for (std::int32_t row = 0; row < _v_mat.rows(); row++)
+    double dq = 0;
+    for (std::size_t i = 0; i < ids.size(); i++)
     {
-        if (_v_mat.at(row, 0).bc == BC_NEUMANN)
+        double q = calc_Q(ids[i], ignore_dielectric);
+        if (q != 0)
         {
-            _v_mat.at(row, 0).v = _v_mat.at(row, 1).v;
-        }
-        if (_v_mat.at(row, _v_mat.cols() - 1).bc == BC_NEUMANN)
-        {
-            _v_mat.at(row, _v_mat.cols() - 1).v = _v_mat.at(row, _v_mat.cols() - 2).v;
+            dq = std::max(dq, fabs(q - Q[i]) / fabs(q));
         }
+        Q[i] = q;
     }
-    
-    return max_R;
+    return first? 1e30: dq;
 }
 
-
-float fdm::_calc_surface_electric_fields(std::uint8_t id)
+double fdm::_calc_surface_electric_fields(std::uint8_t id)
 {
-    float E = 0;
-    for (std::int32_t col = 1; col < _v_mat.cols() - 1; col++)
+    double E = 0;
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    stencil_view<const voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
     {
-        for (std::int32_t row = 1; row < _v_mat.rows() - 1; row++)
+        const voltage *up = s.up();
+        const voltage *mid = s.mid();
+        const voltage *down = s.down();
+        for (std::int32_t col = 1; col < cols - 1; col++)
         {
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row, col + 1).id != id)
+            if (mid[col].id != id)
             {
-                float er = (_v_mat.at(row, col).er + _v_mat.at(row - 1, col).er) * 0.5;
-                E += (_v_mat.at(row, col).v - _v_mat.at(row, col + 1).v) * er / _h;
+                continue;
             }
             
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row, col - 1).id != id)
+            if (mid[col + 1].id != id)
             {
-                float er = (_v_mat.at(row, col - 1).er + _v_mat.at(row - 1, col - 1).er) * 0.5;
-                E += (_v_mat.at(row, col).v - _v_mat.at(row, col - 1).v) * er / _h;
+                float er = (mid[col].er + up[col].er) * 0.5;
+                E += (mid[col].v - mid[col + 1].v) * er / _h;
             }
             
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row + 1, col).id != id)
+            if (mid[col - 1].id != id)
             {
-                float er = (_v_mat.at(row, col).er + _v_mat.at(row, col - 1).er) * 0.5;
-                E += (_v_mat.at(row, col).v - _v_mat.at(row + 1, col).v) * er / _h;
+                float er = (mid[col - 1].er + up[col - 1].er) * 0.5;
+                E += (mid[col].v - mid[col - 1].v) * er / _h;
             }
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row - 1, col).id != id)
+            
+            if (down[col].id != id)
             {
-                float er = (_v_mat.at(row - 1, col).er + _v_mat.at(row - 1, col - 1).er) * 0.5;
-                E += (_v_mat.at(row, col).v - _v_mat.at(row - 1, col).v) * er / _h;
+                float er = (mid[col].er + mid[col - 1].er) * 0.5;
+                E += (mid[col].v - down[col].v) * er / _h;
+            }
+            if (up[col].id != id)
+            {
+                float er = (up[col].er + up[col - 1].er) * 0.5;
+                E += (mid[col].v - up[col].v) * er / _h;
             }
         }
     }
@@ -643,45 +920,42 @@ float fdm::_calc_surface_electric_fields(std::uint8_t id)
     return E * _h;
 }
 
-float fdm::_calc_surface_electric_fields_vacuum(std::uint8_t id)
+double fdm::_calc_surface_electric_fields_vacuum(std::uint8_t id)
 {
-    float E = 0;
-    for (std::int32_t col = 1; col < _v_mat.cols() - 1; col++)
+    double E = 0;
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    stencil_view<const voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
     {
-        for (std::int32_t row = 1; row < _v_mat.rows() - 1; row++)
+        const voltage *up = s.up();
+        const voltage *mid = s.mid();
+        const voltage *down = s.down();
+        for (std::int32_t col = 1; col < cols - 1; col++)
         {
-        #if 0
-            if (_v_mat.at(row, col).id == id)
+            if (mid[col].id != id)
             {
-                float Ux1 = _v_mat.at(row, col).v - _v_mat.at(row, col + 1).v;
-                float Ux2 = _v_mat.at(row, col).v - _v_mat.at(row, col - 1).v;
-                float Uy1 = _v_mat.at(row, col).v - _v_mat.at(row + 1, col).v;
-                float Uy2 = _v_mat.at(row, col).v - _v_mat.at(row - 1, col).v;
-                
-                E += (Ux1 / _h + Ux2 / _h + Uy1 / _h + Uy2 / _h);
-                //printf("Ux1:%g Ux2:%g Uy1:%g Uy2:%g\n", Ux1 / _h, Ux2 / _h, Uy1 / _h, Uy2 / _h);
+                continue;
             }
-        #else
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row, col + 1).id != id)
+            
+            if (mid[col + 1].id != id)
             {
-                E += (_v_mat.at(row, col).v - _v_mat.at(row, col + 1).v) / _h;
+                E += (mid[col].v - mid[col + 1].v) / _h;
             }
             
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row, col - 1).id != id)
+            if (mid[col - 1].id != id)
             {
-                E += (_v_mat.at(row, col).v - _v_mat.at(row, col - 1).v) / _h;
+                E += (mid[col].v - mid[col - 1].v) / _h;
             }
             
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row + 1, col).id != id)
+            if (down[col].id != id)
             {
-                E += (_v_mat.at(row, col).v - _v_mat.at(row + 1, col).v) / _h;
+                E += (mid[col].v - down[col].v) / _h;
             }
-            if (_v_mat.at(row, col).id == id && _v_mat.at(row - 1, col).id != id)
+            if (up[col].id != id)
             {
-                E += (_v_mat.at(row, col).v - _v_mat.at(row - 1, col).v) / _h;
+                E += (mid[col].v - up[col].v) / _h;
             }
-        #endif
-        
         }
     }
     return E * _h;
@@ -725,6 +999,72 @@ float fdm::_calc_surface_electric_fields_vacuum(std::uint8_t id)
 #endif
 }
 
+double fdm::_calc_surface_electric_fields_graded(std::uint8_t id, bool ignore_dielectric)
+{
+    /* 非均匀网格下每条边的系数已经包含了 边长/间距 累加后直接就是电场的积分 */
+    double E = 0;
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    stencil_view<const voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
+    {
+        const voltage *up = s.up();
+        const voltage *mid = s.mid();
+        const voltage *down = s.down();
+        for (std::int32_t col = 1; col < cols - 1; col++)
+        {
+            if (mid[col].id != id)
+            {
+                continue;
+            }
+            
+            float a[4];
+            _node_coeff(row, col, ignore_dielectric, a);
+            /* 右 上 左 下 */
+            const voltage *nv[4] = {mid + col + 1, up + col, mid + col - 1, down + col};
+            for (std::int32_t k = 0; k < 4; k++)
+            {
+                if (nv[k]->id != id)
+                {
+                    E += (mid[col].v - nv[k]->v) * a[k];
+                }
+            }
+        }
+    }
+    return E;
+}
+
+double fdm::_calc_symmetry_axis_fields(std::uint8_t id, bool ignore_dielectric)
+{
+    /* 对称轴上的点 右边的一半属于镜像区域 */
+    double E = 0;
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t col = _v_mat.cols() - 2;
+    stencil_view<const voltage> s(_v_mat, 1);
+    for (std::int32_t row = 1; row < rows - 1; row++, s.next_row())
+    {
+        const voltage *up = s.up();
+        const voltage *mid = s.mid();
+        const voltage *down = s.down();
+        if (mid[col].id != id)
+        {
+            continue;
+        }
+        
+        float a[4];
+        _node_coeff(row, col, ignore_dielectric, a);
+        const voltage *nv[4] = {mid + col + 1, up + col, mid + col - 1, down + col};
+        for (std::int32_t k = 0; k < 4; k++)
+        {
+            if (nv[k]->id != id)
+            {
+                E += (mid[col].v - nv[k]->v) * a[k];
+            }
+        }
+    }
+    return E;
+}
+
 void fdm::_update_material(std::uint8_t id, material& material)
 {
     for (std::int32_t col = 0; col < _material_mat.cols(); col++)
@@ -737,4 +1077,310 @@ void fdm::_update_material(std::uint8_t id, material& material)
             }
         }
     }
-}
\ No newline at end of file
+}
+
+
+std::int32_t fdm::_node_index(const band_ldlt& f, std::int32_t row, std::int32_t col)
+{
+    /* 沿较短的方向编号 使带宽最小 */
+    if (f.transpose)
+    {
+        return (col - 1) * f.bw + row - 1;
+    }
+    return (row - 1) * f.bw + col - 1;
+}
+
+
+void fdm::_node_coeff(std::int32_t row, std::int32_t col, bool ignore_dielectric, float a[4])
+{
+    /* 右 上 左 下 与_solver_er中的a1 a2 a3 a4相同 */
+    if (_uniform)
+    {
+        if (ignore_dielectric)
+        {
+            a[0] = a[1] = a[2] = a[3] = 1;
+            return;
+        }
+        const voltage *up = _v_mat.row_ptr(row - 1);
+        const voltage *mid = up + _v_mat.stride();
+        a[0] = (mid[col].er + up[col].er) * 0.5;
+        a[1] = (up[col].er + up[col - 1].er) * 0.5;
+        a[2] = (up[col - 1].er + mid[col - 1].er) * 0.5;
+        a[3] = (mid[col].er + mid[col - 1].er) * 0.5;
+        return;
+    }
+    
+    /* 非均匀网格 每条边的系数为 对偶单元的边长 * er / 两节点的间距 */
+    float hu = _row_h[row - 1];
+    float hd = _row_h[row];
+    float wl = _col_w[col - 1];
+    float wr = _col_w[col];
+    
+    float er_ul = 1;
+    float er_ur = 1;
+    float er_dl = 1;
+    float er_dr = 1;
+    if (!ignore_dielectric)
+    {
+        const voltage *up = _v_mat.row_ptr(row - 1);
+        const voltage *mid = up + _v_mat.stride();
+        er_ul = up[col - 1].er;
+        er_ur = up[col].er;
+        er_dl = mid[col - 1].er;
+        er_dr = mid[col].er;
+    }
+    a[0] = (er_ur * hu + er_dr * hd) * 0.5 / wr;
+    a[1] = (er_ul * wl + er_ur * wr) * 0.5 / hu;
+    a[2] = (er_ul * hu + er_dl * hd) * 0.5 / wl;
+    a[3] = (er_dl * wl + er_dr * wr) * 0.5 / hd;
+}
+
+
+bool fdm::_factor(band_ldlt& f, bool ignore_dielectric)
+{
+    static const std::int32_t drow[4] = {0, -1, 0, 1};
+    static const std::int32_t dcol[4] = {1, 0, -1, 0};
+    
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    f.band.clear();
+    if (rows < 3 || cols < 3)
+    {
+        return false;
+    }
+    
+    f.transpose = cols > rows;
+    f.bw = f.transpose? rows - 2: cols - 2;
+    f.n = (rows - 2) * (cols - 2);
+    if ((std::int64_t)f.n * (f.bw + 1) > FDM_DIRECT_MAX_BAND)
+    {
+        return false;
+    }
+    
+    std::int32_t w = f.bw + 1;
+    f.band.assign((std::size_t)f.n * w, 0.);
+    
+    /* 组装下三角 电压固定的节点为单位行 与其相邻的项移到右端 */
+    for (std::int32_t row = 1; row < rows - 1; row++)
+    {
+        for (std::int32_t col = 1; col < cols - 1; col++)
+        {
+            std::int32_t i = _node_index(f, row, col);
+            double *Li = &f.band[(std::size_t)i * w];
+            if (_v_mat.at(row, col).bc != BC_NONE)
+            {
+                Li[0] = 1;
+                continue;
+            }
+            
+            float a[4];
+            _node_coeff(row, col, ignore_dielectric, a);
+            
+            /* 对称轴上的行乘以0.5 使矩阵保持对称 */
+            double scale = _is_symmetry_axis(col)? 0.5: 1;
+            double d = 0;
+            for (std::int32_t k = 0; k < 4; k++)
+            {
+                std::int32_t nrow = row + drow[k];
+                std::int32_t ncol = col + dcol[k];
+                d += a[k] * scale;
+                if (_v_mat.at(nrow, ncol).bc == BC_SYMMETRY)
+                {
+                    ncol -= 2;
+                }
+                else if (nrow == 0 || nrow == rows - 1 || ncol == 0 || ncol == cols - 1)
+                {
+                    /* 诺依曼边界上的点等于当前点 */
+                    if (_v_mat.at(nrow, ncol).bc == BC_NEUMANN)
+                    {
+                        d -= a[k] * scale;
+                    }
+                    continue;
+                }
+                
+                if (_v_mat.at(nrow, ncol).bc != BC_NONE)
+                {
+                    continue;
+                }
+                
+                std::int32_t j = _node_index(f, nrow, ncol);
+                if (j < i)
+                {
+                    Li[i - j] -= a[k] * scale;
+                }
+            }
+            Li[0] = d;
+        }
+    }
+    
+    /* 原地分解 t[k] = L(i, k) * D(k) */
+    std::vector<double> t(w);
+    for (std::int32_t i = 0; i < f.n; i++)
+    {
+        double *Li = &f.band[(std::size_t)i * w];
+        std::int32_t j0 = std::max(0, i - f.bw);
+        for (std::int32_t j = j0; j < i; j++)
+        {
+            const double *Lj = &f.band[(std::size_t)j * w];
+            double s = Li[i - j];
+            for (std::int32_t k = j0; k < j; k++)
+            {
+                s -= t[k - j0] * Lj[j - k];
+            }
+            Li[i - j] = s / Lj[0];
+            t[j - j0] = Li[i - j] * Lj[0];
+        }
+        
+        double d = Li[0];
+        for (std::int32_t k = j0; k < i; k++)
+        {
+            d -= t[k - j0] * Li[i - k];
+        }
+        
+        /* 没有连接到固定电压的孤立区域 矩阵奇异 */
+        if (!(d > 0))
+        {
+            f.band.clear();
+            return false;
+        }
+        Li[0] = d;
+    }
+    return true;
+}
+
+
+void fdm::_build_rhs(const band_ldlt& f, bool ignore_dielectric, double *b, std::int32_t m, std::int32_t k)
+{
+    static const std::int32_t drow[4] = {0, -1, 0, 1};
+    static const std::int32_t dcol[4] = {1, 0, -1, 0};
+    
+    std::int32_t rows = _v_mat.rows();
+    std::int32_t cols = _v_mat.cols();
+    for (std::int32_t row = 1; row < rows - 1; row++)
+    {
+        for (std::int32_t col = 1; col < cols - 1; col++)
+        {
+            std::int32_t i = _node_index(f, row, col);
+            if (_v_mat.at(row, col).bc != BC_NONE)
+            {
+                b[(std::size_t)i * m + k] = _v_mat.at(row, col).v;
+                continue;
+            }
+            
+            float a[4];
+            _node_coeff(row, col, ignore_dielectric, a);
+            double scale = _is_symmetry_axis(col)? 0.5: 1;
+            double s = 0;
+            for (std::int32_t n = 0; n < 4; n++)
+            {
+                std::int32_t nrow = row + drow[n];
+                std::int32_t ncol = col + dcol[n];
+                if (_v_mat.at(nrow, ncol).bc == BC_SYMMETRY)
+                {
+                    ncol -= 2;
+                }
+                else if (nrow == 0 || nrow == rows - 1 || ncol == 0 || ncol == cols - 1)
+                {
+                    const voltage& nv = _v_mat.at(nrow, ncol);
+                    if (nv.bc != BC_NEUMANN)
+                    {
+                        s += a[n] * nv.v;
+                    }
+                    continue;
+                }
+                
+                const voltage& nv = _v_mat.at(nrow, ncol);
+                if (nv.bc != BC_NONE)
+                {
+                    s += a[n] * nv.v;
+                }
+            }
+            b[(std::size_t)i * m + k] = s * scale;
+        }
+    }
+}
+
+
+void fdm::_direct_solve(const band_ldlt& f, double *x, std::int32_t m)
+{
+    std::int32_t w = f.bw + 1;
+    
+    /* L y = b */
+    for (std::int32_t i = 0; i < f.n; i++)
+    {
+        const double *Li = &f.band[(std::size_t)i * w];
+        double *xi = x + (std::size_t)i * m;
+        for (std::int32_t j = std::max(0, i - f.bw); j < i; j++)
+        {
+            double l = Li[i - j];
+            if (l == 0)
+            {
+                continue;
+            }
+            const double *xj = x + (std::size_t)j * m;
+            for (std::int32_t k = 0; k < m; k++)
+            {
+                xi[k] -= l * xj[k];
+            }
+        }
+    }
+    
+    /* D z = y */
+    for (std::int32_t i = 0; i < f.n; i++)
+    {
+        double d = f.band[(std::size_t)i * w];
+        for (std::int32_t k = 0; k < m; k++)
+        {
+            x[(std::size_t)i * m + k] /= d;
+        }
+    }
+    
+    /* LT x = z */
+    for (std::int32_t i = f.n - 1; i >= 0; i--)
+    {
+        double *xi = x + (std::size_t)i * m;
+        std::int32_t j_end = std::min(f.n - 1, i + f.bw);
+        for (std::int32_t j = i + 1; j <= j_end; j++)
+        {
+            double l = f.band[(std::size_t)j * w + j - i];
+            if (l == 0)
+            {
+                continue;
+            }
+            const double *xj = x + (std::size_t)j * m;
+            for (std::int32_t k = 0; k < m; k++)
+            {
+                xi[k] -= l * xj[k];
+            }
+        }
+    }
+}
+
+
+void fdm::_store_solution(const band_ldlt& f, const double *x, std::int32_t m, std::int32_t k)
+{
+    for (std::int32_t row = 1; row < _v_mat.rows() - 1; row++)
+    {
+        for (std::int32_t col = 1; col < _v_mat.cols() - 1; col++)
+        {
+            voltage& v = _v_mat.at(row, col);
+            if (v.bc == BC_NONE)
+            {
+                v.v = x[(std::size_t)_node_index(f, row, col) * m + k];
+            }
+        }
+    }
+    _apply_neumann_bc();
+}
+
+
+bool fdm::_prepare_direct(bool ignore_dielectric)
+{
+    band_ldlt& f = _ldlt[ignore_dielectric? 0: 1];
+    if (!f.valid)
+    {
+        f.valid = true;
+        _factor(f, ignore_dielectric);
+    }
+    return !f.band.empty();
+}
@@ -20,6 +20,7 @@
 #define __FDM_H__
 
 #include <map>
+#include <vector>
 #include "matrix.h"
 
 class fdm
@@ -29,7 +30,9 @@ public:
     {
         BC_NONE,
         BC_NEUMANN,
-        BC_DIRICHLET
+        BC_DIRICHLET,
+        /* 对称边界 边界上的点等于往里数第二个点 对称轴在往里第一个点上 目前只用于右边界 */
+        BC_SYMMETRY
     };
     
     enum
@@ -69,11 +72,34 @@ public:
         std::uint8_t er_id;
     };
     
+    /* 最近一次求解的统计 直接求解时iterations为0 calc_capacity_matrix为所有激励的合计 */
+    struct solver_stats
+    {
+        solver_stats()
+            : iterations(0)
+            , residual(0)
+            , dq(0)
+            , converged(true)
+            , stalled(false)
+        {
+        }
+        std::int32_t iterations;
+        /* 最后一次检查时的双精度残差 */
+        double residual;
+        /* 由最后几次检查之间带电导体电荷的变化外推的剩余相对误差 */
+        double dq;
+        bool converged;
+        /* 残差到了单精度的极限不再下降而停止 没有达到收敛条件 converged为false */
+        bool stalled;
+    };
+    
 public:
     fdm();
     ~fdm();
 public:
     void set_box_size(std::int32_t rows, std::int32_t cols, float h);
+    /* 非均匀网格 col_w为每一列的宽度 row_h为每一行的高度 */
+    void set_box_size(const std::vector<float>& col_w, const std::vector<float>& row_h);
     void add_material(std::uint8_t id, material& material);
     void add_metal(std::uint8_t id, float v = 0, std::uint8_t bc = BC_DIRICHLET);
     void add_dielectric(std::uint8_t id, float er);
@@ -87,21 +113,67 @@ public:
     
     void solver(bool ignore_dielectric = false);
     
-    float calc_surface_electric_fields(std::uint8_t id, bool ignore_dielectric = false);
-    float calc_Q(std::uint8_t id, bool ignore_dielectric = false);
+    /* 使用带状LDLT直接求解 同一几何结构只分解一次 之后每次激励只需回代 */
+    void enable_direct_solver(bool b) { _direct_solver = b; }
+    
+    /* 迭代求解的收敛条件 rel_tol大于0时 外推的带电导体电荷相对误差小于rel_tol且残差小于一个固定上限即认为收敛
+     * max_iter大于0时最多迭代max_iter次 都为0时只按残差判断
+     */
+    void set_convergence(double rel_tol, std::int32_t max_iter) { _rel_tol = rel_tol; _max_iter = max_iter; }
+    const solver_stats& get_stats() { return _stats; }
+    
+    /* 右边界为BC_SYMMETRY时 返回的是左半区域的电荷 对称轴上的点只算一半 */
+    /* 电场积分和电荷用双精度累加 */
+    double calc_surface_electric_fields(std::uint8_t id, bool ignore_dielectric = false);
+    double calc_Q(std::uint8_t id, bool ignore_dielectric = false);
     
     float calc_capacity(std::uint8_t id1, std::uint8_t id2, bool ignore_dielectric);
+    
+    /* 计算ids中导体的电容矩阵 依次将每个导体设置为1V其余为0V 所有激励一起回代求解
+     * C按行优先存放 C[i * n + j] 为导体j激励时导体i上的电荷
+     */
+    void calc_capacity_matrix(const std::vector<std::uint8_t>& ids, bool ignore_dielectric, std::vector<double>& C);
     void gen_atlc();
     void dump_V();
     void dump_E();
     void dump_E2();
     
+private:
+    /* 带状LDLT分解 band[i * (bw + 1)] 为D(i) band[i * (bw + 1) + k] 为L(i, i - k) */
+    struct band_ldlt
+    {
+        band_ldlt(): valid(false), n(0), bw(0), transpose(false) {}
+        bool valid;
+        std::int32_t n;
+        std::int32_t bw;
+        bool transpose;
+        std::vector<double> band;
+    };
+    
 private:
     void _init_voltage();
+    void _apply_neumann_bc();
     float _solver_no_er();
     float _solver_er();
-    float _calc_surface_electric_fields(std::uint8_t id);
-    float _calc_surface_electric_fields_vacuum(std::uint8_t id);
+    float _solver_graded(bool ignore_dielectric);
+    /* 双精度计算的最大残差 迭代使用单精度 是否收敛以这个为准 */
+    double _calc_residual(bool ignore_dielectric);
+    /* Q为上一次检查时各导体的电荷 返回最大相对变化并更新Q Q为空时返回一个很大的值 */
+    double _calc_charge_change(const std::vector<std::uint8_t>& ids, std::vector<double>& Q, bool ignore_dielectric);
+    
+    std::int32_t _node_index(const band_ldlt& f, std::int32_t row, std::int32_t col);
+    void _node_coeff(std::int32_t row, std::int32_t col, bool ignore_dielectric, float a[4]);
+    bool _factor(band_ldlt& f, bool ignore_dielectric);
+    void _build_rhs(const band_ldlt& f, bool ignore_dielectric, double *b, std::int32_t m, std::int32_t k);
+    void _direct_solve(const band_ldlt& f, double *x, std::int32_t m);
+    void _store_solution(const band_ldlt& f, const double *x, std::int32_t m, std::int32_t k);
+    bool _prepare_direct(bool ignore_dielectric);
+    void _invalidate_factor() { _ldlt[0].valid = _ldlt[1].valid = false; }
+    bool _is_symmetry_axis(std::int32_t col) { return _bc_right == BC_SYMMETRY && col == _v_mat.cols() - 2; }
+    double _calc_surface_electric_fields(std::uint8_t id);
+    double _calc_surface_electric_fields_vacuum(std::uint8_t id);
+    double _calc_surface_electric_fields_graded(std::uint8_t id, bool ignore_dielectric);
+    double _calc_symmetry_axis_fields(std::uint8_t id, bool ignore_dielectric);
     void _update_material(std::uint8_t id, material& material);
     
 private:
@@ -109,11 +181,23 @@ private:
     matrix<material> _material_mat;
     matrix<voltage> _v_mat;
     float _h;
+    /* 每一列的宽度 每一行的高度 */
+    std::vector<float> _col_w;
+    std::vector<float> _row_h;
+    bool _uniform;
     float _w;
     std::uint8_t _bc_top;
     std::uint8_t _bc_bottom;
     std::uint8_t _bc_left;
     std::uint8_t _bc_right;
+    
+    bool _direct_solver;
+    /* 0:真空 1:电介质 */
+    band_ldlt _ldlt[2];
+    
+    double _rel_tol;
+    std::int32_t _max_iter;
+    solver_stats _stats;
 };
 
 #endif
\ No newline at end of file
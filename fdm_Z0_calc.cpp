@@ -17,9 +17,17 @@
 *****************************************************************************/
 
 #include <string.h>
+#include <algorithm>
 #include "fdm_Z0_calc.h"
 
-static void row_vector_mul_add(float *dst_vector, const float *a_vector, float b, const float *c_vector, std::int32_t n)
+#define log_info(fmt, args...) printf(fmt, ##args)
+
+/* 非均匀网格相邻单元的最大增长比例 */
+#define FDM_MESH_GRADING (1.15)
+/* 非均匀网格单元的最大尺寸(像素) */
+#define FDM_MESH_MAX_STEP (16)
+
+static void row_vector_mul_add(double *dst_vector, const double *a_vector, double b, const double *c_vector, std::int32_t n)
 {
     for (std::int32_t i = 0; i < n; i++)
     {
@@ -27,7 +35,7 @@ static void row_vector_mul_add(float *dst_vector, const float *a_vector, float b
     }
 }
 
-static void row_vector_div(float *dst_vector, const float *a_vector, float b, std::int32_t n)
+static void row_vector_div(double *dst_vector, const double *a_vector, double b, std::int32_t n)
 {
     for (std::int32_t i = 0; i < n; i++)
     {
@@ -36,17 +44,17 @@ static void row_vector_div(float *dst_vector, const float *a_vector, float b, st
 }
 
 
-static void matrix_swap_row(float *matrix, std::int32_t rows, std::int32_t cols, std::int32_t row1, std::int32_t row2)
+static void matrix_swap_row(double *matrix, std::int32_t rows, std::int32_t cols, std::int32_t row1, std::int32_t row2)
 {
     for (std::int32_t col = 0; col < cols; col++)
     {
-        float tmp = matrix[row1 * cols + col];
+        double tmp = matrix[row1 * cols + col];
         matrix[row1 * cols + col] = matrix[row2 * cols + col];
         matrix[row2 * cols + col] = tmp;
     }
 }
 
-static void matrix_mul(float *dst_matrix, float *a_matrix, float b, std::int32_t rows, std::int32_t cols)
+static void matrix_mul(double *dst_matrix, double *a_matrix, double b, std::int32_t rows, std::int32_t cols)
 {
     for (std::int32_t row = 0; row < rows; row++)
     {
@@ -57,7 +65,7 @@ static void matrix_mul(float *dst_matrix, float *a_matrix, float b, std::int32_t
     }
 }
 
-static bool matrix_invert(float *matrix, float *invert, std::int32_t rows, std::int32_t cols)
+static bool matrix_invert(double *matrix, double *invert, std::int32_t rows, std::int32_t cols)
 {
     if (rows != cols)
     {
@@ -107,7 +115,7 @@ static bool matrix_invert(float *matrix, float *invert, std::int32_t rows, std::
         
         for (std::int32_t row = pivot_row + 1; row < rows; row++)
         {
-            float a = matrix[row * cols + col] / matrix[pivot_row * cols + col];
+            double a = matrix[row * cols + col] / matrix[pivot_row * cols + col];
             row_vector_mul_add(matrix + row * cols, matrix + pivot_row * cols, -a , matrix + row * cols, cols);
             row_vector_mul_add(invert + row * cols, invert + pivot_row * cols, -a , invert + row * cols, cols);
         }
@@ -142,7 +150,7 @@ static bool matrix_invert(float *matrix, float *invert, std::int32_t rows, std::
         
         for (std::int32_t row = pivot_row - 1; row >= 0; row--)
         {
-            float a = matrix[row * cols + col] / matrix[pivot_row * cols + col];
+            double a = matrix[row * cols + col] / matrix[pivot_row * cols + col];
             row_vector_mul_add(matrix + row * cols, matrix + pivot_row * cols, -a , matrix + row * cols, cols);
             row_vector_mul_add(invert + row * cols, invert + pivot_row * cols, -a , invert + row * cols, cols);
         }
@@ -156,7 +164,7 @@ static bool matrix_invert(float *matrix, float *invert, std::int32_t rows, std::
         {
             continue;
         }
-        float a = matrix[row * cols + row];
+        double a = matrix[row * cols + row];
         row_vector_div(matrix + row * cols, matrix + row * cols, a, cols);
         row_vector_div(invert + row * cols, invert + row * cols, a, cols);
     }
@@ -172,8 +180,11 @@ fdm_Z0_calc::fdm_Z0_calc()
     , _c_x(_box_w / 2)
     , _c_y(_box_h / 3)
     , _fdm_er_id(FDM_ID_ER)
+    , _graded_mesh(true)
+    , _ground_walls(false)
+    , _rel_tol(0)
+    , _max_iter(0)
 {
-    _last_img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(0, 0, 0));
     clean();
 }
 
@@ -199,7 +210,7 @@ void fdm_Z0_calc::set_box_size(float w, float h)
 
 void fdm_Z0_calc::clean()
 {
-    _img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(255, 255, 255));
+    _xs.clear(_unit2pix(_box_h), _box_cols());
     _er_map.clear();
     _fdm_er_id = FDM_ID_ER;
     
@@ -214,7 +225,7 @@ void fdm_Z0_calc::clean()
 void fdm_Z0_calc::clean_all()
 {
     clean();
-    _last_img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(0, 0, 0));
+    _last_xs.clear();
     _Zo = 0;
     _c = 0;
     _l = 0;
@@ -281,7 +292,8 @@ bool fdm_Z0_calc::calc_Z0(float& Zo, float& v, float& c, float& l, float& r, flo
     r = g = 0;
     
     r = 1.0 / (_wire_w * _wire_h * _wire_conductivity);
-    if (_is_some(_last_img, _img))
+    _add_ground_walls();
+    if (_xs.is_same(_last_xs, _unit2pix(4 * 0.0254)))
     {
         Zo = _Zo;
         c = _c;
@@ -289,7 +301,8 @@ bool fdm_Z0_calc::calc_Z0(float& Zo, float& v, float& c, float& l, float& r, flo
         v = _v;
         return true;
     }
-    _last_img = _img;
+    _last_xs = _xs;
+    _xs.render(_img);
     
     _calc_Z0(_img, Zo, v, c, l, r, g);
     return false;
@@ -302,7 +315,8 @@ bool fdm_Z0_calc::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2
     r_matrix[0][0] = 1.0 / (_wire_w * _wire_h * _wire_conductivity);
     r_matrix[1][1] = 1.0 / (_coupler_w * _coupler_h * _coupler_conductivity);
     
-    if (_is_some(_last_img, _img))
+    _add_ground_walls();
+    if (_xs.is_same(_last_xs, _unit2pix(4 * 0.0254)))
     {
         Zodd = _Zodd;
         Zeven = _Zeven;
@@ -312,62 +326,28 @@ bool fdm_Z0_calc::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2
         return true;
     }
     
-    _last_img = _img;
+    _last_xs = _xs;
+    _xs.render(_img);
     
     
-    const float EPS0 = 8.85419e-12;
-    const float MUE0 = 4 * M_PI * 1e-7;
-    fdm fdm;
-    _init_fdm(fdm, _img);
-    float C_vacuum[4] = {0, 0, 0, 0};
-    float L[4] = {0, 0, 0, 0};
-    float C[4] = {0, 0, 0, 0};
+    const double EPS0 = 8.85419e-12;
+    const double MUE0 = 4 * M_PI * 1e-7;
+    /* 耦合线的电容电感矩阵在双精度下求逆和相减 C11 - C12很接近时单精度会丢掉有效位 */
+    double C_vacuum[4] = {0, 0, 0, 0};
+    double L[4] = {0, 0, 0, 0};
+    double C[4] = {0, 0, 0, 0};
     
     /* 计算真空中导体电容矩阵 (忽略介电常数) */
-    {
-        float C11 = 0;
-        float C12 = 0;
-        float C21 = 0;
-        float C22 = 0;
-        
-        /* 计算C11 C21*/
-        fdm.update_metal(FDM_ID_METAL_COND1, 1);
-        fdm.update_metal(FDM_ID_METAL_COND2, 0);
-        
-        fdm.solver(true);
-        
-        float Q1 = fdm.calc_Q(FDM_ID_METAL_COND1, true);
-        float Q2 = fdm.calc_Q(FDM_ID_METAL_COND2, true);
-        
-        C11 = Q1;
-        C21 = Q2;
-        
-        
-        /* 计算C22 C12*/
-        fdm.update_metal(FDM_ID_METAL_COND1, 0);
-        fdm.update_metal(FDM_ID_METAL_COND2, 1);
-        
-        fdm.solver(true);
-        
-        Q1 = fdm.calc_Q(FDM_ID_METAL_COND1, true);
-        Q2 = fdm.calc_Q(FDM_ID_METAL_COND2, true);
-        C12 = Q1;
-        C22 = Q2;
-        
-        C_vacuum[0] = C11;
-        C_vacuum[1] = C12;
-        C_vacuum[2] = C21;
-        C_vacuum[3] = C22;
-    }
+    _calc_coupled_C(_img, true, C_vacuum);
     
     //printf("C_vacuum matrix\n" "%g\t%g\n%g\t%g\n", C_vacuum[0], C_vacuum[1], C_vacuum[2], C_vacuum[3]);
             
     /* 根据真空中导体电容矩阵求解电感矩阵 */
     {
-        float matrix_c[4] = {C_vacuum[0], C_vacuum[1], C_vacuum[2], C_vacuum[3]};
+        double matrix_c[4] = {C_vacuum[0], C_vacuum[1], C_vacuum[2], C_vacuum[3]};
         
         /* 对电容矩阵求逆 */
-        matrix_invert((float *)matrix_c, L, 2, 2);
+        matrix_invert(matrix_c, L, 2, 2);
         
         /* 再乘以真空介电常数和真空磁导率 就得到了电感矩阵 */
         matrix_mul(L, L, EPS0 * MUE0, 2, 2);
@@ -379,47 +359,12 @@ bool fdm_Z0_calc::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2
     }
     
     /* 计算 电介质中导体的电容矩阵 */
-    {
-        float C11 = 0;
-        float C12 = 0;
-        float C21 = 0;
-        float C22 = 0;
-        
-        /* 计算C11 C21*/
-        fdm.update_metal(FDM_ID_METAL_COND1, 1);
-        fdm.update_metal(FDM_ID_METAL_COND2, 0);
-        
-        fdm.solver();
-        
-        float Q1 = fdm.calc_Q(FDM_ID_METAL_COND1);
-        float Q2 = fdm.calc_Q(FDM_ID_METAL_COND2);
-        
-        C11 = Q1;
-        C21 = Q2;
-        
-        
-        /* 计算C22 C12*/
-        fdm.update_metal(FDM_ID_METAL_COND1, 0);
-        fdm.update_metal(FDM_ID_METAL_COND2, 1);
-        
-        fdm.solver();
-        
-        Q1 = fdm.calc_Q(FDM_ID_METAL_COND1);
-        Q2 = fdm.calc_Q(FDM_ID_METAL_COND2);
-        C12 = Q1;
-        C22 = Q2;
-        
-        C[0] = C11;
-        C[1] = C12;
-        C[2] = C21;
-        C[3] = C22;
-        
-        c_matrix[0][0] = C11 * 1e12;
-        c_matrix[0][1] = C12 * 1e12;
-        c_matrix[1][0] = C21 * 1e12;
-        c_matrix[1][1] = C22 * 1e12;
-        
-    }
+    _calc_coupled_C(_img, false, C);
+    
+    c_matrix[0][0] = C[0] * 1e12;
+    c_matrix[0][1] = C[1] * 1e12;
+    c_matrix[1][0] = C[2] * 1e12;
+    c_matrix[1][1] = C[3] * 1e12;
     
     Zodd = (sqrt((L[0] - L[1]) / (C[0] - C[1])) + sqrt((L[3] - L[2]) / (C[3] - C[2]))) / 2;
     Zeven = (sqrt((L[0] + L[1]) / (C[0] + C[1])) + sqrt((L[3] + L[2]) / (C[3] + C[2]))) / 2;
@@ -436,17 +381,17 @@ bool fdm_Z0_calc::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2
 void fdm_Z0_calc::_draw(float x, float y, float w, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b)
 {
     std::int32_t pix_y1 = _unit2pix(y + _c_y);
-    std::int32_t pix_x1 = _unit2pix(x + _c_x - w / 2);
-    std::int32_t pix_x2 = _unit2pix(x + _c_x - w / 2 + w);
+    std::int32_t pix_x1 = _x2pix(x + _c_x - w / 2);
+    std::int32_t pix_x2 = _x2pix(x + _c_x - w / 2 + w);
     std::int32_t pix_y2 = _unit2pix(y + _c_y + thick);;
-    cv::rectangle(_img, cv::Point(pix_x1, pix_y1), cv::Point(pix_x2 - 1, pix_y2 - 1), cv::Scalar(b, g, r), -1);
+    _xs.add_rect((r << 16) | (g << 8) | b, pix_x1, pix_y1, pix_x2, pix_y2);
 }
 
 void fdm_Z0_calc::_draw_ring(float x, float y, float radius, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b)
 {
     std::int32_t pix_y = _unit2pix(y + _c_y);
-    std::int32_t pix_x = _unit2pix(x + _c_x);
-    cv::circle(_img, cv::Point(pix_x, pix_y), _unit2pix(radius + thick * 0.5), cv::Scalar(b, g, r), _unit2pix(thick));
+    std::int32_t pix_x = _x2pix(x + _c_x);
+    _xs.add_ring((r << 16) | (g << 8) | b, pix_x, pix_y, _unit2pix(radius + thick * 0.5), _unit2pix(thick));
 }
 
 float fdm_Z0_calc::_read_value(const char *str, const char *key)
@@ -461,35 +406,240 @@ float fdm_Z0_calc::_read_value(const char *str, const char *key)
     return atof(s);
 }
 
-bool fdm_Z0_calc::_is_some(cv::Mat& img1, cv::Mat& img2)
+void fdm_Z0_calc::_log_stats(fdm& fdm)
 {
-    if (img1.cols != img2.cols || img1.rows != img2.rows)
+    /* 设置了收敛条件时输出迭代求解的统计 直接求解没有迭代 不输出 */
+    const fdm::solver_stats& stats = fdm.get_stats();
+    if ((_rel_tol > 0 || _max_iter > 0) && stats.iterations > 0)
+    {
+        log_info("fdm: iterations:%d residual:%.3g dq:%.3g%s\n",
+                    stats.iterations, stats.residual, stats.dq, stats.converged? "": (stats.stalled? " (stalled)": " (not converged)"));
+    }
+}
+
+void fdm_Z0_calc::_add_ground_walls()
+{
+    if (_ground_walls)
+    {
+        _xs.add_rect(0x00ff00, 0, _xs.rows() - 1, _xs.cols(), _xs.rows());
+        _xs.add_rect(0x00ff00, 0, 0, _xs.cols(), 1);
+    }
+}
+
+bool fdm_Z0_calc::_is_mirror(cv::Mat& img, bool swap_cond)
+{
+    const cv::Vec3b cond1(0, 0, 255);
+    const cv::Vec3b cond2(255, 0, 0);
+    
+    if (img.cols < 8 || (img.cols & 1))
     {
         return false;
     }
     
-    std::int32_t count = 0;
-    for (std::int32_t row = 0; row < img1.rows; row++)
+    for (std::int32_t row = 0; row < img.rows; row++)
     {
-        for (std::int32_t col = 0; col < img1.cols; col++)
+        for (std::int32_t col = 0; col < img.cols / 2; col++)
         {
-            if (img1.at<cv::Vec3b>(row, col) == img2.at<cv::Vec3b>(row, col))
+            cv::Vec3b pix = img.at<cv::Vec3b>(row, img.cols - 1 - col);
+            if (swap_cond && pix == cond1)
+            {
+                pix = cond2;
+            }
+            else if (swap_cond && pix == cond2)
             {
-                count++;
+                pix = cond1;
+            }
+            
+            if (img.at<cv::Vec3b>(row, col) != pix)
+            {
+                return false;
             }
         }
     }
-    
-    return count > img1.cols * img1.rows  - _unit2pix(4 * 0.0254);
+    return true;
 }
 
 
+void fdm_Z0_calc::_calc_coupled_C(cv::Mat& img, bool ignore_dielectric, double C[4])
+{
+    if (!_is_mirror(img, true))
+    {
+        /* 两个导体只分解一次 两种激励一起回代 */
+        fdm fdm;
+        _init_fdm(fdm, img);
+        std::vector<std::uint8_t> ids = {FDM_ID_METAL_COND1, FDM_ID_METAL_COND2};
+        std::vector<double> Cm;
+        fdm.calc_capacity_matrix(ids, ignore_dielectric, Cm);
+        _log_stats(fdm);
+        for (std::int32_t i = 0; i < 4; i++)
+        {
+            C[i] = Cm[i];
+        }
+        return;
+    }
+    
+    /* 对称的两根线 左半边只有一个导体 分别用偶模和奇模求出电荷
+     * Qe = C11 + C12  Qo = C11 - C12
+     */
+    double Q[2];
+    for (std::int32_t i = 0; i < 2; i++)
+    {
+        fdm fdm;
+        _init_fdm(fdm, img, (i == 0)? SYM_EVEN: SYM_ODD);
+        fdm.update_metal(FDM_ID_METAL_COND1, 1);
+        fdm.update_metal(FDM_ID_METAL_COND2, 1);
+        fdm.solver(ignore_dielectric);
+        _log_stats(fdm);
+        Q[i] = fdm.calc_Q(FDM_ID_METAL_COND1, ignore_dielectric) + fdm.calc_Q(FDM_ID_METAL_COND2, ignore_dielectric);
+    }
+    
+    C[0] = C[3] = (Q[0] + Q[1]) * 0.5;
+    C[1] = C[2] = (Q[0] - Q[1]) * 0.5;
+}
+
 
+void fdm_Z0_calc::_gen_mesh_lines(cv::Mat& img, std::int32_t cols, bool is_col, std::vector<std::int32_t>& lines)
+{
+    std::int32_t n = is_col? cols: img.rows;
+    std::int32_t m = is_col? img.rows: cols;
+    
+    lines.clear();
+    
+    /* key[i]: 第i-1和第i个像素之间是材料分界 0 1 n 总是保留 (0,0)点放了一个地 */
+    std::vector<bool> key(n + 1, false);
+    key[0] = key[n] = true;
+    if (n > 1)
+    {
+        key[1] = true;
+    }
+    for (std::int32_t i = 1; i < n; i++)
+    {
+        for (std::int32_t j = 0; j < m && !key[i]; j++)
+        {
+            const cv::Vec3b& p1 = is_col? img.at<cv::Vec3b>(j, i - 1): img.at<cv::Vec3b>(i - 1, j);
+            const cv::Vec3b& p2 = is_col? img.at<cv::Vec3b>(j, i): img.at<cv::Vec3b>(i, j);
+            if (p1 != p2)
+            {
+                key[i] = true;
+            }
+        }
+    }
+    
+    if (!_graded_mesh)
+    {
+        for (std::int32_t i = 0; i <= n; i++)
+        {
+            lines.push_back(i);
+        }
+        return;
+    }
+    
+    /* 每条线到最近分界线的距离 */
+    std::vector<std::int32_t> dist(n + 1, n);
+    std::int32_t last = -n;
+    for (std::int32_t i = 0; i <= n; i++)
+    {
+        if (key[i])
+        {
+            last = i;
+        }
+        dist[i] = i - last;
+    }
+    last = 2 * n;
+    for (std::int32_t i = n; i >= 0; i--)
+    {
+        if (key[i])
+        {
+            last = i;
+        }
+        dist[i] = std::min(dist[i], last - i);
+    }
+    
+    /* 从分界线开始按比例增大步长 但不跨过下一条分界线 */
+    std::int32_t pos = 0;
+    lines.push_back(0);
+    while (pos < n)
+    {
+        std::int32_t step = 1 + dist[pos] * (FDM_MESH_GRADING - 1);
+        step = std::min(step, (std::int32_t)FDM_MESH_MAX_STEP);
+        std::int32_t next = pos + 1;
+        while (next < n && next < pos + step && !key[next])
+        {
+            next++;
+        }
+        pos = next;
+        lines.push_back(pos);
+    }
+}
 
+std::uint8_t fdm_Z0_calc::_pix2id(const cv::Vec3b& pix)
+{
+    std::uint8_t b = pix[0];
+    std::uint8_t g = pix[1];
+    std::uint8_t r = pix[2];
+    
+    if (r == 255 && g == 0 && b == 0)
+    {
+        return FDM_ID_METAL_COND1;
+    }
+    else if (r == 0 && g == 0 && b == 255)
+    {
+        return FDM_ID_METAL_COND2;
+    }
+    else if (r == 0 && g == 255 && b == 0)
+    {
+        return FDM_ID_METAL_GND;
+    }
+    else if (r == 0x0f)
+    {
+        std::uint16_t uer = b | (g << 8);
+        if (_er_map.count(uer))
+        {
+            return _er_map[uer];
+        }
+    }
+    return 0xff;
+}
 
-void fdm_Z0_calc::_init_fdm(fdm& fdm, cv::Mat& img)
+void fdm_Z0_calc::_init_fdm(fdm& fdm, cv::Mat& img, std::uint8_t sym)
 {
-    fdm.set_box_size(img.rows, img.cols, _pix_unit);
+    std::int32_t cols = (sym == SYM_NONE)? img.cols: img.cols / 2;
+    fdm.set_convergence(_rel_tol, _max_iter);
+    std::vector<std::int32_t> col_lines;
+    std::vector<std::int32_t> row_lines;
+    _gen_mesh_lines(img, cols, true, col_lines);
+    _gen_mesh_lines(img, cols, false, row_lines);
+    
+    if (sym == SYM_EVEN)
+    {
+        /* 对称轴右边再加一列镜像单元 作为对称边界 */
+        col_lines.push_back(cols * 2 - col_lines[col_lines.size() - 2]);
+        fdm.set_bc(fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_SYMMETRY);
+    }
+    else if (sym == SYM_ODD)
+    {
+        fdm.set_bc(fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_DIRICHLET);
+    }
+    
+    if (col_lines.back() - col_lines.front() == (std::int32_t)col_lines.size() - 1
+        && row_lines.back() - row_lines.front() == (std::int32_t)row_lines.size() - 1)
+    {
+        fdm.set_box_size(row_lines.size() - 1, col_lines.size() - 1, _pix_unit);
+    }
+    else
+    {
+        std::vector<float> col_w;
+        std::vector<float> row_h;
+        for (std::size_t i = 1; i < col_lines.size(); i++)
+        {
+            col_w.push_back((col_lines[i] - col_lines[i - 1]) * _pix_unit);
+        }
+        for (std::size_t i = 1; i < row_lines.size(); i++)
+        {
+            row_h.push_back((row_lines[i] - row_lines[i - 1]) * _pix_unit);
+        }
+        fdm.set_box_size(col_w, row_h);
+    }
     //fdm.set_bc(fdm::BC_DIRICHLET, fdm::BC_DIRICHLET, fdm::BC_NEUMANN, fdm::BC_NEUMANN);
     //fdm.set_bc(fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_DIRICHLET, fdm::BC_DIRICHLET);
     //fdm.set_bc(fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_NEUMANN, fdm::BC_DIRICHLET);
@@ -507,33 +657,15 @@ void fdm_Z0_calc::_init_fdm(fdm& fdm, cv::Mat& img)
         fdm.add_dielectric(fdm_er_id, er);
     }
     
-    for (std::int32_t col = 0; col < img.cols; col++)
+    /* 两条网格线之间的像素材料相同 取左上角的像素即可 */
+    for (std::int32_t col = 0; col < (std::int32_t)col_lines.size() - 1; col++)
     {
-        for (std::int32_t row = 0; row < img.rows; row++)
+        for (std::int32_t row = 0; row < (std::int32_t)row_lines.size() - 1; row++)
         {
-            std::uint8_t b = img.at<cv::Vec3b>(row, col)[0];
-            std::uint8_t g = img.at<cv::Vec3b>(row, col)[1];
-            std::uint8_t r = img.at<cv::Vec3b>(row, col)[2];
-            
-            if (r == 255 && g == 0 && b == 0)
-            {
-                fdm.add_point(row, col, FDM_ID_METAL_COND1);
-            }
-            else if (r == 0 && g == 0 && b == 255)
-            {
-                fdm.add_point(row, col, FDM_ID_METAL_COND2);
-            }
-            else if (r == 0 && g == 255 && b == 0)
-            {
-                fdm.add_point(row, col, FDM_ID_METAL_GND);
-            }
-            else if (r == 0x0f)
+            std::uint8_t id = _pix2id(img.at<cv::Vec3b>(row_lines[row], col_lines[col]));
+            if (id != 0xff)
             {
-                std::uint16_t uer = b | (g << 8);
-                if (_er_map.count(uer))
-                {
-                    fdm.add_point(row, col, _er_map[uer]);
-                }
+                fdm.add_point(row, col, id);
             }
         }
     }
@@ -545,18 +677,31 @@ void fdm_Z0_calc::_calc_Z0(cv::Mat img, float& Z0, float& v, float& c, float& l,
     const float EPS0 = 8.85419e-12;
     const float MUE0 = 4 * M_PI * 1e-7;
     fdm fdm;
-    _init_fdm(fdm, img);
+    
+    /* 左右对称时只算左半边 电荷乘2 */
+    float k = 1;
+    if (_is_mirror(img, false))
+    {
+        _init_fdm(fdm, img, SYM_EVEN);
+        k = 2;
+    }
+    else
+    {
+        _init_fdm(fdm, img);
+    }
     
     /* 计算真空下的电容 */
     fdm.solver(true);
-    float C0 = fdm.calc_Q(FDM_ID_METAL_COND1, true);
+    _log_stats(fdm);
+    double C0 = fdm.calc_Q(FDM_ID_METAL_COND1, true) * k;
     
     /* 计算电感 */
     l = EPS0 * MUE0 / C0;
     
     /* 计算电介质下的电容 */
     fdm.solver(false);
-    c = fdm.calc_Q(FDM_ID_METAL_COND1, false);
+    _log_stats(fdm);
+    c = fdm.calc_Q(FDM_ID_METAL_COND1, false) * k;
     
     Z0 = sqrt(l / c);
     float velocity = 1.0 / sqrt(l * c);
@@ -22,8 +22,10 @@
 #include <cstdint>
 #include <opencv2/opencv.hpp>
 #include <map>
+#include <vector>
 #include "fdm.h"
 #include "Z0_calc.h"
+#include "xsection.h"
 class fdm_Z0_calc: public Z0_calc
 {
 private:
@@ -36,6 +38,14 @@ private:
         FDM_ID_ER,
     };
     
+    /* 左右对称时只计算左半边 SYM_EVEN:对称轴上电场法向分量为0 SYM_ODD:对称轴上电压为0 */
+    enum
+    {
+        SYM_NONE = 0,
+        SYM_EVEN,
+        SYM_ODD,
+    };
+    
 public:
     fdm_Z0_calc();
     virtual ~fdm_Z0_calc();
@@ -46,6 +56,9 @@ public:
     
     virtual void set_box_size(float w, float h);
     
+    /* 只在退回SOR迭代时起作用 直接求解总是精确解 */
+    virtual void set_convergence(float rel_tol, std::int32_t max_iter) { _rel_tol = rel_tol; _max_iter = max_iter; }
+    
     virtual std::uint32_t get_type() { return Z0_calc::Z0_CALC_FDM; }
     
     virtual void clean();
@@ -60,14 +73,27 @@ public:
     virtual void add_ring_elec(float x, float y, float r, float thickness, float er = 4.6);
     virtual bool calc_Z0(float& Zo, float& v, float& c, float& l, float& r, float& g);
     virtual bool calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2], float l_matrix[2][2], float r_matrix[2][2], float g_matrix[2][2]);
+    
+    /* 使用非均匀网格 导体边缘和介质分界面附近保持像素精度 远离分界面的地方网格按比例逐渐变大 */
+    void enable_graded_mesh(bool b) { _graded_mesh = b; }
+    /* 盒子的上下边界各放一行地 与atlc的位图模型一致 */
+    void enable_ground_walls(bool b) { _ground_walls = b; }
 private:
     std::int32_t _unit2pix(float v) { return round(v * _pix_unit_r);}
+    /* 盒子的宽度取偶数个像素 x坐标以中心为对称轴取整 左右对称的结构画出来也是对称的 */
+    std::int32_t _box_cols() { return _unit2pix(_box_w * 0.5) * 2; }
+    std::int32_t _x2pix(float x) { return (x <= _c_x)? _unit2pix(x): _box_cols() - _unit2pix(_box_w - x); }
     void _draw(float x, float y, float w, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b);
     void _draw_ring(float x, float y, float radius, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b);
     float _read_value(const char *str, const char *key);
-    bool _is_some(cv::Mat& img1, cv::Mat& img2);
+    void _add_ground_walls();
+    void _log_stats(fdm& fdm);
+    bool _is_mirror(cv::Mat& img, bool swap_cond);
     
-    void _init_fdm(fdm& fdm, cv::Mat& img);
+    void _gen_mesh_lines(cv::Mat& img, std::int32_t cols, bool is_col, std::vector<std::int32_t>& lines);
+    std::uint8_t _pix2id(const cv::Vec3b& pix);
+    void _init_fdm(fdm& fdm, cv::Mat& img, std::uint8_t sym = SYM_NONE);
+    void _calc_coupled_C(cv::Mat& img, bool ignore_dielectric, double C[4]);
     void _calc_Z0(cv::Mat img, float& Z0, float& v, float& c, float& l, float& r, float& g);
 private:
     float _pix_unit;
@@ -77,10 +103,16 @@ private:
     float _c_x;
     float _c_y;
     
+    /* 用截面描述判断是否可以使用上一次的结果 需要求解时才光栅化到_img */
+    xsection _xs;
+    xsection _last_xs;
     cv::Mat _img;
-    cv::Mat _last_img;
     std::map<std::uint16_t, std::uint8_t> _er_map;
     std::uint8_t _fdm_er_id;
+    bool _graded_mesh;
+    bool _ground_walls;
+    float _rel_tol;
+    std::int32_t _max_iter;
     
     float _Zo;
     float _c;
@@ -0,0 +1,289 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2023 Liu An Lin <liuanlin-mx@qq.com>                        *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include "ir_drop.h"
+
+ir_drop::ir_drop()
+    : _nodes(0)
+    , _tol(1e-9)
+    , _max_iter(100000)
+    , _iter(0)
+{
+}
+
+ir_drop::~ir_drop()
+{
+}
+
+void ir_drop::clear()
+{
+    _nodes = 0;
+    _branches.clear();
+    _i.clear();
+    _fixed_v.clear();
+    _fixed.clear();
+}
+
+std::int32_t ir_drop::add_node()
+{
+    _i.push_back(0);
+    _fixed_v.push_back(0);
+    _fixed.push_back(0);
+    return _nodes++;
+}
+
+void ir_drop::add_conductance(std::int32_t node1, std::int32_t node2, double g)
+{
+    if (node1 == node2 || !(g > 0))
+    {
+        return;
+    }
+    branch b;
+    b.n1 = node1;
+    b.n2 = node2;
+    b.g = g;
+    _branches.push_back(b);
+}
+
+void ir_drop::set_voltage(std::int32_t node, double v)
+{
+    _fixed[node] = 1;
+    _fixed_v[node] = v;
+}
+
+void ir_drop::add_current(std::int32_t node, double i)
+{
+    _i[node] += i;
+}
+
+
+bool ir_drop::solve(std::vector<double>& v)
+{
+    v.assign(_nodes, 0);
+    _iter = 0;
+    
+    /* 并查集 找出没有连接到电压固定节点的孤立区域 */
+    std::vector<std::int32_t> parent(_nodes);
+    for (std::int32_t i = 0; i < _nodes; i++)
+    {
+        parent[i] = i;
+    }
+    auto find = [&](std::int32_t i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    for (const auto& b: _branches)
+    {
+        std::int32_t r1 = find(b.n1);
+        std::int32_t r2 = find(b.n2);
+        if (r1 != r2)
+        {
+            parent[r1] = r2;
+        }
+    }
+    std::vector<std::uint8_t> grounded(_nodes, 0);
+    for (std::int32_t i = 0; i < _nodes; i++)
+    {
+        if (_fixed[i])
+        {
+            grounded[find(i)] = 1;
+        }
+    }
+    
+    /* 未知节点编号 孤立节点不参与求解 */
+    std::int32_t n = 0;
+    std::int32_t floating = 0;
+    _idx.assign(_nodes, -1);
+    for (std::int32_t i = 0; i < _nodes; i++)
+    {
+        if (_fixed[i])
+        {
+            v[i] = _fixed_v[i];
+        }
+        else if (grounded[find(i)])
+        {
+            _idx[i] = n++;
+        }
+        else
+        {
+            floating++;
+        }
+    }
+    if (floating)
+    {
+        printf("warn: %d nodes are not connected to the source.\n", floating);
+    }
+    if (n == 0)
+    {
+        return true;
+    }
+    
+    /* 组装 对角线单独存放在diag中 */
+    std::vector<double> diag(n, 0);
+    std::vector<double> b(n, 0);
+    _row.assign(n + 1, 0);
+    for (std::int32_t i = 0; i < _nodes; i++)
+    {
+        if (_idx[i] >= 0)
+        {
+            b[_idx[i]] = _i[i];
+        }
+    }
+    for (const auto& br: _branches)
+    {
+        std::int32_t i1 = _idx[br.n1];
+        std::int32_t i2 = _idx[br.n2];
+        if (i1 >= 0)
+        {
+            diag[i1] += br.g;
+            if (i2 >= 0)
+            {
+                _row[i1 + 1]++;
+            }
+            else
+            {
+                b[i1] += br.g * v[br.n2];
+            }
+        }
+        if (i2 >= 0)
+        {
+            diag[i2] += br.g;
+            if (i1 >= 0)
+            {
+                _row[i2 + 1]++;
+            }
+            else
+            {
+                b[i2] += br.g * v[br.n1];
+            }
+        }
+    }
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        _row[i + 1] += _row[i];
+    }
+    
+    _col.resize(_row[n]);
+    _val.resize(_row[n]);
+    std::vector<std::int32_t> pos(_row.begin(), _row.end() - 1);
+    for (const auto& br: _branches)
+    {
+        std::int32_t i1 = _idx[br.n1];
+        std::int32_t i2 = _idx[br.n2];
+        if (i1 >= 0 && i2 >= 0)
+        {
+            _col[pos[i1]] = i2;
+            _val[pos[i1]++] = -br.g;
+            _col[pos[i2]] = i1;
+            _val[pos[i2]++] = -br.g;
+        }
+    }
+    _val.insert(_val.end(), diag.begin(), diag.end());
+    
+    /* Jacobi预处理的共轭梯度法 */
+    std::vector<double> x(n, 0);
+    std::vector<double> r(b);
+    std::vector<double> z(n);
+    std::vector<double> p(n);
+    std::vector<double> Ap(n);
+    
+    double b_norm = 0;
+    double rz = 0;
+    #pragma omp parallel for reduction(+: b_norm, rz)
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        z[i] = r[i] / diag[i];
+        p[i] = z[i];
+        b_norm += b[i] * b[i];
+        rz += r[i] * z[i];
+    }
+    b_norm = sqrt(b_norm);
+    
+    bool converged = (b_norm == 0);
+    while (!converged && _iter < _max_iter)
+    {
+        _mul(p, Ap);
+        double pAp = 0;
+        #pragma omp parallel for reduction(+: pAp)
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            pAp += p[i] * Ap[i];
+        }
+        
+        double alpha = rz / pAp;
+        double r_norm = 0;
+        double rz_new = 0;
+        #pragma omp parallel for reduction(+: r_norm, rz_new)
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * Ap[i];
+            z[i] = r[i] / diag[i];
+            r_norm += r[i] * r[i];
+            rz_new += r[i] * z[i];
+        }
+        _iter++;
+        
+        if (sqrt(r_norm) < _tol * b_norm)
+        {
+            converged = true;
+            break;
+        }
+        
+        double beta = rz_new / rz;
+        rz = rz_new;
+        #pragma omp parallel for
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            p[i] = z[i] + beta * p[i];
+        }
+    }
+    
+    for (std::int32_t i = 0; i < _nodes; i++)
+    {
+        if (_idx[i] >= 0)
+        {
+            v[i] = x[_idx[i]];
+        }
+    }
+    return converged;
+}
+
+
+void ir_drop::_mul(const std::vector<double>& x, std::vector<double>& y)
+{
+    std::int32_t n = (std::int32_t)x.size();
+    const double *diag = &_val[_row[n]];
+    #pragma omp parallel for
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        double s = diag[i] * x[i];
+        for (std::int32_t k = _row[i]; k < _row[i + 1]; k++)
+        {
+            s += _val[k] * x[_col[k]];
+        }
+        y[i] = s;
+    }
+}
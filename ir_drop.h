@@ -0,0 +1,81 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2023 Liu An Lin <liuanlin-mx@qq.com>                        *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+
+#ifndef __IR_DROP_H__
+#define __IR_DROP_H__
+#include <cstdint>
+#include <vector>
+
+/* 直流电阻网络 用共轭梯度法求解节点电压 */
+class ir_drop
+{
+public:
+    ir_drop();
+    ~ir_drop();
+    
+public:
+    void clear();
+    std::int32_t add_node();
+    std::int32_t nodes() { return _nodes; }
+    /* g为电导 单位S */
+    void add_conductance(std::int32_t node1, std::int32_t node2, double g);
+    /* 电压固定的节点 */
+    void set_voltage(std::int32_t node, double v);
+    /* 流入节点的电流 单位A */
+    void add_current(std::int32_t node, double i);
+    
+    void set_tolerance(double tol) { _tol = tol; }
+    void set_max_iter(std::int32_t max_iter) { _max_iter = max_iter; }
+    
+    /* 没有收敛返回false 没有连接到电压固定节点的孤立节点电压为0 */
+    bool solve(std::vector<double>& v);
+    
+    std::int32_t get_iter() { return _iter; }
+    /* solve之后有效 节点是否连接到电压固定的节点 */
+    bool is_connected(std::int32_t node) { return _fixed[node] || _idx[node] >= 0; }
+    
+private:
+    struct branch
+    {
+        std::int32_t n1;
+        std::int32_t n2;
+        double g;
+    };
+    
+private:
+    void _mul(const std::vector<double>& x, std::vector<double>& y);
+    
+private:
+    std::int32_t _nodes;
+    std::vector<branch> _branches;
+    std::vector<double> _i;
+    std::vector<double> _fixed_v;
+    std::vector<std::uint8_t> _fixed;
+    
+    /* 未知节点的编号和CSR格式的系数矩阵 */
+    std::vector<std::int32_t> _idx;
+    std::vector<std::int32_t> _row;
+    std::vector<std::int32_t> _col;
+    std::vector<double> _val;
+    
+    double _tol;
+    std::int32_t _max_iter;
+    std::int32_t _iter;
+};
+
+#endif
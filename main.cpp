@@ -84,7 +84,8 @@ enum
     MODE_TL,
     MODE_RL,
     MODE_ANT,
-    MODE_SP
+    MODE_SP,
+    MODE_IR
 };
 
 static std::shared_ptr<pcb> pcb_(new pcb());
@@ -102,16 +103,28 @@ static int main_tl_rl(int argc, char **argv)
     float coupled_min_len = 0.5;
     bool lossless_tl = true;
     bool ltra = false;
+    std::uint32_t wideband = z_extractor::WIDEBAND_NONE;
+    float roughness = 0;
+    bool segment_merge = false;
     float freq = 1e0;
+    float fmax = 0;
+    std::int32_t ndec = 10;
     float conductivity = 5.8e7;
     float step = 0.5;
     bool via_tl_mode = false;
     bool use_mmtl = true;
     bool enable_openmp = false;
+    std::int32_t zone_mesh_level = 0;
+    bool zone_refine = false;
+    float ir_grid = 0.2;
+    float fdm_tol = 0;
+    std::int32_t fdm_max_iter = 0;
+    const char *src = NULL;
     
     std::list<std::string> nets;
     std::list<std::pair<std::string, std::string> > coupled_nets;
     std::list<std::pair<std::string, std::string> > pads;
+    std::list<std::pair<std::string, std::string> > loads;
     std::list<std::string> refs;
     std::vector<std::string> current;
     
@@ -158,6 +171,18 @@ static int main_tl_rl(int argc, char **argv)
         {
             ltra = (atoi(arg_next) == 0)? false: true;
         }
+        else if (std::string(arg) == "-wideband" && i < argc)
+        {
+            wideband = atoi(arg_next);
+        }
+        else if (std::string(arg) == "-roughness" && i < argc)
+        {
+            roughness = atof(arg_next);
+        }
+        else if (std::string(arg) == "-merge_segments" && i < argc)
+        {
+            segment_merge = (atoi(arg_next) == 0)? false: true;
+        }
         else if (std::string(arg) == "-conductivity" && i < argc)
         {
             conductivity = atof(arg_next);
@@ -170,6 +195,14 @@ static int main_tl_rl(int argc, char **argv)
         {
             freq = atof(arg_next);
         }
+        else if (std::string(arg) == "-fmax" && i < argc)
+        {
+            fmax = atof(arg_next);
+        }
+        else if (std::string(arg) == "-ndec" && i < argc)
+        {
+            ndec = atoi(arg_next);
+        }
         else if (std::string(arg) == "-step" && i < argc)
         {
             step = atof(arg_next);
@@ -186,6 +219,34 @@ static int main_tl_rl(int argc, char **argv)
         {
             enable_openmp = (atoi(arg_next) == 0)? false: true;
         }
+        else if (std::string(arg) == "-zone_mesh_level" && i < argc)
+        {
+            zone_mesh_level = atoi(arg_next);
+        }
+        else if (std::string(arg) == "-zone_refine" && i < argc)
+        {
+            zone_refine = (atoi(arg_next) == 0)? false: true;
+        }
+        else if (std::string(arg) == "-src" && i < argc)
+        {
+            src = arg_next;
+        }
+        else if (std::string(arg) == "-load" && i < argc)
+        {
+            _parse_coupled_net(arg_next, loads);
+        }
+        else if (std::string(arg) == "-ir_grid" && i < argc)
+        {
+            ir_grid = atof(arg_next);
+        }
+        else if (std::string(arg) == "-fdm_tol" && i < argc)
+        {
+            fdm_tol = atof(arg_next);
+        }
+        else if (std::string(arg) == "-fdm_max_iter" && i < argc)
+        {
+            fdm_max_iter = atoi(arg_next);
+        }
         
     }
     if (mode == MODE_TL)
@@ -202,6 +263,13 @@ static int main_tl_rl(int argc, char **argv)
             return 0;
         }
     }
+    else if (mode == MODE_IR)
+    {
+        if (src == NULL || loads.empty())
+        {
+            return 0;
+        }
+    }
     
     pcb_->clean_segment(nets);
     for (const auto& net: coupled_nets)
@@ -214,15 +282,62 @@ static int main_tl_rl(int argc, char **argv)
     z_extr->set_coupled_min_len(coupled_min_len);
     z_extr->enable_lossless_tl(lossless_tl);
     z_extr->enable_ltra_model(ltra);
+    if (wideband > z_extractor::WIDEBAND_NGSPICE)
+    {
+        printf("err: -wideband %u invalid (0:off 1:hspice 2:ngspice).\n", wideband);
+        return 0;
+    }
+    if (wideband == z_extractor::WIDEBAND_HSPICE)
+    {
+        printf("warn: -wideband 1 writes HSPICE W-element models, the library can not be loaded by ngspice.\n");
+    }
+    z_extr->set_wideband_model(wideband);
+    z_extr->set_roughness(roughness);
+    z_extr->enable_segment_merge(segment_merge);
     z_extr->enable_via_tl_mode(via_tl_mode);
     z_extr->enable_openmp(enable_openmp);
+    z_extr->set_zone_mesh_level(zone_mesh_level);
+    z_extr->enable_zone_refine(zone_refine);
     z_extr->set_freq(freq);
+    z_extr->set_rl_sweep(fmax, ndec);
     z_extr->set_conductivity(conductivity);
     z_extr->set_step(step);
+    z_extr->set_fdm_convergence(fdm_tol, fdm_max_iter);
     z_extr->set_calc((use_mmtl)? Z0_calc::Z0_CALC_MMTL: Z0_calc::Z0_CALC_FDM);
     
-    std::string spice;
-    std::string info;
+    if (oname == NULL)
+    {
+        oname = "out";
+    }
+    
+    /* 每个网络算完马上写入文件 不在内存中保存整个库 info同时输出到stdout 插件可以实时显示进度 */
+    sprintf(buf, "%s.lib", oname);
+    FILE *spice_lib_fp = fopen(buf, "wb");
+    if (spice_lib_fp)
+    {
+        setvbuf(spice_lib_fp, NULL, _IOFBF, 1024 * 1024);
+    }
+    sprintf(buf, "%s.info", oname);
+    FILE *info_fp = fopen(buf, "wb");
+    
+    auto spice_write = [&](const std::string& str)
+    {
+        if (spice_lib_fp)
+        {
+            fwrite(str.c_str(), 1, str.length(), spice_lib_fp);
+        }
+    };
+    auto info_write = [&](const std::string& str)
+    {
+        printf("%s", str.c_str());
+        fflush(stdout);
+        if (info_fp)
+        {
+            fwrite(str.c_str(), 1, str.length(), info_fp);
+            fflush(info_fp);
+        }
+    };
+    
     if (mode == MODE_TL)
     {
         std::vector<std::uint32_t> v_refs;
@@ -248,7 +363,7 @@ static int main_tl_rl(int argc, char **argv)
                 continue;
             }
             //printf("ckt:%s\n", ckt.c_str());
-            spice += "*" + call + ckt + "\n\n\n";
+            spice_write("*" + call + ckt + "\n\n\n");
             
             if (first)
             {
@@ -257,7 +372,7 @@ static int main_tl_rl(int argc, char **argv)
             }
             float len = velocity * td;
             sprintf(str, "net: \"%s\"  Z0:%.1f  td:%.4fNS  len:(%.1fmil)\n", net.c_str(), Z0_avg, td, len / 0.0254);
-            info += str;
+            info_write(str);
         }
         
         for (const auto& coupled: coupled_nets)
@@ -280,7 +395,7 @@ static int main_tl_rl(int argc, char **argv)
             }
     
             //printf("ckt:%s\n", ckt.c_str());
-            spice += "*" + call + ckt + "\n\n\n";
+            spice_write("*" + call + ckt + "\n\n\n");
             
             if (first)
             {
@@ -291,12 +406,12 @@ static int main_tl_rl(int argc, char **argv)
             sprintf(str, "net: \"%s:%s\"  Zodd:%.1f  Zeven:%.f  Zdiff:%.1f  Zcomm:%.1f\n",
                 coupled.first.c_str(), coupled.second.c_str(),
                 Zodd_avg, Zeven_avg, Zodd_avg * 2., Zeven_avg * 0.5);
-            info += str;
+            info_write(str);
             
             sprintf(str, "net: \"%s\"  Z0:%.1f  td:%.4fNS  len:(%.1fmil)\n", coupled.first.c_str(), Z0_avg[0], td_sum[0], velocity * td_sum[0] / 0.0254);
-            info += str;
+            info_write(str);
             sprintf(str, "net: \"%s\"  Z0:%.1f  td:%.4fNS  len:(%.1fmil)\n", coupled.second.c_str(), Z0_avg[1], td_sum[1], velocity * td_sum[1] / 0.0254);
-            info += str;
+            info_write(str);
             
             //char str[4096] = {0};
             //float c = 299792458000 * v_ratio;
@@ -309,34 +424,99 @@ static int main_tl_rl(int argc, char **argv)
     else if (mode == MODE_RL)
     {
         char str[4096] = {0};
+        
+        /* 同一网络的焊盘对作为多端口一起求解 */
+        std::vector<z_extractor::rl_port> ports;
+        std::map<std::uint32_t, std::vector<std::uint32_t> > net_ports;
         for (const auto& pad: pads)
         {
-            std::string ckt;
-            std::string call;
-            std::vector<std::string> footprint;
-            float r = 0;
-            float l = 0;
-            
             std::vector<std::string> pad1 = _string_split(pad.first, ".");
             std::vector<std::string> pad2 = _string_split(pad.second, ".");
-            if (z_extr->gen_subckt_rl(pad1.front(), pad1.back(), pad2.front(), pad2.back(), ckt, call, r, l))
+            z_extractor::rl_port port;
+            port.footprint1 = pad1.front();
+            port.footprint1_pad_number = pad1.back();
+            port.footprint2 = pad2.front();
+            port.footprint2_pad_number = pad2.back();
+            
+            /* 有问题的焊盘对只跳过自己 不影响同一网络的其他焊盘对 */
+            pcb::pad p;
+            pcb::pad p2;
+            if (!pcb_->get_pad(port.footprint1, port.footprint1_pad_number, p))
+            {
+                printf("warn: not found %s.%s, skip.\n", port.footprint1.c_str(), port.footprint1_pad_number.c_str());
+                continue;
+            }
+            if (!pcb_->get_pad(port.footprint2, port.footprint2_pad_number, p2))
+            {
+                printf("warn: not found %s.%s, skip.\n", port.footprint2.c_str(), port.footprint2_pad_number.c_str());
+                continue;
+            }
+            if (p.net != p2.net)
             {
-                spice += ckt;
+                printf("warn: %s.%s %s.%s not on the same network, skip.\n", port.footprint1.c_str(), port.footprint1_pad_number.c_str(),
+                                        port.footprint2.c_str(), port.footprint2_pad_number.c_str());
+                continue;
+            }
+            net_ports[p.net].push_back(ports.size());
+            ports.push_back(port);
+        }
+        
+        /* 每个网络求解完就输出 不等所有网络都算完 */
+        for (const auto& net: net_ports)
+        {
+            const std::vector<std::uint32_t>& idx = net.second;
+            std::vector<z_extractor::rl_port> v_ports;
+            for (auto i: idx)
+            {
+                v_ports.push_back(ports[i]);
+            }
+            
+            std::vector<std::string> v_ckts;
+            std::vector<std::string> v_calls;
+            std::vector<double> r;
+            std::vector<double> l;
+            if (!z_extr->gen_subckt_rl(v_ports, v_ckts, v_calls, r, l))
+            {
+                continue;
+            }
+            
+            std::uint32_t n = idx.size();
+            for (std::uint32_t i = 0; i < n; i++)
+            {
+                const z_extractor::rl_port& port = v_ports[i];
+                float r0 = r[i * n + i];
+                float l0 = l[i * n + i];
+                spice_write(v_ckts[i]);
                 sprintf(str, "pad-pad: %s.%s:%s.%s R=%.4e L=%.4gnH",
-                            pad1.front().c_str(), pad1.back().c_str(), pad2.front().c_str(), pad2.back().c_str(), r, l * 1e9);
-                info += str;
+                            port.footprint1.c_str(), port.footprint1_pad_number.c_str(),
+                            port.footprint2.c_str(), port.footprint2_pad_number.c_str(), r0, l0 * 1e9);
+                info_write(str);
                 
                 if (!current.empty())
                 {
                     sprintf(str, " voltage drop: ");
-                    info += str;
+                    info_write(str);
                     for (auto I: current)
                     {
-                        sprintf(str, "(%.3eV@%gA) ", r * atof(I.c_str()), atof(I.c_str()));
-                        info += str;
+                        sprintf(str, "(%.3eV@%gA) ", r0 * atof(I.c_str()), atof(I.c_str()));
+                        info_write(str);
                     }
                 }
-                info += "\n";
+                info_write("\n");
+            }
+            
+            for (std::uint32_t i = 0; i < n; i++)
+            {
+                for (std::uint32_t j = i + 1; j < n; j++)
+                {
+                    sprintf(str, "mutual: %s.%s:%s.%s %s.%s:%s.%s Rm=%.4e M=%.4gnH\n",
+                                v_ports[i].footprint1.c_str(), v_ports[i].footprint1_pad_number.c_str(),
+                                v_ports[i].footprint2.c_str(), v_ports[i].footprint2_pad_number.c_str(),
+                                v_ports[j].footprint1.c_str(), v_ports[j].footprint1_pad_number.c_str(),
+                                v_ports[j].footprint2.c_str(), v_ports[j].footprint2_pad_number.c_str(),
+                                r[i * n + j], l[i * n + j] * 1e9);
+                    info_write(str);
+                }
             }
         }
         
@@ -349,29 +529,66 @@ static int main_tl_rl(int argc, char **argv)
             
             if (z_extr->gen_subckt(pcb_->get_net_id(net.c_str()), ckt, footprint, call))
             {
-                spice += ckt;
+                spice_write(ckt);
             }
         }
     }
-    
-    printf("%s\n", info.c_str());
-    if (oname == NULL)
+    else if (mode == MODE_IR)
     {
-        oname = "out";
+        char str[4096] = {0};
+        std::vector<std::string> src_pad = _string_split(src, ".");
+        std::vector<z_extractor::ir_load> v_loads;
+        for (const auto& load: loads)
+        {
+            std::vector<std::string> pad = _string_split(load.first, ".");
+            z_extractor::ir_load l;
+            l.footprint = pad.front();
+            l.pad_number = pad.back();
+            l.current = atof(load.second.c_str());
+            v_loads.push_back(l);
+        }
+        
+        std::map<std::string, cv::Mat> j_map;
+        if (z_extr->gen_ir_drop(src_pad.front(), src_pad.back(), v_loads, ir_grid, j_map))
+        {
+            for (const auto& l: v_loads)
+            {
+                sprintf(str, "src: %s load: %s.%s I=%gA drop=%.4emV\n",
+                        src, l.footprint.c_str(), l.pad_number.c_str(), l.current, l.drop * 1e3);
+                info_write(str);
+            }
+            
+            for (const auto& j: j_map)
+            {
+                double min_j = 0;
+                double max_j = 0;
+                cv::Point max_loc;
+                cv::minMaxLoc(j.second, &min_j, &max_j, NULL, &max_loc);
+                sprintf(str, "layer: %s Jmax=%.3fA/mm^2 at (%.2fmm, %.2fmm)\n",
+                        j.first.c_str(), max_j, pcb_->get_edge_left() + (max_loc.x + 0.5) * ir_grid, pcb_->get_edge_top() + (max_loc.y + 0.5) * ir_grid);
+                info_write(str);
+                
+                if (max_j > 0)
+                {
+                    cv::Mat img;
+                    j.second.convertTo(img, CV_8U, 255. / max_j);
+                    cv::applyColorMap(img, img, cv::COLORMAP_JET);
+                    std::string layer = j.first;
+                    std::replace(layer.begin(), layer.end(), '.', '_');
+                    sprintf(buf, "%s_%s_J.png", oname, layer.c_str());
+                    cv::imwrite(buf, img);
+                }
+            }
+        }
     }
-    sprintf(buf, "%s.lib", oname);
-    FILE *spice_lib_fp = fopen(buf, "wb");
+    
+    printf("\n");
     if (spice_lib_fp)
     {
-        fwrite(spice.c_str(), 1, spice.length(), spice_lib_fp);
         fclose(spice_lib_fp);
     }
-    
-    sprintf(buf, "%s.info", oname);
-    FILE *info_fp = fopen(buf, "wb");
     if (info_fp)
     {
-        fwrite(info.c_str(), 1, info.length(), info_fp);
         fclose(info_fp);
     }
     return 0;
@@ -772,6 +989,10 @@ int main(int argc, char **argv)
         {
             mode = MODE_RL;
         }
+        else if (std::string(arg) == "-ir")
+        {
+            mode = MODE_IR;
+        }
         else if (std::string(arg) == "-sp")
         {
             mode = MODE_SP;
@@ -792,7 +1013,7 @@ int main(int argc, char **argv)
         return 0;
     }
     
-    if (mode == MODE_TL || mode == MODE_RL)
+    if (mode == MODE_TL || mode == MODE_RL || mode == MODE_IR)
     {
         return main_tl_rl(argc, argv);
     }
@@ -19,8 +19,16 @@
 #ifndef __MATRIX_H__
 #define __MATRIX_H__
 #include <cstdint>
+#include <cstddef>
 #include <stdlib.h>
 #include <new>
+#include <memory>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/* 数据按64字节(缓存行)对齐分配 */
+#define MATRIX_ALIGN 64
 
 template <typename T>
 class matrix
@@ -45,16 +53,13 @@ public:
     bool create(std::int32_t rows, std::int32_t cols, std::int32_t border = 0, const T& v = T())
     {
         _free();
-        _data = (T*)malloc(sizeof(T) * (rows + border * 2) * (cols + border * 2));
+        _data = (T*)_aligned_alloc(sizeof(T) * (rows + border * 2) * (cols + border * 2));
         if (_data == NULL)
         {
             return false;
         }
         
-        for (std::int32_t i = 0; i < (rows + border * 2) * (cols + border * 2); i++)
-        {
-            new(_data + i) T(v);
-        }
+        std::uninitialized_fill_n(_data, (rows + border * 2) * (cols + border * 2), v);
         
         _rows = rows;
         _cols = cols;
@@ -72,6 +77,23 @@ public:
         return _data[(row + _border) * (_cols + _border * 2) + col + _border];
     }
     
+    /* 第row行第0列的指针 同一行内可以直接用列号做下标 col可以取-border */
+    inline T* row_ptr(std::int32_t row)
+    {
+        return _data + (row + _border) * stride() + _border;
+    }
+    
+    inline const T* row_ptr(std::int32_t row) const
+    {
+        return _data + (row + _border) * stride() + _border;
+    }
+    
+    /* 相邻两行之间的元素个数 */
+    inline std::int32_t stride() const
+    {
+        return _cols + _border * 2;
+    }
+    
     inline T* data()
     {
         return _data;
@@ -92,7 +114,7 @@ public:
         return _cols;
     }
 
-    inline std::int32_t border_size()
+    inline std::int32_t border_size() const
     {
         return _border;
     }
@@ -106,7 +128,7 @@ private:
             {
                 ((T*)(_data + i))->~T();
             }
-            free(_data);
+            _aligned_free(_data);
             _data = 0;
             _rows = 0;
             _cols = 0;
@@ -114,10 +136,90 @@ private:
         }
     }
     
+    static void *_aligned_alloc(std::size_t size)
+    {
+        /* posix_memalign要求大小不为0 */
+        if (size == 0)
+        {
+            size = MATRIX_ALIGN;
+        }
+#ifdef _WIN32
+        return ::_aligned_malloc(size, MATRIX_ALIGN);
+#else
+        void *p = NULL;
+        if (posix_memalign(&p, MATRIX_ALIGN, size) != 0)
+        {
+            return NULL;
+        }
+        return p;
+#endif
+    }
+    
+    static void _aligned_free(void *p)
+    {
+#ifdef _WIN32
+        ::_aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+    
+    /* 不可复制 */
+    matrix(const matrix&);
+    matrix& operator=(const matrix&);
+    
 private:
     T *_data;
     std::int32_t _rows;
     std::int32_t _cols;
     std::int32_t _border;
 };
+
+
+/* 差分模板视图 缓存中心行的指针和行距 逐行移动时只做一次指针加法
+ * R为模板半径 行偏移在编译期检查 调用者保证访问的行列在矩阵(含边框)范围内
+ */
+template <typename T, std::int32_t R = 1>
+class stencil_view
+{
+public:
+    template <typename M>
+    stencil_view(M& m, std::int32_t row)
+        : _stride(m.stride())
+        , _mid(m.row_ptr(row))
+    {
+    }
+    
+public:
+    template <std::int32_t DR>
+    inline T* row() const
+    {
+        static_assert(DR >= -R && DR <= R, "row offset out of stencil radius");
+        return _mid + DR * _stride;
+    }
+    
+    inline T* up() const
+    {
+        return row<-1>();
+    }
+    
+    inline T* mid() const
+    {
+        return _mid;
+    }
+    
+    inline T* down() const
+    {
+        return row<1>();
+    }
+    
+    inline void next_row()
+    {
+        _mid += _stride;
+    }
+    
+private:
+    std::ptrdiff_t _stride;
+    T *_mid;
+};
 #endif
\ No newline at end of file
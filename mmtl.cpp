@@ -18,6 +18,7 @@
 
 #include <string.h>
 #include <list>
+#include <algorithm>
 #include "mmtl.h"
 
 static const char *base_xsctn = "package require csdl\n\n"
@@ -42,7 +43,8 @@ static const char *base_xsctn = "package require csdl\n\n"
                 "   -xOffset 0.0\n";
                 
 mmtl::mmtl()
-    : _tmp_name("tmp")
+    : _dir(scratch::make_subdir("mmtl"))
+    , _tmp_name("tmp")
     , _xsctn(base_xsctn)
     , _cond_id(0)
     , _gnd_id(0)
@@ -73,11 +75,7 @@ mmtl::mmtl()
 
 mmtl::~mmtl()
 {
-    remove((_tmp_name + ".xsctn").c_str());
-    remove((_tmp_name + ".result").c_str());
-    remove((_tmp_name + ".dump").c_str());
-    remove((_tmp_name + ".result_field_plot_data").c_str());
-    remove("nmmtl.dump");
+    scratch::remove_subdir(_dir);
     
 }
 
@@ -105,7 +103,7 @@ void mmtl::clean()
     _gnd_id = 0;
     _elec_id = 0;
     
-    _img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(255, 255, 255));
+    _xs.clear(_unit2pix(_box_h), _box_cols());
 }
 
 
@@ -117,8 +115,8 @@ void mmtl::clean_all()
     _gnd_id = 0;
     _elec_id = 0;
     
-    _img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(255, 255, 255));
-    _last_img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(0, 0, 0));
+    _xs.clear(_unit2pix(_box_h), _box_cols());
+    _last_xs.clear();
 }
 
 
@@ -150,7 +148,7 @@ void mmtl::add_wire(float x, float y, float w, float thickness, float conductivi
     
     if (fabs(w - _wire_w) > 0.0001 || fabs(thickness - _wire_h) > 0.0001)
     {
-        _last_img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(0, 0, 0));
+        _last_xs.clear();
     }
     _wire_w = w;
     _wire_h = thickness;
@@ -171,7 +169,7 @@ void mmtl::add_coupler(float x, float y, float w, float thickness, float conduct
     
     if (fabs(w - _coupler_w) > 0.0001 || fabs(thickness - _coupler_h) > 0.0001)
     {
-        _last_img = cv::Mat(_unit2pix(_box_h), _unit2pix(_box_w), CV_8UC3, cv::Scalar(0, 0, 0));
+        _last_xs.clear();
     }
     _coupler_w = w;
     _coupler_h = thickness;
@@ -199,8 +197,10 @@ bool mmtl::calc_Z0(float& Z0, float& v, float& c, float& l, float& r, float& g)
 {
     Z0 = v = c = l = r = g = 0;
     char buf[1024] = {0};
-    if (_is_some())
+    /* 左右镜像的截面结果相同 不需要再运行mmtl */
+    if (_is_some() || _is_mirror(false))
     {
+        _last_xs = _xs;
         Z0 = _Z0;
         v = _v;
         c = _c;
@@ -210,14 +210,18 @@ bool mmtl::calc_Z0(float& Z0, float& v, float& c, float& l, float& r, float& g)
         return true;
     }
     
-    _last_img = _img;
+    if (_dir.empty())
+    {
+        return false;
+    }
+    _last_xs = _xs;
     
     if (_build() == false)
     {
         return false;
     }
     
-    FILE *fp = fopen((_tmp_name + ".xsctn").c_str(), "wb");
+    FILE *fp = fopen(_get_tmp_path(".xsctn").c_str(), "wb");
     if (fp)
     {
         fwrite(_xsctn.c_str(), 1, _xsctn.length(), fp);
@@ -225,7 +229,7 @@ bool mmtl::calc_Z0(float& Z0, float& v, float& c, float& l, float& r, float& g)
     }
     
     
-    FILE *pfp = popen(("mmtl_bem " + _tmp_name).c_str(), "r");
+    FILE *pfp = popen((scratch::cd_cmd(_dir) + "mmtl_bem " + _tmp_name).c_str(), "r");
     while (fgets(buf, sizeof(buf), pfp))
     {
     }
@@ -266,13 +270,35 @@ bool mmtl::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2], floa
         return true;
     }
     
-    _last_img = _img;
+    /* 左右镜像后两根线互换 交换矩阵的两个导体即可 */
+    if (_is_mirror(true))
+    {
+        _last_xs = _xs;
+        std::swap(_c_matrix[0][0], _c_matrix[1][1]);
+        std::swap(_c_matrix[0][1], _c_matrix[1][0]);
+        std::swap(_l_matrix[0][0], _l_matrix[1][1]);
+        std::swap(_l_matrix[0][1], _l_matrix[1][0]);
+        std::swap(_r_matrix[0][0], _r_matrix[1][1]);
+        std::swap(_r_matrix[0][1], _r_matrix[1][0]);
+        
+        Zodd = _Zodd;
+        Zeven = _Zeven;
+        memcpy(c_matrix, _c_matrix, sizeof(_c_matrix));
+        memcpy(l_matrix, _l_matrix, sizeof(_l_matrix));
+        memcpy(r_matrix, _r_matrix, sizeof(_r_matrix));
+        return true;
+    }
+    
+    if (_dir.empty())
+    {
+        return false;
+    }
+    _last_xs = _xs;
     if (_build() == false)
     {
         return false;
     }
-    sprintf(buf, "%s.xsctn", _tmp_name.c_str());
-    FILE *fp = fopen(buf, "wb");
+    FILE *fp = fopen(_get_tmp_path(".xsctn").c_str(), "wb");
     if (fp)
     {
         fwrite(_xsctn.c_str(), 1, _xsctn.length(), fp);
@@ -281,7 +307,7 @@ bool mmtl::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2], floa
     }
     
     
-    sprintf(cmd, "mmtl_bem %s", _tmp_name.c_str());
+    sprintf(cmd, "%smmtl_bem %s", scratch::cd_cmd(_dir).c_str(), _tmp_name.c_str());
     
     FILE *pfp = popen(cmd, "r");
     while (fgets(buf, sizeof(buf), pfp))
@@ -290,6 +316,8 @@ bool mmtl::calc_coupled_Z0(float& Zodd, float& Zeven, float c_matrix[2][2], floa
     pclose(pfp);
     _read_value(Zodd, Zeven, c_matrix, l_matrix, r_matrix, g_matrix);
     
+    _Zodd = Zodd;
+    _Zeven = Zeven;
     memcpy(_c_matrix, c_matrix, sizeof(_c_matrix));
     memcpy(_l_matrix, l_matrix, sizeof(_l_matrix));
     memcpy(_r_matrix, r_matrix, sizeof(_r_matrix));
@@ -460,8 +488,7 @@ void mmtl::_read_value(float & Z0, float & v, float & c, float & l, float& r, fl
 {
     char buf[4096];
     
-    sprintf(buf, "%s.result", _tmp_name.c_str());
-    FILE *fp = fopen(buf, "rb");
+    FILE *fp = fopen(_get_tmp_path(".result").c_str(), "rb");
     if (fp == NULL)
     {
         return;
@@ -523,8 +550,7 @@ void mmtl::_read_value(float& Zodd, float& Zeven, float c_matrix[2][2], float l_
     
     char buf[4096];
     
-    sprintf(buf, "%s.result", _tmp_name.c_str());
-    FILE *fp = fopen(buf, "rb");
+    FILE *fp = fopen(_get_tmp_path(".result").c_str(), "rb");
     if (fp == NULL)
     {
         return;
@@ -644,37 +670,34 @@ void mmtl::_read_value(float& Zodd, float& Zeven, float c_matrix[2][2], float l_
 void mmtl::_draw(float x, float y, float w, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b)
 {
     std::int32_t pix_y1 = _unit2pix(y + _c_y);
-    std::int32_t pix_x1 = _unit2pix(x + _c_x - w / 2);
-    std::int32_t pix_x2 = _unit2pix(x + _c_x - w / 2 + w);
+    std::int32_t pix_x1 = _x2pix(x + _c_x - w / 2);
+    std::int32_t pix_x2 = _x2pix(x + _c_x - w / 2 + w);
     std::int32_t pix_y2 = _unit2pix(y + _c_y + thick);;
-    cv::rectangle(_img, cv::Point(pix_x1, pix_y1), cv::Point(pix_x2 - 1, pix_y2 - 1), cv::Scalar(b, g, r), -1);
+    _xs.add_rect((r << 16) | (g << 8) | b, pix_x1, pix_y1, pix_x2, pix_y2);
 }
 
 void mmtl::_draw_ring(float x, float y, float radius, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b)
 {
     std::int32_t pix_y = _unit2pix(y + _c_y);
-    std::int32_t pix_x = _unit2pix(x + _c_x);
-    cv::circle(_img, cv::Point(pix_x, pix_y), _unit2pix(radius + thick * 0.5), cv::Scalar(b, g, r), _unit2pix(thick));
+    std::int32_t pix_x = _x2pix(x + _c_x);
+    _xs.add_ring((r << 16) | (g << 8) | b, pix_x, pix_y, _unit2pix(radius + thick * 0.5), _unit2pix(thick));
 }
 
 
 bool mmtl::_is_some()
 {
-    if (_img.cols != _last_img.cols || _img.rows != _last_img.rows)
-    {
-        return false;
-    }
+    return _xs.is_same(_last_xs, _unit2pix(4 * 0.0254));
+}
+
+
+bool mmtl::_is_mirror(bool swap_cond)
+{
+    const std::uint32_t cond1 = 0xff0000;
+    const std::uint32_t cond2 = 0x0000ff;
     
-    std::int32_t count = 0;
-    for (std::int32_t row = 0; row < _img.rows; row++)
+    if (swap_cond)
     {
-        for (std::int32_t col = 0; col < _img.cols; col++)
-        {
-            if (_img.at<cv::Vec3b>(row, col) == _last_img.at<cv::Vec3b>(row, col))
-            {
-                count++;
-            }
-        }
+        return _xs.is_mirror(_last_xs, _unit2pix(4 * 0.0254), cond1, cond2);
     }
-    return count > _img.cols * _img.rows  - _unit2pix(4 * 0.0254);
+    return _xs.is_mirror(_last_xs, _unit2pix(4 * 0.0254), cond1, cond1);
 }
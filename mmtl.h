@@ -21,8 +21,9 @@
 
 #include <cstdint>
 #include <map>
-#include <opencv2/opencv.hpp>
 #include "Z0_calc.h"
+#include "scratch.h"
+#include "xsection.h"
 
 class mmtl: public Z0_calc
 {
@@ -80,12 +81,19 @@ private:
     void _read_value(float& Zodd, float& Zeven, float c_matrix[2][2], float l_matrix[2][2], float r_matrix[2][2], float g_matrix[2][2]);
     
     std::int32_t _unit2pix(float v) { return round(v * _pix_unit_r);}
+    /* 盒子的宽度取偶数个像素 x坐标以中心为对称轴取整 左右对称的结构画出来也是对称的 */
+    std::int32_t _box_cols() { return _unit2pix(_box_w * 0.5) * 2; }
+    std::int32_t _x2pix(float x) { return (x <= _c_x)? _unit2pix(x): _box_cols() - _unit2pix(_box_w - x); }
     void _draw(float x, float y, float w, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b);
     void _draw_ring(float x, float y, float radius, float thick, std::uint8_t r, std::uint8_t g, std::uint8_t b);
     bool _is_some();
+    bool _is_mirror(bool swap_cond);
+    std::string _get_tmp_path(const char *ext) { return scratch::path(_dir, _tmp_name + ext); }
     
 private:
 
+    /* mmtl_bem会在当前目录写nmmtl.dump 每个实例在自己的临时目录下运行 */
+    std::string _dir;
     std::string _tmp_name;
     std::string _xsctn;
     std::uint32_t _cond_id;
@@ -93,8 +101,9 @@ private:
     std::uint32_t _elec_id;
     std::multimap<float, item> _map;
     
-    cv::Mat _img;
-    cv::Mat _last_img;
+    /* 截面只用于判断是否可以使用上一次的结果 */
+    xsection _xs;
+    xsection _last_xs;
     float _pix_unit;
     float _pix_unit_r;
     float _box_w;
@@ -17,8 +17,13 @@
 *****************************************************************************/
 
 #include <complex>
+#include <stdarg.h>
+#include <algorithm>
 #include "calc.h"
 #include "openems_model_gen.h"
+
+/* 每批并行生成的对象数 限制同时缓存的脚本大小 */
+#define MODEL_CHUNK_BATCH (4096)
 float openems_model_gen::C0 = 299792458;
 openems_model_gen::openems_model_gen(const std::shared_ptr<pcb>& pcb)
     : _pcb(pcb)
@@ -952,12 +957,13 @@ void openems_model_gen::_add_dielectric(FILE *fp)
         if (grs.size() == 1 &&
             (grs[0].gr_type == pcb::gr::GR_POLY))
         {
-            range_det range;
+            model_chunk chunk;
             pcb::point at(0, 0);
             pcb::gr gr = grs[0];
             gr.layer_name = layer.name;
             gr.fill_type = pcb::gr::FILL_SOLID;
-            _add_gr(gr, at, 0, layer.name, fp, range, 0, false);
+            _add_gr(gr, at, 0, layer.name, chunk, 0, false);
+            fwrite(chunk.text.data(), 1, chunk.text.size(), fp);
         }
         else
         {
@@ -984,33 +990,64 @@ void openems_model_gen::_add_metal(FILE *fp)
 
 void openems_model_gen::_add_segment(FILE *fp, std::int32_t metal_prio)
 {
-    for (auto net: _nets)
-    {
-        range_det range;
-        std::uint32_t net_id = net.first;
-        const mesh_info& info = net.second;
-        std::list<pcb::segment> segments = _pcb->get_segments(net_id);
-        
-                
-        for (const auto& s: segments)
-        {
+    /* 所有网络的走线展开到一起 按批并行生成脚本 再按原顺序写入 */
+    std::vector<std::string> net_names;
+    std::vector<const mesh_info *> net_infos;
+    std::vector<pcb::segment> segments;
+    std::vector<std::uint32_t> segment_net;
+    for (const auto& net: _nets)
+    {
+        std::list<pcb::segment> s_list = _pcb->get_segments(net.first);
+        segments.insert(segments.end(), s_list.begin(), s_list.end());
+        segment_net.resize(segments.size(), net_names.size());
+        net_names.push_back(_pcb->get_net_name(net.first));
+        net_infos.push_back(&net.second);
+    }
+    std::vector<range_det> net_ranges(net_names.size());
+    
+    std::vector<model_chunk> chunks;
+    for (std::uint32_t base = 0; base < segments.size(); base += MODEL_CHUNK_BATCH)
+    {
+        std::uint32_t n = std::min<std::uint32_t>(MODEL_CHUNK_BATCH, segments.size() - base);
+        chunks.assign(n, model_chunk());
+        
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (std::uint32_t i = 0; i < n; i++)
+        {
+            const pcb::segment& s = segments[base + i];
+            const mesh_info& info = *net_infos[segment_net[base + i]];
+            const std::string& net_name = net_names[segment_net[base + i]];
+            model_chunk& chunk = chunks[i];
+            
             const std::string& layer = s.layer_name;
             float z1 = _pcb->get_layer_z_axis(layer);
             float thickness = _pcb->get_layer_thickness(layer);
             if (s.is_arc())
             {
-                _add_arc(fp, _pcb->get_net_name(s.net), s.start, s.mid, s.end, s.width, z1, z1 + thickness, range, info.gen_mesh, info.use_uniform_grid, info.mesh_prio, metal_prio);
+                _add_arc(chunk, net_name, s.start, s.mid, s.end, s.width, z1, z1 + thickness, info.gen_mesh, info.use_uniform_grid, info.mesh_prio, metal_prio);
             }
             else
             {
-                _add_line(fp, _pcb->get_net_name(s.net), s.start, s.end, s.width, z1, z1 + thickness, range, info.gen_mesh, info.use_uniform_grid, info.mesh_prio, metal_prio);
+                _add_line(chunk, net_name, s.start, s.end, s.width, z1, z1 + thickness, info.gen_mesh, info.use_uniform_grid, info.mesh_prio, metal_prio);
             }
             
-            range.det(s.start.x - s.width, s.start.y - s.width);
-            range.det(s.start.x + s.width, s.start.y + s.width);
-            range.det(s.end.x - s.width, s.end.y - s.width);
-            range.det(s.end.x + s.width, s.end.y + s.width);
+            chunk.range.det(s.start.x - s.width, s.start.y - s.width);
+            chunk.range.det(s.start.x + s.width, s.start.y + s.width);
+            chunk.range.det(s.end.x - s.width, s.end.y - s.width);
+            chunk.range.det(s.end.x + s.width, s.end.y + s.width);
+        }
+        
+        for (std::uint32_t i = 0; i < n; i++)
+        {
+            net_ranges[segment_net[base + i]].det(chunks[i].range);
         }
+        _write_chunks(fp, chunks);
+    }
+    
+    for (std::uint32_t i = 0; i < net_infos.size(); i++)
+    {
+        const mesh_info& info = *net_infos[i];
+        range_det& range = net_ranges[i];
         if (info.gen_mesh && info.use_uniform_grid && range.is_valid())
         {
             float x_margin = 1;
@@ -1028,14 +1065,33 @@ void openems_model_gen::_add_segment(FILE *fp, std::int32_t metal_prio)
 
 void openems_model_gen::_add_via(FILE *fp, std::int32_t metal_prio)
 {
-    for (auto net: _nets)
+    std::vector<std::string> net_names;
+    std::vector<const mesh_info *> net_infos;
+    std::vector<pcb::via> vias;
+    std::vector<std::uint32_t> via_net;
+    for (const auto& net: _nets)
     {
-        std::uint32_t net_id = net.first;
-        const mesh_info& info = net.second;
-        std::string net_name = _pcb->get_net_name(net_id);
-        std::list<pcb::via> vias = _pcb->get_vias(net_id);
-        for (const auto& v: vias)
+        std::list<pcb::via> v_list = _pcb->get_vias(net.first);
+        vias.insert(vias.end(), v_list.begin(), v_list.end());
+        via_net.resize(vias.size(), net_names.size());
+        net_names.push_back(_pcb->get_net_name(net.first));
+        net_infos.push_back(&net.second);
+    }
+    
+    std::vector<model_chunk> chunks;
+    for (std::uint32_t base = 0; base < vias.size(); base += MODEL_CHUNK_BATCH)
+    {
+        std::uint32_t n = std::min<std::uint32_t>(MODEL_CHUNK_BATCH, vias.size() - base);
+        chunks.assign(n, model_chunk());
+        
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (std::uint32_t i = 0; i < n; i++)
         {
+            const pcb::via& v = vias[base + i];
+            const mesh_info& info = *net_infos[via_net[base + i]];
+            const std::string& net_name = net_names[via_net[base + i]];
+            model_chunk& chunk = chunks[i];
+            
             std::vector<std::string> layers = _pcb->get_via_layers(v);
     
             float min_z = 10000;
@@ -1069,7 +1125,7 @@ void openems_model_gen::_add_via(FILE *fp, std::int32_t metal_prio)
             #if 0
                 float radius = v.size / 2;
                 
-                fprintf(fp, "CSX = AddCylinder(CSX, '%s', 2, [%f %f %f], [%f %f %f], %f);\n",
+                _chunk_printf(chunk, "CSX = AddCylinder(CSX, '%s', 2, [%f %f %f], [%f %f %f], %f);\n",
                         net_name.c_str(),
                         c.x, c.y, z1,
                         c.x, c.y, _ignore_cu_thickness? z2 + 0.001: z2,
@@ -1081,7 +1137,7 @@ void openems_model_gen::_add_via(FILE *fp, std::int32_t metal_prio)
                 pcb::point c(v.at);
                 
                 float radius = v.drill / 2;
-                fprintf(fp, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
+                _chunk_printf(chunk, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
                             net_name.c_str(),
                             metal_prio,
                             c.x, c.y, min_z,
@@ -1089,15 +1145,16 @@ void openems_model_gen::_add_via(FILE *fp, std::int32_t metal_prio)
                             radius);
                 if (info.gen_mesh && !info.use_uniform_grid)
                 {
-                    _mesh.x.insert(mesh::line(c.x, info.mesh_prio));
+                    chunk.x.push_back(mesh::line(c.x, info.mesh_prio));
                     //_mesh_x.insert(c.x + radius);
                     //_mesh_x.insert(c.x - radius);
-                    _mesh.y.insert(mesh::line(c.y, info.mesh_prio));
+                    chunk.y.push_back(mesh::line(c.y, info.mesh_prio));
                     //_mesh_y.insert(c.y + radius);
                     //_mesh_y.insert(c.y - radius);
                 }
             }
         }
+        _write_chunks(fp, chunks);
     }
     fprintf(fp, "\n\n");
     fprintf(fp, "\n\n");
@@ -1106,13 +1163,34 @@ void openems_model_gen::_add_via(FILE *fp, std::int32_t metal_prio)
 
 void openems_model_gen::_add_zone(FILE *fp, std::int32_t metal_prio)
 {
-    for (auto net: _nets)
+    std::vector<std::string> net_names;
+    std::vector<const mesh_info *> net_infos;
+    std::vector<pcb::zone> zones;
+    std::vector<std::uint32_t> zone_net;
+    for (const auto& net: _nets)
     {
-        std::uint32_t net_id = net.first;
-        const mesh_info& info = net.second;
-        std::list<pcb::zone> zones = _pcb->get_zones(net_id);
-        for (const auto& z: zones)
+        std::list<pcb::zone> z_list = _pcb->get_zones(net.first);
+        zones.insert(zones.end(), z_list.begin(), z_list.end());
+        zone_net.resize(zones.size(), net_names.size());
+        net_names.push_back(_pcb->get_net_name(net.first));
+        net_infos.push_back(&net.second);
+    }
+    
+    std::vector<model_chunk> chunks;
+    for (std::uint32_t base = 0; base < zones.size(); base += MODEL_CHUNK_BATCH)
+    {
+        std::uint32_t n = std::min<std::uint32_t>(MODEL_CHUNK_BATCH, zones.size() - base);
+        chunks.assign(n, model_chunk());
+        
+        /* 铺铜的点数差别很大 动态分配 */
+        #pragma omp parallel for schedule(dynamic)
+        for (std::uint32_t i = 0; i < n; i++)
         {
+            const pcb::zone& z = zones[base + i];
+            const mesh_info& info = *net_infos[zone_net[base + i]];
+            const std::string& net_name = net_names[zone_net[base + i]];
+            model_chunk& chunk = chunks[i];
+            
             const std::string& layer = z.layer_name;
             float z1 = _pcb->get_layer_z_axis(layer);
             float thickness = _pcb->get_layer_thickness(layer);
@@ -1120,18 +1198,19 @@ void openems_model_gen::_add_zone(FILE *fp, std::int32_t metal_prio)
             std::uint32_t idx = 1;
             for (const auto& p: z.pts)
             {
-                fprintf(fp, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.x, idx, p.y);
+                _chunk_printf(chunk, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.x, idx, p.y);
                 idx++;
                 if (info.zone_gen_mesh)
                 {
-                    _mesh.x.insert(mesh::line(p.x, info.mesh_prio));
-                    _mesh.y.insert(mesh::line(p.y, info.mesh_prio));
+                    chunk.x.push_back(mesh::line(p.x, info.mesh_prio));
+                    chunk.y.push_back(mesh::line(p.y, info.mesh_prio));
                 }
             }
             
-            fprintf(fp, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", _pcb->get_net_name(z.net).c_str(), metal_prio, z1, thickness);
-            fprintf(fp, "clear p;\n");
+            _chunk_printf(chunk, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", net_name.c_str(), metal_prio, z1, thickness);
+            _chunk_printf(chunk, "clear p;\n");
         }
+        _write_chunks(fp, chunks);
     }
     fprintf(fp, "\n\n");
     fprintf(fp, "\n\n");
@@ -1140,26 +1219,50 @@ void openems_model_gen::_add_zone(FILE *fp, std::int32_t metal_prio)
 void openems_model_gen::_add_footprint(FILE *fp, std::int32_t metal_prio, std::int32_t metal_pad_prio)
 {
     const std::vector<pcb::footprint>& footprints = _pcb->get_footprints();
+    std::vector<const pcb::footprint *> fps;
+    std::vector<const mesh_info *> fp_infos;
     for (const auto& footprint: footprints)
     {
-        if (_footprints.count(footprint.reference))
+        auto it = _footprints.find(footprint.reference);
+        if (it != _footprints.end())
+        {
+            fps.push_back(&footprint);
+            fp_infos.push_back(&it->second);
+        }
+    }
+    
+    std::vector<model_chunk> chunks;
+    for (std::uint32_t base = 0; base < fps.size(); base += MODEL_CHUNK_BATCH)
+    {
+        std::uint32_t n = std::min<std::uint32_t>(MODEL_CHUNK_BATCH, fps.size() - base);
+        chunks.assign(n, model_chunk());
+        
+        #pragma omp parallel for schedule(dynamic)
+        for (std::uint32_t i = 0; i < n; i++)
         {
-            range_det range;
-            const mesh_info& info = _footprints[footprint.reference];
-            fprintf(fp, "CSX = AddMetal(CSX, '%s');\n", footprint.reference.c_str());
+            const pcb::footprint& footprint = *fps[base + i];
+            const mesh_info& info = *fp_infos[base + i];
+            model_chunk& chunk = chunks[i];
+            
+            _chunk_printf(chunk, "CSX = AddMetal(CSX, '%s');\n", footprint.reference.c_str());
             for (const auto& gr: footprint.grs)
             {
                 if (_pcb->is_cu_layer(gr.layer_name))
                 {
-                    _add_gr(gr, footprint.at, footprint.at_angle, footprint.reference, fp, range, info.mesh_prio, info.gen_mesh && !info.use_uniform_grid, metal_prio);
+                    _add_gr(gr, footprint.at, footprint.at_angle, footprint.reference, chunk, info.mesh_prio, info.gen_mesh && !info.use_uniform_grid, metal_prio);
                 }
             }
             
             for (const auto& pad: footprint.pads)
             {
-                _add_pad(footprint, pad, footprint.reference, fp, range, info.mesh_prio, info.gen_mesh && !info.use_uniform_grid, metal_pad_prio);
+                _add_pad(footprint, pad, footprint.reference, chunk, info.mesh_prio, info.gen_mesh && !info.use_uniform_grid, metal_pad_prio);
             }
-            
+        }
+        
+        for (std::uint32_t i = 0; i < n; i++)
+        {
+            const mesh_info& info = *fp_infos[base + i];
+            range_det& range = chunks[i].range;
             if (info.gen_mesh && info.use_uniform_grid && range.is_valid())
             {
                 float x_margin = std::min(5.f, std::max(1.f, (range.x_max - range.x_min) / 20));
@@ -1170,13 +1273,14 @@ void openems_model_gen::_add_footprint(FILE *fp, std::int32_t metal_prio, std::i
                 _mesh.y_range.insert(y_range);
             }
         }
+        _write_chunks(fp, chunks);
     }
     fprintf(fp, "\n\n");
     fprintf(fp, "\n\n");
 }
 
 
-void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, const std::string& name, FILE *fp, range_det& range,
+void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, const std::string& name, model_chunk& chunk,
                                     std::uint32_t mesh_prio, bool gen_mesh, std::int32_t metal_prio)
 {
     const std::string& layer = gr.layer_name;
@@ -1190,18 +1294,18 @@ void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, c
         for (auto xy : gr.pts)
         {
             _pcb->coo_cvt_fp2pcb(at, angle, xy);
-            fprintf(fp, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, xy.x, idx, xy.y);
+            _chunk_printf(chunk, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, xy.x, idx, xy.y);
             idx++;
-            range.det(xy.x, xy.y);
+            chunk.range.det(xy.x, xy.y);
             if (gen_mesh)
             {
-                _mesh.x.insert(mesh::line(xy.x, mesh_prio));
-                _mesh.y.insert(mesh::line(xy.y, mesh_prio));
+                chunk.x.push_back(mesh::line(xy.x, mesh_prio));
+                chunk.y.push_back(mesh::line(xy.y, mesh_prio));
             }
         }
         
-        fprintf(fp, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, thickness);
-        fprintf(fp, "clear p;\n");
+        _chunk_printf(chunk, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, thickness);
+        _chunk_printf(chunk, "clear p;\n");
     }
     else if (gr.gr_type == pcb::gr::GR_RECT)
     {
@@ -1217,26 +1321,26 @@ void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, c
         
         if (gr.fill_type == pcb::gr::FILL_SOLID)
         {
-            fprintf(fp, "p(1, 1) = %f; p(2, 1) = %f;\n", p1.x, p1.y);
-            fprintf(fp, "p(1, 2) = %f; p(2, 2) = %f;\n", p2.x, p2.y);
-            fprintf(fp, "p(1, 3) = %f; p(2, 3) = %f;\n", p3.x, p3.y);
-            fprintf(fp, "p(1, 4) = %f; p(2, 4) = %f;\n", p4.x, p4.y);
+            _chunk_printf(chunk, "p(1, 1) = %f; p(2, 1) = %f;\n", p1.x, p1.y);
+            _chunk_printf(chunk, "p(1, 2) = %f; p(2, 2) = %f;\n", p2.x, p2.y);
+            _chunk_printf(chunk, "p(1, 3) = %f; p(2, 3) = %f;\n", p3.x, p3.y);
+            _chunk_printf(chunk, "p(1, 4) = %f; p(2, 4) = %f;\n", p4.x, p4.y);
         
             //fprintf(fp, "CSX = AddBox(CSX, '%s', 2, [%f %f %f], [%f %f %f]);\n",
             //    name.c_str(), p1.x, p1.y, z1, p3.x, p3.y, z2);
-            fprintf(fp, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, thickness);
-            fprintf(fp, "clear p;\n");
+            _chunk_printf(chunk, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, thickness);
+            _chunk_printf(chunk, "clear p;\n");
             
-            range.det(p1.x, p1.y);
-            range.det(p2.x, p2.y);
-            range.det(p3.x, p3.y);
-            range.det(p4.x, p4.y);
+            chunk.range.det(p1.x, p1.y);
+            chunk.range.det(p2.x, p2.y);
+            chunk.range.det(p3.x, p3.y);
+            chunk.range.det(p4.x, p4.y);
             if (gen_mesh)
             {
-                _mesh.x.insert(mesh::line(p1.x, mesh_prio)); _mesh.y.insert(mesh::line(p1.y, mesh_prio));
-                _mesh.x.insert(mesh::line(p2.x, mesh_prio)); _mesh.y.insert(mesh::line(p2.y, mesh_prio));
-                _mesh.x.insert(mesh::line(p3.x, mesh_prio)); _mesh.y.insert(mesh::line(p3.y, mesh_prio));
-                _mesh.x.insert(mesh::line(p4.x, mesh_prio)); _mesh.y.insert(mesh::line(p4.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p1.x, mesh_prio)); chunk.y.push_back(mesh::line(p1.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p2.x, mesh_prio)); chunk.y.push_back(mesh::line(p2.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p3.x, mesh_prio)); chunk.y.push_back(mesh::line(p3.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p4.x, mesh_prio)); chunk.y.push_back(mesh::line(p4.y, mesh_prio));
             }
         }
     }
@@ -1246,7 +1350,7 @@ void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, c
         pcb::point end = gr.end;
         _pcb->coo_cvt_fp2pcb(at, angle, start);
         _pcb->coo_cvt_fp2pcb(at, angle, end);
-        _add_line(fp, name, start, end, gr.stroke_width, z1, z2, range, gen_mesh, false, mesh_prio, metal_prio);
+        _add_line(chunk, name, start, end, gr.stroke_width, z1, z2, gen_mesh, false, mesh_prio, metal_prio);
     }
     else if (gr.gr_type == pcb::gr::GR_ARC)
     {
@@ -1257,7 +1361,7 @@ void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, c
         _pcb->coo_cvt_fp2pcb(at, angle, end);
         _pcb->coo_cvt_fp2pcb(at, angle, mid);
         
-        _add_arc(fp, name, start, mid, end, gr.stroke_width, z1, z2, range, gen_mesh, false, mesh_prio, metal_prio);
+        _add_arc(chunk, name, start, mid, end, gr.stroke_width, z1, z2, gen_mesh, false, mesh_prio, metal_prio);
     }
     else if (gr.gr_type == pcb::gr::GR_CIRCLE)
     {
@@ -1268,18 +1372,18 @@ void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, c
         float radius = calc_dist(start.x, start.y, end.x, end.y);
         if (gr.fill_type == pcb::gr::FILL_SOLID)
         {
-            fprintf(fp, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
+            _chunk_printf(chunk, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
                         name.c_str(),
                         metal_prio,
                         start.x, start.y, z1,
                         start.x, start.y, z2,
                         radius);
             
-            range.det(start.x, start.y);
+            chunk.range.det(start.x, start.y);
             if (gen_mesh)
             {
-                _mesh.x.insert(mesh::line(start.x, mesh_prio));
-                _mesh.y.insert(mesh::line(start.y, mesh_prio));
+                chunk.x.push_back(mesh::line(start.x, mesh_prio));
+                chunk.y.push_back(mesh::line(start.y, mesh_prio));
             }
         }
         else
@@ -1287,11 +1391,11 @@ void openems_model_gen::_add_gr(const pcb::gr& gr, pcb::point at, float angle, c
             //float thickness = _cvt_img_len(gr.stroke_width, pix_unit);
         }
     }
-    fprintf(fp, "\n");
+    _chunk_printf(chunk, "\n");
 }
 
 
-void openems_model_gen::_add_pad(const pcb::footprint& footprint, const pcb::pad& p, const std::string& name, FILE *fp, range_det& range,
+void openems_model_gen::_add_pad(const pcb::footprint& footprint, const pcb::pad& p, const std::string& name, model_chunk& chunk,
                                     std::uint32_t mesh_prio, bool gen_mesh, std::int32_t metal_prio)
 {
     std::vector<std::string> layers = _pcb->get_pad_layers(p);
@@ -1333,21 +1437,21 @@ void openems_model_gen::_add_pad(const pcb::footprint& footprint, const pcb::pad
             
             _pcb->coo_cvt_fp2pcb(footprint.at, footprint.at_angle, c);
             float radius = p.drill / 2;
-            fprintf(fp, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
+            _chunk_printf(chunk, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
                         name.c_str(),
                         metal_prio,
                         c.x, c.y, min_z,
                         c.x, c.y, max_z,
                         radius);
-            range.det(c.x, c.y);
+            chunk.range.det(c.x, c.y);
             if (gen_mesh)
             {
                 //_mesh_x.insert(c.x);
-                _mesh.x.insert(mesh::line(c.x + radius, mesh_prio));
-                _mesh.x.insert(mesh::line(c.x - radius, mesh_prio));
+                chunk.x.push_back(mesh::line(c.x + radius, mesh_prio));
+                chunk.x.push_back(mesh::line(c.x - radius, mesh_prio));
                 //_mesh_y.insert(c.y);
-                _mesh.y.insert(mesh::line(c.y + radius, mesh_prio));
-                _mesh.y.insert(mesh::line(c.y - radius, mesh_prio));
+                chunk.y.push_back(mesh::line(c.y + radius, mesh_prio));
+                chunk.y.push_back(mesh::line(c.y - radius, mesh_prio));
             }
         }
     }
@@ -1381,24 +1485,24 @@ void openems_model_gen::_add_pad(const pcb::footprint& footprint, const pcb::pad
             _pcb->coo_cvt_fp2pcb(footprint.at, footprint.at_angle, p4);
             
             
-            fprintf(fp, "p(1, 1) = %f; p(2, 1) = %f;\n", p1.x, p1.y);
-            fprintf(fp, "p(1, 2) = %f; p(2, 2) = %f;\n", p2.x, p2.y);
-            fprintf(fp, "p(1, 3) = %f; p(2, 3) = %f;\n", p3.x, p3.y);
-            fprintf(fp, "p(1, 4) = %f; p(2, 4) = %f;\n", p4.x, p4.y);
+            _chunk_printf(chunk, "p(1, 1) = %f; p(2, 1) = %f;\n", p1.x, p1.y);
+            _chunk_printf(chunk, "p(1, 2) = %f; p(2, 2) = %f;\n", p2.x, p2.y);
+            _chunk_printf(chunk, "p(1, 3) = %f; p(2, 3) = %f;\n", p3.x, p3.y);
+            _chunk_printf(chunk, "p(1, 4) = %f; p(2, 4) = %f;\n", p4.x, p4.y);
         
-            fprintf(fp, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, thickness);
-            fprintf(fp, "clear p;\n");
+            _chunk_printf(chunk, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, thickness);
+            _chunk_printf(chunk, "clear p;\n");
             
-            range.det(p1.x, p1.y);
-            range.det(p2.x, p2.y);
-            range.det(p3.x, p3.y);
-            range.det(p4.x, p4.y);
+            chunk.range.det(p1.x, p1.y);
+            chunk.range.det(p2.x, p2.y);
+            chunk.range.det(p3.x, p3.y);
+            chunk.range.det(p4.x, p4.y);
             if (gen_mesh)
             {
-                _mesh.x.insert(mesh::line(p1.x, mesh_prio)); _mesh.y.insert(mesh::line(p1.y, mesh_prio));
-                _mesh.x.insert(mesh::line(p2.x, mesh_prio)); _mesh.y.insert(mesh::line(p2.y, mesh_prio));
-                _mesh.x.insert(mesh::line(p3.x, mesh_prio)); _mesh.y.insert(mesh::line(p3.y, mesh_prio));
-                _mesh.x.insert(mesh::line(p4.x, mesh_prio)); _mesh.y.insert(mesh::line(p4.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p1.x, mesh_prio)); chunk.y.push_back(mesh::line(p1.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p2.x, mesh_prio)); chunk.y.push_back(mesh::line(p2.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p3.x, mesh_prio)); chunk.y.push_back(mesh::line(p3.y, mesh_prio));
+                chunk.x.push_back(mesh::line(p4.x, mesh_prio)); chunk.y.push_back(mesh::line(p4.y, mesh_prio));
             }
         }
         else if (p.shape == pcb::pad::SHAPE_CIRCLE)
@@ -1408,18 +1512,18 @@ void openems_model_gen::_add_pad(const pcb::footprint& footprint, const pcb::pad
             _pcb->coo_cvt_fp2pcb(footprint.at, footprint.at_angle, c);
             float radius = p.size_w / 2;
             
-            fprintf(fp, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
+            _chunk_printf(chunk, "CSX = AddCylinder(CSX, '%s', %d, [%f %f %f], [%f %f %f], %f);\n",
                         name.c_str(),
                         metal_prio,
                         c.x, c.y, z1,
                         c.x, c.y, _ignore_cu_thickness? z2 + 0.001: z2,
                         radius);
                 
-            range.det(c.x, c.y);
+            chunk.range.det(c.x, c.y);
             if (gen_mesh)
             {        
-                _mesh.x.insert(mesh::line(c.x, mesh_prio));
-                _mesh.y.insert(mesh::line(c.y, mesh_prio));
+                chunk.x.push_back(mesh::line(c.x, mesh_prio));
+                chunk.y.push_back(mesh::line(c.y, mesh_prio));
             }
         }
         else if (p.shape == pcb::pad::SHAPE_OVAL)
@@ -1428,13 +1532,13 @@ void openems_model_gen::_add_pad(const pcb::footprint& footprint, const pcb::pad
         }
     }
     
-    fprintf(fp, "\n\n");
+    _chunk_printf(chunk, "\n\n");
     
 }
 
 
-void openems_model_gen::_add_line(FILE *fp, const std::string& name, const pcb::point& p1, const pcb::point& p2, float width,float z1, float z2,
-                                    range_det& range, bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio)
+void openems_model_gen::_add_line(model_chunk& chunk, const std::string& name, const pcb::point& p1, const pcb::point& p2, float width,float z1, float z2,
+                                    bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio)
 {
     std::complex<float> start(p1.x, p1.y);
     std::complex<float> end(p2.x, p2.y);
@@ -1454,12 +1558,12 @@ void openems_model_gen::_add_line(FILE *fp, const std::string& name, const pcb::
     {
         std::complex<float> tmp = std::polar(std::abs(unit_vector), (float)(std::arg(unit_vector) + M_PI_2 + i * M_PI / n));
         std::complex<float> p = start + tmp * (width / 2);
-        fprintf(fp, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.real(), idx, p.imag());
+        _chunk_printf(chunk, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.real(), idx, p.imag());
         idx++;
         if (gen_mesh && !use_uniform_grid)
         {
-            _mesh.x.insert(mesh::line(p.real(), mesh_prio));
-            _mesh.y.insert(mesh::line(p.imag(), mesh_prio));
+            chunk.x.push_back(mesh::line(p.real(), mesh_prio));
+            chunk.y.push_back(mesh::line(p.imag(), mesh_prio));
         }
     }
                 
@@ -1467,23 +1571,23 @@ void openems_model_gen::_add_line(FILE *fp, const std::string& name, const pcb::
     {
         std::complex<float> tmp = std::polar(std::abs(unit_vector), (float)(std::arg(unit_vector) + -M_PI_2 + i * M_PI / n));
         std::complex<float> p = end + tmp * (width / 2);
-        fprintf(fp, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.real(), idx, p.imag());
+        _chunk_printf(chunk, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.real(), idx, p.imag());
         idx++;
         if (gen_mesh && !use_uniform_grid)
         {
-            _mesh.x.insert(mesh::line(p.real(), mesh_prio));
-            _mesh.y.insert(mesh::line(p.imag(), mesh_prio));
+            chunk.x.push_back(mesh::line(p.real(), mesh_prio));
+            chunk.y.push_back(mesh::line(p.imag(), mesh_prio));
         }
     }
     
-    fprintf(fp, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, z2 - z1);
-    fprintf(fp, "clear p;\n");
+    _chunk_printf(chunk, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, z2 - z1);
+    _chunk_printf(chunk, "clear p;\n");
 }
 
 
 
-void openems_model_gen::_add_arc(FILE *fp, const std::string& name, const pcb::point& start, const pcb::point& mid, const pcb::point& end, float width, float z1, float z2,
-                        range_det& range, bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio)
+void openems_model_gen::_add_arc(model_chunk& chunk, const std::string& name, const pcb::point& start, const pcb::point& mid, const pcb::point& end, float width, float z1, float z2,
+                        bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio)
 {
     pcb::segment s;
     s.start = start;
@@ -1523,11 +1627,57 @@ void openems_model_gen::_add_arc(FILE *fp, const std::string& name, const pcb::p
     std::uint32_t idx = 1;
     for (const auto& p: points)
     {
-        fprintf(fp, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.x, idx, p.y);
+        _chunk_printf(chunk, "p(1, %d) = %f; p(2, %d) = %f;\n", idx, p.x, idx, p.y);
         idx++;
     }
-    fprintf(fp, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, z2 - z1);
-    fprintf(fp, "clear p;\n");
+    _chunk_printf(chunk, "CSX = AddLinPoly(CSX, '%s', %d, 2, %f, p, %f, 'CoordSystem', 0);\n", name.c_str(), metal_prio, z1, z2 - z1);
+    _chunk_printf(chunk, "clear p;\n");
+}
+
+void openems_model_gen::_chunk_printf(model_chunk& chunk, const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    std::int32_t len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+    {
+        return;
+    }
+    
+    if (len < (std::int32_t)sizeof(buf))
+    {
+        chunk.text.append(buf, len);
+        return;
+    }
+    
+    /* 网络名很长时一次放不下 直接格式化到text末尾 */
+    std::size_t pos = chunk.text.size();
+    chunk.text.resize(pos + len + 1);
+    va_start(ap, fmt);
+    vsnprintf(&chunk.text[pos], len + 1, fmt, ap);
+    va_end(ap);
+    chunk.text.resize(pos + len);
+}
+
+void openems_model_gen::_write_chunks(FILE *fp, const std::vector<model_chunk>& chunks)
+{
+    std::size_t len = 0;
+    for (const auto& chunk: chunks)
+    {
+        len += chunk.text.size();
+    }
+    
+    std::string buf;
+    buf.reserve(len);
+    for (const auto& chunk: chunks)
+    {
+        buf += chunk.text;
+        _mesh.x.insert(chunk.x.begin(), chunk.x.end());
+        _mesh.y.insert(chunk.y.begin(), chunk.y.end());
+    }
+    fwrite(buf.data(), 1, buf.size(), fp);
 }
 
 void openems_model_gen::_add_excitation(FILE *fp, std::uint32_t mesh_prio)
@@ -2363,7 +2513,10 @@ void openems_model_gen::_check_mesh(const std::set<mesh::line>& mesh_line)
 
 std::vector<pcb::point> openems_model_gen::_get_fp_poly_points(const pcb::footprint& fp, const std::string& pad_number)
 {
-    std::vector<pcb::point> points;
+    /* 封装内所有焊盘的点一起转换到pcb坐标 圆形焊盘先转换圆心 radius小于0的是矩形的顶点 */
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<float> radius;
     for (const auto& p: fp.pads)
     {
         if (p.pad_number != pad_number)
@@ -2372,32 +2525,33 @@ std::vector<pcb::point> openems_model_gen::_get_fp_poly_points(const pcb::footpr
         }
         if (p.shape == pcb::pad::SHAPE_RECT || p.shape == pcb::pad::SHAPE_ROUNDRECT)
         {
-            pcb::point p1(p.at.x - p.size_w / 2, p.at.y + p.size_h / 2);
-            pcb::point p2(p.at.x + p.size_w / 2, p.at.y + p.size_h / 2);
-            pcb::point p3(p.at.x + p.size_w / 2, p.at.y - p.size_h / 2);
-            pcb::point p4(p.at.x - p.size_w / 2, p.at.y - p.size_h / 2);
-            
-            
-            _pcb->coo_cvt_fp2pcb(fp.at, fp.at_angle, p1);
-            _pcb->coo_cvt_fp2pcb(fp.at, fp.at_angle, p2);
-            _pcb->coo_cvt_fp2pcb(fp.at, fp.at_angle, p3);
-            _pcb->coo_cvt_fp2pcb(fp.at, fp.at_angle, p4);
-            
-            points.push_back(p1);
-            points.push_back(p2);
-            points.push_back(p3);
-            points.push_back(p4);
+            xs.insert(xs.end(), {p.at.x - p.size_w / 2, p.at.x + p.size_w / 2, p.at.x + p.size_w / 2, p.at.x - p.size_w / 2});
+            ys.insert(ys.end(), {p.at.y + p.size_h / 2, p.at.y + p.size_h / 2, p.at.y - p.size_h / 2, p.at.y - p.size_h / 2});
+            radius.insert(radius.end(), 4, -1);
         }
         else if (p.shape == pcb::pad::SHAPE_CIRCLE)
         {
-            pcb::point c(p.at);
-            
-            _pcb->coo_cvt_fp2pcb(fp.at, fp.at_angle, c);
-            float radius = p.size_w / 2;
-            points.push_back(pcb::point(c.x - radius, c.y));
-            points.push_back(pcb::point(c.x + radius, c.y));
-            points.push_back(pcb::point(c.x, c.y - radius));
-            points.push_back(pcb::point(c.x, c.y + radius));
+            xs.push_back(p.at.x);
+            ys.push_back(p.at.y);
+            radius.push_back(p.size_w / 2);
+        }
+    }
+    
+    _pcb->coo_cvt_fp2pcb(fp.at, fp.at_angle, xs.data(), ys.data(), xs.size());
+    
+    std::vector<pcb::point> points;
+    for (std::uint32_t i = 0; i < xs.size(); i++)
+    {
+        if (radius[i] < 0)
+        {
+            points.push_back(pcb::point(xs[i], ys[i]));
+        }
+        else
+        {
+            points.push_back(pcb::point(xs[i] - radius[i], ys[i]));
+            points.push_back(pcb::point(xs[i] + radius[i], ys[i]));
+            points.push_back(pcb::point(xs[i], ys[i] - radius[i]));
+            points.push_back(pcb::point(xs[i], ys[i] + radius[i]));
         }
     }
     return points;
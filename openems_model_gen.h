@@ -186,6 +186,14 @@ private:
             y_max = std::max(y_max, y);
         }
         
+        void det(const range_det& other)
+        {
+            x_min = std::min(x_min, other.x_min);
+            x_max = std::max(x_max, other.x_max);
+            y_min = std::min(y_min, other.y_min);
+            y_max = std::max(y_max, other.y_max);
+        }
+        
         bool is_valid()
         {
             return x_min != 10000 && x_max != -10000 && y_min != 10000 && y_max != -10000;
@@ -196,6 +204,15 @@ private:
         float y_min;
         float y_max;
     };
+    
+    /* 一个对象生成的脚本和网格线 各线程并行填充 之后按对象顺序串行合并 输出与线程数无关 */
+    struct model_chunk
+    {
+        std::string text;
+        std::vector<mesh::line> x;
+        std::vector<mesh::line> y;
+        range_det range;
+    };
 public:
     openems_model_gen(const std::shared_ptr<pcb>& pcb);
     ~openems_model_gen();
@@ -253,13 +270,18 @@ private:
     void _add_via(FILE *fp, std::int32_t metal_prio = 1);
     void _add_zone(FILE *fp, std::int32_t metal_prio = 1);
     void _add_footprint(FILE *fp, std::int32_t metal_prio = 1, std::int32_t metal_pad_prio = 1);
-    void _add_gr(const pcb::gr& gr, pcb::point at, float angle, const std::string& name, FILE *fp, range_det& range, std::uint32_t mesh_prio = 0, bool gen_mesh = true, std::int32_t metal_prio = 1);
-    void _add_pad(const pcb::footprint& footprint, const pcb::pad& p, const std::string& name, FILE *fp, range_det& range, std::uint32_t mesh_prio = 0, bool gen_mesh = true, std::int32_t metal_prio = 1);
-    void _add_line(FILE *fp, const std::string& name, const pcb::point& start, const pcb::point& end, float width, float z1, float z2,
-                        range_det& range, bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio = 1);
+    void _add_gr(const pcb::gr& gr, pcb::point at, float angle, const std::string& name, model_chunk& chunk, std::uint32_t mesh_prio = 0, bool gen_mesh = true, std::int32_t metal_prio = 1);
+    void _add_pad(const pcb::footprint& footprint, const pcb::pad& p, const std::string& name, model_chunk& chunk, std::uint32_t mesh_prio = 0, bool gen_mesh = true, std::int32_t metal_prio = 1);
+    void _add_line(model_chunk& chunk, const std::string& name, const pcb::point& start, const pcb::point& end, float width, float z1, float z2,
+                        bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio = 1);
                         
-    void _add_arc(FILE *fp, const std::string& name, const pcb::point& start, const pcb::point& mid, const pcb::point& end, float width, float z1, float z2,
-                        range_det& range, bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio = 1);
+    void _add_arc(model_chunk& chunk, const std::string& name, const pcb::point& start, const pcb::point& mid, const pcb::point& end, float width, float z1, float z2,
+                        bool gen_mesh, bool use_uniform_grid, std::uint32_t mesh_prio, std::int32_t metal_prio = 1);
+    
+    /* 按printf格式追加到chunk.text */
+    static void _chunk_printf(model_chunk& chunk, const char *fmt, ...);
+    /* 按顺序把chunks的脚本一次写入fp 并把网格线合并到_mesh */
+    void _write_chunks(FILE *fp, const std::vector<model_chunk>& chunks);
     
     void _add_excitation(FILE *fp, std::uint32_t mesh_prio = 99);
     void _add_lumped_element(FILE *fp, std::uint32_t mesh_prio = 99);
@@ -16,6 +16,7 @@
 *                                                                            *
 *****************************************************************************/
 
+#include <algorithm>
 #include "calc.h"
 #include "pcb.h"
 
@@ -490,6 +491,21 @@ void pcb::coo_cvt_fp2pcb(const point& fp_at, float fp_angle, point& p)
 #endif
 }
 
+void pcb::coo_cvt_fp2pcb(const point& fp_at, float fp_angle, float *xs, float *ys, std::int32_t n)
+{
+    /* y轴翻转后绕原点旋转 再平移到封装的位置 */
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        ys[i] = -ys[i];
+    }
+    calc_rotation_batch(0, 0, xs, ys, n, fp_angle);
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        xs[i] = fp_at.x + xs[i];
+        ys[i] = fp_at.y - ys[i];
+    }
+}
+
 std::string pcb::get_tstamp_short(const std::string& tstamp)
 {
     size_t pos = tstamp.find('-');
@@ -931,6 +947,57 @@ float pcb::get_layer_loss_tangent(const std::string& layer_name)
     return 0;
 }
 
+void pcb::get_cu_layer_substrate(const std::string& layer_name, float& epsilon_r, float& loss_tangent)
+{
+    layer up;
+    layer down;
+    std::int32_t state = 0;
+    
+    up.type = down.type = pcb::layer::COPPER;
+    for (auto& l: _layers)
+    {
+        if (l.name == layer_name)
+        {
+            state = 1;
+            continue;
+        }
+        if (state == 0)
+        {
+            up = l;
+        }
+        else if (state == 1)
+        {
+            down = l;
+            break;
+        }
+    }
+    
+    std::int32_t n = 0;
+    epsilon_r = 0;
+    loss_tangent = 0;
+    if (up.type == pcb::layer::DIELECTRIC)
+    {
+        epsilon_r += up.epsilon_r;
+        loss_tangent += up.loss_tangent;
+        n++;
+    }
+    
+    if (down.type == pcb::layer::DIELECTRIC)
+    {
+        epsilon_r += down.epsilon_r;
+        loss_tangent += down.loss_tangent;
+        n++;
+    }
+    
+    if (n == 0)
+    {
+        epsilon_r = 1;
+        return;
+    }
+    epsilon_r /= n;
+    loss_tangent /= n;
+}
+
 float pcb::get_board_thickness()
 {
     float dist = 0;
@@ -1571,17 +1638,44 @@ void pcb::_clean_segment(std::uint32_t net_id)
     std::list<pcb::segment> conn;
     get_no_conn_segments(net_id, no_conn, conn);
     
+    /* 焊盘的位置和大小按SoA存放 每条走线的两个端点一次和所有焊盘比较 结果跟segment_is_inside_pad相同 */
+    std::vector<pcb::pad> v_pads(pads.begin(), pads.end());
+    std::int32_t n = v_pads.size();
+    std::vector<std::vector<std::string> > pad_layers(n);
+    std::vector<double> pad_x(n);
+    std::vector<double> pad_y(n);
+    std::vector<double> pad_hw(n);
+    std::vector<double> pad_hh(n);
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        float x;
+        float y;
+        get_pad_pos(v_pads[i], x, y);
+        pad_layers[i] = get_pad_layers(v_pads[i]);
+        pad_x[i] = x;
+        pad_y[i] = y;
+        pad_hw[i] = v_pads[i].size_w * 0.5;
+        pad_hh[i] = v_pads[i].size_h * 0.5;
+    }
+    std::vector<double> start_dist(n);
+    std::vector<double> end_dist(n);
+    
     for (auto it = no_conn.begin(); it != no_conn.end();)
     {
         auto& s = *it;
-        for (const auto& p: pads)
+        calc_point_rect_dist_batch(s.second.start.x, s.second.start.y, pad_x.data(), pad_y.data(), pad_hw.data(), pad_hh.data(), n, start_dist.data());
+        calc_point_rect_dist_batch(s.second.end.x, s.second.end.y, pad_x.data(), pad_y.data(), pad_hw.data(), pad_hh.data(), n, end_dist.data());
+        for (std::int32_t i = 0; i < n; i++)
         {
-            std::uint32_t flag = segment_is_inside_pad(s.second, p);
+            if (std::find(pad_layers[i].begin(), pad_layers[i].end(), s.second.layer_name) == pad_layers[i].end())
+            {
+                continue;
+            }
+            std::uint32_t flag = ((start_dist[i] <= 0)? 0x01: 0) | ((end_dist[i] <= 0)? 0x02: 0);
             if ((s.first & 0x01) && (flag & 0x01))
             {
-                float x;
-                float y;
-                get_pad_pos(p, x, y);
+                float x = pad_x[i];
+                float y = pad_y[i];
                 pcb::segment new_s;
                 new_s = s.second;
                 new_s.end.x = x;
@@ -1592,9 +1686,8 @@ void pcb::_clean_segment(std::uint32_t net_id)
             }
             if ((s.first & 0x02) && (flag & 0x02))
             {
-                float x;
-                float y;
-                get_pad_pos(p, x, y);
+                float x = pad_x[i];
+                float y = pad_y[i];
                 pcb::segment new_s;
                 new_s = s.second;
                 new_s.start.x = x;
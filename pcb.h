@@ -275,6 +275,8 @@ public:
     
     void get_pad_pos(const pad& p, float& x, float& y);
     void coo_cvt_fp2pcb(const point& fp_at, float fp_angle, point& p);
+    /* 批量转换 xs ys为SoA存放的n个点 */
+    void coo_cvt_fp2pcb(const point& fp_at, float fp_angle, float *xs, float *ys, std::int32_t n);
     std::string get_tstamp_short(const std::string& tstamp);
     static std::string format_net(const std::string& name);
     std::string pos2net(float x, float y, const std::string& layer);
@@ -303,6 +305,8 @@ public:
     float get_cu_layer_epsilon_r(const std::string& layer_name);
     float get_layer_epsilon_r(const std::string& layer_start, const std::string& layer_end);
     float get_layer_loss_tangent(const std::string& layer_name);
+    /* 走线上下相邻的基材(不包括阻焊层)的平均介电常数和损耗角正切 */
+    void get_cu_layer_substrate(const std::string& layer_name, float& epsilon_r, float& loss_tangent);
     float get_board_thickness();
     float get_cu_min_thickness();
     float get_min_thickness(std::uint32_t layer_type);
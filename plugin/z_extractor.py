@@ -380,6 +380,7 @@ class z_extractor_gui(z_extractor_base):
         self.lock = threading.Lock()
         self.cmd_line = ""
         self.cmd_output = ""
+        self.cmd_progress = ""
         
         file_name = self.board.GetFileName()
         self.board_path = os.path.split(file_name)[0]
@@ -795,6 +796,7 @@ class z_extractor_gui(z_extractor_base):
         
         self.lock.acquire()
         self.cmd_output = ""
+        self.cmd_progress = ""
         self.cmd_line = self.gen_cmd(self.m_checkBoxExtractAll.GetValue())
         self.lock.release()
         
@@ -821,12 +823,19 @@ class z_extractor_gui(z_extractor_base):
         
     def m_timerOnTimer( self, event ):
         cmd_output = ""
+        cmd_progress = ""
         if self.lock.acquire(blocking=False):
             cmd_output = self.cmd_output
+            cmd_progress = self.cmd_progress
+            self.cmd_progress = ""
             self.lock.release()
-            
+        
+        if (cmd_progress != ""):
+            self.m_textCtrlOutput.AppendText(cmd_progress)
+        
         if (cmd_output == ""):
-            self.m_textCtrlOutput.AppendText(".")
+            if (cmd_progress == ""):
+                self.m_textCtrlOutput.AppendText(".")
         else:
             self.m_textCtrlOutput.AppendText("\n" + cmd_output + "\n");
             self.m_buttonExtract.SetLabel("Extract")
@@ -849,12 +858,17 @@ class z_extractor_gui(z_extractor_base):
             
         self.sub_process_pid = sub_process.pid
         self.lock.release()
-        out, err = sub_process.communicate()
+        
+        # 每个网络的结果一算完就会输出 逐行显示
+        for line in iter(sub_process.stdout.readline, b''):
+            self.lock.acquire()
+            self.cmd_progress += line.decode()
+            self.lock.release()
+        sub_process.wait()
             
         if sub_process.returncode == 0:
-            str = out.decode()
             self.lock.acquire()
-            self.cmd_output = str + "\n" + "time: {:.3f}s\n".format((time.perf_counter() - start_time))
+            self.cmd_output = "time: {:.3f}s\n".format((time.perf_counter() - start_time))
             self.lock.release()
             
             
@@ -0,0 +1,283 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2023 Liu An Lin <liuanlin-mx@qq.com>                        *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstdint>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include <signal.h>
+#include <errno.h>
+#include "scratch.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#define SCRATCH_SEP "\\"
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#define SCRATCH_SEP "/"
+#endif
+
+#define SCRATCH_PREFIX "z_extractor-"
+
+
+static std::string *_root = NULL;
+
+/* 进程退出时删除临时目录 */
+static void _remove_root()
+{
+    if (_root && *_root != ".")
+    {
+        scratch::remove_dir(*_root);
+    }
+}
+
+/* 被信号终止时也删除临时目录 然后按默认方式重新触发信号 */
+static void _signal_handler(int sig)
+{
+    _remove_root();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void _install_signal_handler()
+{
+    static const int sigs[] = {
+        SIGINT,
+        SIGTERM,
+#ifdef SIGHUP
+        SIGHUP,
+#endif
+    };
+    
+    for (auto sig: sigs)
+    {
+        /* 被忽略的信号保持忽略 */
+        if (signal(sig, _signal_handler) == SIG_IGN)
+        {
+            signal(sig, SIG_IGN);
+        }
+    }
+}
+
+#ifndef _WIN32
+/* 删除base下进程已经不存在的临时目录 崩溃或被SIGKILL结束的进程来不及删除 */
+static void _remove_stale(const std::string& base)
+{
+    DIR *d = opendir(base.c_str());
+    if (d == NULL)
+    {
+        return;
+    }
+    
+    std::vector<std::string> stale;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+    {
+        int pid = 0;
+        if (strncmp(e->d_name, SCRATCH_PREFIX, strlen(SCRATCH_PREFIX)) != 0
+            || sscanf(e->d_name + strlen(SCRATCH_PREFIX), "%d-", &pid) != 1
+            || pid <= 0 || pid == getpid())
+        {
+            continue;
+        }
+        
+        if (kill(pid, 0) != 0 && errno == ESRCH)
+        {
+            stale.push_back(scratch::path(base, e->d_name));
+        }
+    }
+    closedir(d);
+    
+    for (const auto& dir: stale)
+    {
+        struct stat st;
+        if (lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid())
+        {
+            scratch::remove_dir(dir);
+        }
+    }
+}
+#endif
+
+static std::string *_create_root()
+{
+    std::string base;
+    std::string *root = new std::string;
+    const char *env = getenv("Z_EXTRACTOR_TMPDIR");
+    if (env && env[0])
+    {
+        base = env;
+    }
+#ifdef _WIN32
+    if (base.empty())
+    {
+        env = getenv("TEMP");
+        base = (env && env[0])? env: ".";
+    }
+    
+    for (std::int32_t i = 0; i < 1000 && root->empty(); i++)
+    {
+        char name[64];
+        sprintf(name, SCRATCH_SEP SCRATCH_PREFIX "%d-%d", _getpid(), i);
+        if (_mkdir((base + name).c_str()) == 0)
+        {
+            *root = base + name;
+        }
+    }
+#else
+    if (base.empty() && access("/dev/shm", W_OK) == 0)
+    {
+        base = "/dev/shm";
+    }
+    if (base.empty())
+    {
+        env = getenv("TMPDIR");
+        base = (env && env[0])? env: "/tmp";
+    }
+    
+    _remove_stale(base);
+    
+    char name[64];
+    sprintf(name, SCRATCH_SEP SCRATCH_PREFIX "%d-XXXXXX", (int)getpid());
+    std::string tmpl = base + name;
+    std::vector<char> buf(tmpl.begin(), tmpl.end());
+    buf.push_back(0);
+    if (mkdtemp(buf.data()))
+    {
+        *root = buf.data();
+    }
+#endif
+    if (root->empty())
+    {
+        printf("warn: failed to create scratch directory in %s, using current directory.\n", base.c_str());
+        *root = ".";
+    }
+    
+    /* 不释放 退出时其他静态对象的析构函数还可能用到 */
+    _root = root;
+    atexit(_remove_root);
+    _install_signal_handler();
+    return root;
+}
+
+
+const std::string& scratch::dir()
+{
+    static std::string *root = _create_root();
+    return *root;
+}
+
+std::string scratch::make_subdir(const std::string& prefix)
+{
+    static std::atomic<std::uint32_t> seq(0);
+    char name[64];
+    sprintf(name, "%u", seq++);
+    std::string sub = path(dir(), prefix + name);
+#ifdef _WIN32
+    if (_mkdir(sub.c_str()) != 0)
+#else
+    if (mkdir(sub.c_str(), 0700) != 0)
+#endif
+    {
+        printf("err: failed to create scratch directory %s.\n", sub.c_str());
+        return "";
+    }
+    return sub;
+}
+
+void scratch::remove_dir(const std::string& path)
+{
+#ifdef _WIN32
+    struct _finddata_t fd;
+    intptr_t h = _findfirst((path + SCRATCH_SEP "*").c_str(), &fd);
+    if (h != -1)
+    {
+        do
+        {
+            if (strcmp(fd.name, ".") == 0 || strcmp(fd.name, "..") == 0)
+            {
+                continue;
+            }
+            std::string name = scratch::path(path, fd.name);
+            if (fd.attrib & _A_SUBDIR)
+            {
+                remove_dir(name);
+            }
+            else
+            {
+                remove(name.c_str());
+            }
+        } while (_findnext(h, &fd) == 0);
+        _findclose(h);
+    }
+    _rmdir(path.c_str());
+#else
+    DIR *d = opendir(path.c_str());
+    if (d)
+    {
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL)
+        {
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            {
+                continue;
+            }
+            std::string name = scratch::path(path, e->d_name);
+            struct stat st;
+            if (lstat(name.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                remove_dir(name);
+            }
+            else
+            {
+                remove(name.c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(path.c_str());
+#endif
+}
+
+void scratch::remove_subdir(const std::string& path)
+{
+    if (!path.empty())
+    {
+        remove_dir(path);
+    }
+}
+
+std::string scratch::path(const std::string& dir, const std::string& name)
+{
+    return dir + SCRATCH_SEP + name;
+}
+
+std::string scratch::cd_cmd(const std::string& dir)
+{
+#ifdef _WIN32
+    return "cd /d \"" + dir + "\" && ";
+#else
+    return "cd \"" + dir + "\" && ";
+#endif
+}
@@ -0,0 +1,44 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2023 Liu An Lin <liuanlin-mx@qq.com>                        *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+
+#ifndef __SCRATCH_H__
+#define __SCRATCH_H__
+#include <string>
+
+/* 外部求解器(fasthenry mmtl_bem)的临时文件目录
+ * 每个进程一个独立目录 优先使用内存文件系统 进程退出或被SIGINT/SIGTERM/SIGHUP终止时自动删除
+ * 目录名带进程号 启动时删除已经不存在的进程留下的目录(崩溃或被强制结束)
+ * 可以用环境变量Z_EXTRACTOR_TMPDIR指定上级目录
+ */
+class scratch
+{
+public:
+    /* 当前进程的临时目录 第一次调用时创建 */
+    static const std::string& dir();
+    /* 在进程临时目录下创建唯一的子目录 每个求解器实例使用自己的子目录 可以并行调用 失败时返回空字符串 */
+    static std::string make_subdir(const std::string& prefix);
+    /* 删除目录及其中的文件 */
+    static void remove_dir(const std::string& path);
+    /* 删除make_subdir创建的子目录 path为空时不做任何事 */
+    static void remove_subdir(const std::string& path);
+    static std::string path(const std::string& dir, const std::string& name);
+    /* 在dir目录下执行命令的前缀 用于会在当前目录写文件的外部程序 */
+    static std::string cd_cmd(const std::string& dir);
+};
+
+#endif
@@ -0,0 +1,289 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2023 Liu An Lin <liuanlin-mx@qq.com>                        *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+
+#include <math.h>
+#include <algorithm>
+#include "xsection.h"
+
+/* FNV-1a */
+#define XSECTION_HASH_BASIS (14695981039346656037ULL)
+#define XSECTION_HASH_PRIME (1099511628211ULL)
+
+xsection::xsection()
+    : _rows(0)
+    , _cols(0)
+    , _hash(XSECTION_HASH_BASIS)
+{
+}
+
+xsection::~xsection()
+{
+}
+
+void xsection::clear(std::int32_t rows, std::int32_t cols)
+{
+    _rows = rows;
+    _cols = cols;
+    _shapes.clear();
+    _hash = XSECTION_HASH_BASIS;
+    
+    shape s;
+    s.type = 0xff;
+    s.material = 0;
+    s.x1 = s.x2 = cols;
+    s.y1 = s.y2 = rows;
+    _update_hash(s);
+}
+
+void xsection::add_rect(std::uint32_t material, std::int32_t x1, std::int32_t y1, std::int32_t x2, std::int32_t y2)
+{
+    shape s;
+    s.type = SHAPE_RECT;
+    s.material = material;
+    s.x1 = x1;
+    s.y1 = y1;
+    s.x2 = x2;
+    s.y2 = y2;
+    _shapes.push_back(s);
+    _update_hash(s);
+}
+
+void xsection::add_ring(std::uint32_t material, std::int32_t x, std::int32_t y, std::int32_t radius, std::int32_t thick)
+{
+    shape s;
+    s.type = SHAPE_RING;
+    s.material = material;
+    s.x1 = x;
+    s.y1 = y;
+    s.x2 = radius;
+    s.y2 = thick;
+    _shapes.push_back(s);
+    _update_hash(s);
+}
+
+
+bool xsection::is_same(const xsection& other, std::int32_t tol) const
+{
+    if (_rows != other._rows || _cols != other._cols || _shapes.size() != other._shapes.size())
+    {
+        return false;
+    }
+    
+    if (_hash == other._hash && tol > 0)
+    {
+        return true;
+    }
+    
+    std::int64_t count = 0;
+    for (std::size_t i = 0; i < _shapes.size() && count < tol; i++)
+    {
+        count += _diff(_shapes[i], other._shapes[i]);
+    }
+    return count < tol;
+}
+
+bool xsection::is_mirror(const xsection& other, std::int32_t tol, std::uint32_t cond1, std::uint32_t cond2) const
+{
+    if (_rows != other._rows || _cols != other._cols || _shapes.size() != other._shapes.size())
+    {
+        return false;
+    }
+    
+    std::vector<shape> mirror(other._shapes);
+    for (auto& s: mirror)
+    {
+        if (s.type == SHAPE_RECT)
+        {
+            std::int32_t x1 = _cols - s.x2;
+            s.x2 = _cols - s.x1;
+            s.x1 = x1;
+        }
+        else
+        {
+            s.x1 = _cols - 1 - s.x1;
+        }
+        
+        if (s.material == cond1)
+        {
+            s.material = cond2;
+        }
+        else if (s.material == cond2)
+        {
+            s.material = cond1;
+        }
+    }
+    
+    /* 导体1和导体2交换后 地和其他物体从左到右添加变成了从右到左 不能按添加顺序逐个比较
+     * 两边都按材料和位置排序 排序后的第k个物体互相对应
+     */
+    std::int32_t n = _shapes.size();
+    std::vector<std::int32_t> idx_a(n);
+    std::vector<std::int32_t> idx_b(n);
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        idx_a[i] = idx_b[i] = i;
+    }
+    std::sort(idx_a.begin(), idx_a.end(), [&](std::int32_t i, std::int32_t j) { return _less(_shapes[i], _shapes[j]); });
+    std::sort(idx_b.begin(), idx_b.end(), [&](std::int32_t i, std::int32_t j) { return _less(mirror[i], mirror[j]); });
+    
+    std::int64_t count = 0;
+    for (std::int32_t k = 0; k < n && count < tol; k++)
+    {
+        count += _diff(_shapes[idx_a[k]], mirror[idx_b[k]]);
+    }
+    if (count >= tol)
+    {
+        return false;
+    }
+    
+    /* 后添加的覆盖先添加的 重叠的不同材料物体在两边的先后顺序必须相同 */
+    std::vector<std::int32_t> pair(n);
+    for (std::int32_t k = 0; k < n; k++)
+    {
+        pair[idx_a[k]] = idx_b[k];
+    }
+    for (std::int32_t i = 0; i < n; i++)
+    {
+        for (std::int32_t j = i + 1; j < n; j++)
+        {
+            if (_shapes[i].material != _shapes[j].material
+                && _overlap(_shapes[i], _shapes[j])
+                && pair[i] > pair[j])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void xsection::render(cv::Mat& img) const
+{
+    img = cv::Mat(_rows, _cols, CV_8UC3, cv::Scalar(255, 255, 255));
+    for (const auto& s: _shapes)
+    {
+        cv::Scalar color(s.material & 0xff, (s.material >> 8) & 0xff, (s.material >> 16) & 0xff);
+        if (s.type == SHAPE_RECT)
+        {
+            cv::rectangle(img, cv::Point(s.x1, s.y1), cv::Point(s.x2 - 1, s.y2 - 1), color, -1);
+        }
+        else
+        {
+            cv::circle(img, cv::Point(s.x1, s.y1), s.x2, color, s.y2);
+        }
+    }
+}
+
+
+void xsection::_update_hash(const shape& s)
+{
+    std::int32_t v[6] = {s.type, (std::int32_t)s.material, s.x1, s.y1, s.x2, s.y2};
+    const std::uint8_t *p = (const std::uint8_t *)v;
+    for (std::size_t i = 0; i < sizeof(v); i++)
+    {
+        _hash = (_hash ^ p[i]) * XSECTION_HASH_PRIME;
+    }
+}
+
+std::int64_t xsection::_area(const shape& s) const
+{
+    if (s.type == SHAPE_RING)
+    {
+        return 2 * M_PI * s.x2 * s.y2;
+    }
+    
+    std::int64_t w = std::min(s.x2, _cols) - std::max(s.x1, 0);
+    std::int64_t h = std::min(s.y2, _rows) - std::max(s.y1, 0);
+    return (w > 0 && h > 0)? w * h: 0;
+}
+
+std::int64_t xsection::_diff(const shape& a, const shape& b) const
+{
+    if (a.type != b.type || a.material != b.material)
+    {
+        return _area(a) + _area(b);
+    }
+    
+    if (a.type == SHAPE_RING)
+    {
+        return (a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2)? 0: _area(a) + _area(b);
+    }
+    
+    /* 对称差的面积 */
+    shape c;
+    c.type = SHAPE_RECT;
+    c.x1 = std::max(a.x1, b.x1);
+    c.y1 = std::max(a.y1, b.y1);
+    c.x2 = std::min(a.x2, b.x2);
+    c.y2 = std::min(a.y2, b.y2);
+    std::int64_t both = (c.x1 < c.x2 && c.y1 < c.y2)? _area(c): 0;
+    return _area(a) + _area(b) - 2 * both;
+}
+
+bool xsection::_less(const shape& a, const shape& b)
+{
+    if (a.type != b.type)
+    {
+        return a.type < b.type;
+    }
+    if (a.material != b.material)
+    {
+        return a.material < b.material;
+    }
+    if (a.y1 != b.y1)
+    {
+        return a.y1 < b.y1;
+    }
+    if (a.x1 != b.x1)
+    {
+        return a.x1 < b.x1;
+    }
+    if (a.y2 != b.y2)
+    {
+        return a.y2 < b.y2;
+    }
+    return a.x2 < b.x2;
+}
+
+bool xsection::_overlap(const shape& a, const shape& b)
+{
+    std::int32_t box_a[4];
+    std::int32_t box_b[4];
+    const shape *s[2] = {&a, &b};
+    std::int32_t *box[2] = {box_a, box_b};
+    for (std::int32_t i = 0; i < 2; i++)
+    {
+        if (s[i]->type == SHAPE_RING)
+        {
+            /* 外接矩形 半径加上半个环的厚度 */
+            std::int32_t r = s[i]->x2 + (s[i]->y2 + 1) / 2;
+            box[i][0] = s[i]->x1 - r;
+            box[i][1] = s[i]->y1 - r;
+            box[i][2] = s[i]->x1 + r + 1;
+            box[i][3] = s[i]->y1 + r + 1;
+        }
+        else
+        {
+            box[i][0] = s[i]->x1;
+            box[i][1] = s[i]->y1;
+            box[i][2] = s[i]->x2;
+            box[i][3] = s[i]->y2;
+        }
+    }
+    return box_a[0] < box_b[2] && box_b[0] < box_a[2] && box_a[1] < box_b[3] && box_b[1] < box_a[3];
+}
@@ -0,0 +1,91 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2023 Liu An Lin <liuanlin-mx@qq.com>                        *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+
+#ifndef __XSECTION_H__
+#define __XSECTION_H__
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/* 传输线截面的几何描述 按添加顺序记录像素坐标下的矩形和圆环以及材料
+ * 后添加的覆盖先添加的 所以顺序也是描述的一部分
+ * 判断两次计算的截面是否相同只需要比较描述 需要求解时才光栅化成图像
+ */
+class xsection
+{
+public:
+    enum
+    {
+        SHAPE_RECT = 0,
+        SHAPE_RING,
+    };
+    
+    struct shape
+    {
+        std::uint8_t type;
+        /* 材料 即光栅化时的颜色 0xRRGGBB */
+        std::uint32_t material;
+        /* 矩形为[x1, x2) [y1, y2) 圆环x1 y1为圆心 x2为半径 y2为环的厚度 */
+        std::int32_t x1;
+        std::int32_t y1;
+        std::int32_t x2;
+        std::int32_t y2;
+    };
+    
+public:
+    xsection();
+    ~xsection();
+    
+public:
+    void clear(std::int32_t rows = 0, std::int32_t cols = 0);
+    void add_rect(std::uint32_t material, std::int32_t x1, std::int32_t y1, std::int32_t x2, std::int32_t y2);
+    void add_ring(std::uint32_t material, std::int32_t x, std::int32_t y, std::int32_t radius, std::int32_t thick);
+    
+    std::int32_t rows() const { return _rows; }
+    std::int32_t cols() const { return _cols; }
+    std::uint64_t hash() const { return _hash; }
+    
+    /* 两个截面不同的像素数小于tol时认为相同 物体数量或盒子大小不同时认为不同 */
+    bool is_same(const xsection& other, std::int32_t tol) const;
+    /* 左右镜像(同时交换材料cond1和cond2)后和other相同 cond1等于cond2时不交换
+     * 镜像后物体的添加顺序会变 按材料和位置排序后比较 互相重叠的不同材料物体的先后顺序要一致
+     */
+    bool is_mirror(const xsection& other, std::int32_t tol, std::uint32_t cond1, std::uint32_t cond2) const;
+    
+    /* 光栅化 背景为白色 */
+    void render(cv::Mat& img) const;
+    
+private:
+    void _update_hash(const shape& s);
+    std::int64_t _area(const shape& s) const;
+    /* 两个物体不同的像素数 只按几何估算 不考虑被其他物体覆盖的部分 */
+    std::int64_t _diff(const shape& a, const shape& b) const;
+    /* 排序用 先按类型和材料 再按位置 */
+    static bool _less(const shape& a, const shape& b);
+    /* 两个物体的外接矩形是否重叠 */
+    static bool _overlap(const shape& a, const shape& b);
+    
+private:
+    std::int32_t _rows;
+    std::int32_t _cols;
+    std::vector<shape> _shapes;
+    std::uint64_t _hash;
+};
+
+#endif
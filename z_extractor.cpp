@@ -25,6 +25,7 @@
 #include "fdm_Z0_calc.h"
 #include "Z0_calc.h"
 #include "calc.h"
+#include "ir_drop.h"
 
 #if 0
 #define log_debug(fmt, args...) printf(fmt, ##args)
@@ -48,11 +49,20 @@ z_extractor::z_extractor(std::shared_ptr<pcb>& pcb)
     _ltra_model = true;
     _via_tl_mode = false;
     _enable_openmp = true;
+    _wideband_model = WIDEBAND_NONE;
+    _segment_merge = false;
+    _zone_mesh_level = 0;
+    _zone_refine = false;
     
     _img_ratio = 1 / (0.0254 * 0.5);
     
     _conductivity = 5.8e7;
     _freq = 1e9;
+    _rl_fmax = 0;
+    _rl_ndec = 10;
+    _fdm_rel_tol = 0;
+    _fdm_max_iter = 0;
+    _roughness = 0;
     
     
     std::int32_t thread_nums = omp_get_max_threads();
@@ -72,171 +82,133 @@ bool z_extractor::gen_subckt_rl(const std::string& footprint1, const std::string
                         const std::string& footprint2, const std::string& footprint2_pad_number,
                         std::string& ckt, std::string& call, float& r, float& l)
 {
-    pcb::pad pad1;
-    pcb::pad pad2;
-    if (!_pcb->get_pad(footprint1, footprint1_pad_number, pad1))
+    rl_port port;
+    port.footprint1 = footprint1;
+    port.footprint1_pad_number = footprint1_pad_number;
+    port.footprint2 = footprint2;
+    port.footprint2_pad_number = footprint2_pad_number;
+    
+    std::vector<std::string> ckts;
+    std::vector<std::string> calls;
+    std::vector<double> r_;
+    std::vector<double> l_;
+    if (!gen_subckt_rl({port}, ckts, calls, r_, l_))
     {
-        printf("not found %s.%s\n", footprint1.c_str(), footprint1_pad_number.c_str());
         return false;
     }
-    
-    if (!_pcb->get_pad(footprint2, footprint2_pad_number, pad2))
+    ckt = ckts[0];
+    call = calls[0];
+    r = r_[0];
+    l = l_[0];
+    return true;
+}
+
+
+bool z_extractor::gen_subckt_rl(const std::vector<rl_port>& ports, std::vector<std::string>& ckts, std::vector<std::string>& calls,
+                        std::vector<double>& r, std::vector<double>& l)
+{
+    if (ports.empty())
     {
-        printf("not found %s.%s\n", footprint2.c_str(), footprint2_pad_number.c_str());
         return false;
     }
     
-    if (pad1.net != pad2.net)
+    std::uint32_t net_id = 0;
+    std::vector<std::pair<std::string, std::string> > nodes;
+    for (std::uint32_t i = 0; i < ports.size(); i++)
     {
-        printf("err: %s.%s %s.%s not on the same network\n", footprint1.c_str(), footprint1_pad_number.c_str(),
-                                    footprint2.c_str(), footprint2_pad_number.c_str());
-        return false;
+        const rl_port& port = ports[i];
+        pcb::pad pad1;
+        pcb::pad pad2;
+        if (!_pcb->get_pad(port.footprint1, port.footprint1_pad_number, pad1))
+        {
+            printf("not found %s.%s\n", port.footprint1.c_str(), port.footprint1_pad_number.c_str());
+            return false;
+        }
+        
+        if (!_pcb->get_pad(port.footprint2, port.footprint2_pad_number, pad2))
+        {
+            printf("not found %s.%s\n", port.footprint2.c_str(), port.footprint2_pad_number.c_str());
+            return false;
+        }
+        
+        if (pad1.net != pad2.net || (i > 0 && pad1.net != net_id))
+        {
+            printf("err: %s.%s %s.%s not on the same network\n", port.footprint1.c_str(), port.footprint1_pad_number.c_str(),
+                                        port.footprint2.c_str(), port.footprint2_pad_number.c_str());
+            return false;
+        }
+        net_id = pad1.net;
+        
+        float x1;
+        float y1;
+        float x2;
+        float y2;
+        std::vector<std::string> layers1 = _pcb->get_pad_layers(pad1);
+        std::vector<std::string> layers2 = _pcb->get_pad_layers(pad2);
+        _pcb->get_pad_pos(pad1, x1, y1);
+        _pcb->get_pad_pos(pad2, x2, y2);
+        nodes.push_back(std::pair<std::string, std::string>(_pos2net(x1, y1, layers1.front()), _pos2net(x2, y2, layers2.front())));
     }
-    std::uint32_t net_id = pad1.net;
-    
     
-    if (_pcb->check_segments(net_id) == false)
+    /* 构建fasthenry */
+    fasthenry henry;
+    if (!_build_rl_model(henry, net_id))
     {
         return false;
     }
     
-    std::list<pcb::pad> pads = _pcb->get_pads(net_id);
-    std::vector<std::list<pcb::segment> > v_segments = _pcb->get_segments_sort(net_id);
-    std::list<pcb::via> vias = _pcb->get_vias(net_id);
+    //henry.dump();
     
-    /* 构建fasthenry */
-    fasthenry henry;
-    henry.set_freq(_freq);
-    henry.set_conductivity(_conductivity);
-    std::map<std::string, cv::Mat> zone_mat;
-    std::map<std::string, std::list<cond> > conds;
-    bool have_zones = !_pcb->get_zones(net_id).empty();
-    float grid_size = 1;
-    if (have_zones)
+    std::uint32_t n = ports.size();
+    std::vector<fasthenry::impedance_matrix> ims;
+    if (!henry.calc_impedance_sweep(nodes, ims))
     {
-        _create_refs_mat({net_id}, zone_mat, false);
-        _add_zone(henry, net_id, zone_mat, conds, grid_size);
+        ims.clear();
     }
     
-    for (auto& s_list: v_segments)
+    /* 矩阵取最低频点的值 */
+    r.assign(n * n, 0);
+    l.assign(n * n, 0);
+    if (!ims.empty())
     {
-        float z_val = _pcb->get_layer_z_axis(s_list.front().layer_name);
-        float h_val = _pcb->get_layer_thickness(s_list.front().layer_name);
-        
-        for (auto& s: s_list)
-        { 
-            henry.add_wire(_pos2net(s.start.x, s.start.y, s.layer_name), _pos2net(s.end.x, s.end.y, s.layer_name),
-                                _get_tstamp_short(s.tstamp),
-                                fasthenry::point(s.start.x, s.start.y, z_val),
-                                fasthenry::point(s.end.x, s.end.y, z_val), s.width, h_val);
-            if (have_zones)
-            {
-                _conn_to_zone(henry, s.start.x, s.start.y, zone_mat, s.layer_name, conds, grid_size);
-                _conn_to_zone(henry, s.end.x, s.end.y, zone_mat, s.layer_name, conds, grid_size);
-            }
+        for (std::uint32_t i = 0; i < n * n; i++)
+        {
+            r[i] = ims[0].values[i].first;
+            l[i] = ims[0].values[i].second / (2 * M_PI * ims[0].freq);
         }
     }
     
-    for (auto& v: vias)
+    /* 每十倍频程一节梯形网络 */
+    std::int32_t sections = 0;
+    if (ims.size() > 1)
     {
-        std::vector<std::string> layers = _pcb->get_via_layers(v);
-        for (std::int32_t i = 0; i < (std::int32_t)layers.size() - 1; i++)
-        {
-            const std::string& start = layers[i];
-            const std::string& end = layers[i + 1];
-            
-            float z1 = _pcb->get_layer_z_axis(start);
-            float z2 = _pcb->get_layer_z_axis(end);
-            
-            henry.add_via(_pos2net(v.at.x, v.at.y, start), _pos2net(v.at.x, v.at.y, end),
-                                _format_net(_get_tstamp_short(v.tstamp) + start + end).c_str(),
-                                fasthenry::point(v.at.x, v.at.y, z1),
-                                fasthenry::point(v.at.x, v.at.y, z2), v.drill, v.size);
-            if (have_zones)
-            {
-                _conn_to_zone(henry, v.at.x, v.at.y, zone_mat, start, conds, grid_size);
-                _conn_to_zone(henry, v.at.x, v.at.y, zone_mat, end, conds, grid_size);
-            }
-        }
+        sections = round(log10(ims.back().freq / ims.front().freq));
+        sections = std::min(std::max(sections, 1), 8);
     }
-
-    for (const auto& pad: pads)
+    
+    ckts.resize(n);
+    calls.resize(n);
+    for (std::uint32_t i = 0; i < n; i++)
     {
-        float x;
-        float y;
-        _pcb->get_pad_pos(pad, x, y);
-        
-        std::vector<std::string> layers = _pcb->get_pad_layers(pad);
-        
-        if (layers.size() == 1)
-        {
-            const std::string& layer = layers.front();
-            float z = _pcb->get_layer_z_axis(layer);
-            henry.add_node(_pos2net(x, y, layer), fasthenry::point(x, y, z));
-                                
-            if (have_zones)
-            {
-                _conn_to_zone(henry, x, y, zone_mat, layer, conds, grid_size);
-            }
-        }
-        
-        for (std::uint32_t i = 1; i < layers.size(); i++)
+        double r0 = r[i * n + i];
+        double l0 = l[i * n + i];
+        std::vector<double> rk;
+        std::vector<double> lk;
+        if (sections > 0)
         {
-            const std::string& start = layers[i - 1];
-            const std::string& end = layers[i];
-            float z1 = _pcb->get_layer_z_axis(start);
-            float z2 = _pcb->get_layer_z_axis(end);
-            
-            henry.add_via(_pos2net(x, y, start), _pos2net(x, y, end),
-                                _format_net(_get_tstamp_short(pad.tstamp) + start + end).c_str(),
-                                fasthenry::point(x, y, z1),
-                                fasthenry::point(x, y, z2), 1, 1);
-            
-            if (have_zones)
+            std::vector<double> freq;
+            std::vector<std::pair<double, double> > z;
+            for (const auto& im: ims)
             {
-                _conn_to_zone(henry, x, y, zone_mat, start, conds, grid_size);
-                _conn_to_zone(henry, x, y, zone_mat, end, conds, grid_size);
+                freq.push_back(im.freq);
+                z.push_back(im.values[i * n + i]);
             }
+            double err = fasthenry::fit_rl_ladder(freq, z, sections, r0, l0, rk, lk);
+            log_info("%s.%s-%s.%s rl ladder sections:%d err:%.2f%%\n", ports[i].footprint1.c_str(), ports[i].footprint1_pad_number.c_str(),
+                        ports[i].footprint2.c_str(), ports[i].footprint2_pad_number.c_str(), (std::int32_t)rk.size(), err * 100);
         }
+        _gen_rl_ckt(net_id, ports[i], r0, l0, rk, lk, ckts[i], calls[i]);
     }
-    
-    //henry.dump();
-    
-    float x1;
-    float y1;
-    float x2;
-    float y2;
-    double r_ = 0;
-    double l_ = 0;
-        
-    std::vector<std::string> layers1 = _pcb->get_pad_layers(pad1);
-    std::vector<std::string> layers2 = _pcb->get_pad_layers(pad2);
-    _pcb->get_pad_pos(pad1, x1, y1);
-    _pcb->get_pad_pos(pad2, x2, y2);
-    henry.calc_impedance(_pos2net(x1, y1, layers1.front()), _pos2net(x2, y2, layers2.front()), r_, l_);
-    
-    
-    char buf[512];
-    std::string comment;
-    std::string subckt_name = _format_net_name(_pcb->get_net_name(net_id) + "_" +
-                            footprint1 + "_" + footprint1_pad_number + "-" + 
-                            footprint2 + "_" + footprint2_pad_number) + " ";
-    
-    std::string ckt_pin1 = footprint1 + "_" + footprint1_pad_number;
-    std::string ckt_pin2 = footprint2 + "_" + footprint2_pad_number;
-    ckt = ".subckt " + subckt_name + " " + ckt_pin1 + " " + ckt_pin2 + "\n";
-    call = "X" + subckt_name + " " + ckt_pin1 + " " + ckt_pin2 + " " + subckt_name + "\n";
-    
-    comment = "****" + footprint1 + "." + footprint1_pad_number + "    " + footprint2 + "." + footprint2_pad_number +  "*****\n";
-    ckt = comment + ckt;
-    sprintf(buf, "R1 %s mid %lg\n", ckt_pin1.c_str(), r_);
-    ckt += buf;
-    sprintf(buf, "L1 mid %s %lg\n", ckt_pin2.c_str(), l_);
-    ckt += buf;
-    ckt += ".ends\n";
-    
-    r = r_;
-    l = l_;
     return true;
 }
 
@@ -561,7 +533,12 @@ bool z_extractor::gen_subckt(std::vector<std::uint32_t> net_ids, std::vector<std
             }
         }
         
-        sub += henry.gen_ckt2(wire_names, ckt_name);
+        std::string rl = henry.gen_ckt2(wire_names, ckt_name);
+        if (rl.empty())
+        {
+            return false;
+        }
+        sub += rl;
         ckt += "X" + ckt_name + call_param + ckt_name + "\n";
         
     }
@@ -581,7 +558,12 @@ bool z_extractor::gen_subckt(std::vector<std::uint32_t> net_ids, std::vector<std
                     continue;
                 }
                 
-                sub += henry.gen_ckt(_get_tstamp_short(s.tstamp).c_str(), ("RL" + _get_tstamp_short(s.tstamp)).c_str());
+                std::string rl = henry.gen_ckt(_get_tstamp_short(s.tstamp).c_str(), ("RL" + _get_tstamp_short(s.tstamp)).c_str());
+                if (rl.empty())
+                {
+                    return false;
+                }
+                sub += rl;
                 
                 sprintf(buf, "X%s %s %s RL%s\n", tstamp.c_str(),
                                         _pos2net(s.start.x, s.start.y, s.layer_name).c_str(),
@@ -612,7 +594,12 @@ bool z_extractor::gen_subckt(std::vector<std::uint32_t> net_ids, std::vector<std
                 const std::string& start = layers[i];
                 const std::string& end = layers[i + 1];
                 std::string name = tstamp + _format_layer_name(start) + _format_layer_name(end);
-                sub += henry.gen_ckt(name.c_str(), ("RL" + name).c_str());
+                std::string rl = henry.gen_ckt(name.c_str(), ("RL" + name).c_str());
+                if (rl.empty())
+                {
+                    return false;
+                }
+                sub += rl;
                 sprintf(buf, "X%s %s %s RL%s\n", name.c_str(),
                                         _pos2net(v.at.x, v.at.y, start).c_str(),
                                         _pos2net(v.at.x, v.at.y, end).c_str(),
@@ -696,49 +683,58 @@ bool z_extractor::gen_subckt_zo(std::uint32_t net_id, std::vector<std::uint32_t>
         std::string ckt_net_name;
         std::vector<pcb::segment> v_list(s_list.begin(), s_list.end());
         
+        std::vector<std::vector<pcb::segment> > runs;
+        _merge_segments(v_list, runs);
+        
+        /* 每条走线的结果写到自己的位置 最后按走线顺序拼接 输出与线程数无关 */
+        std::vector<segment_ckt> v_ckt(runs.size());
         #pragma omp parallel for
-        for (std::uint32_t i = 0; i < v_list.size(); i++)
+        for (std::uint32_t i = 0; i < runs.size(); i++)
         {
             char buf[512];
-            pcb::segment& s = v_list[i];
-            std::string tstamp = _get_tstamp_short(s.tstamp);
-            std::string subckt;
-            std::vector<std::pair<float, float> > v_Z0_td_;
-            subckt = _gen_segment_Z0_ckt_openmp(("ZO" + _get_tstamp_short(s.tstamp)).c_str(), s, refs_mat, v_Z0_td_);
+            const pcb::segment& s = runs[i].front();
+            const pcb::segment& e = runs[i].back();
+            segment_ckt& out = v_ckt[i];
+            out.subckt = _gen_segment_Z0_ckt_openmp(("ZO" + _get_tstamp_short(s.tstamp)).c_str(), runs[i], refs_mat, out.Z0_td[0], out.models);
             
             sprintf(buf, "X%s %s %s ZO%s\n", _get_tstamp_short(s.tstamp).c_str(),
                                     _pos2net(s.start.x, s.start.y, s.layer_name).c_str(),
-                                    _pos2net(s.end.x, s.end.y, s.layer_name).c_str(),
+                                    _pos2net(e.end.x, e.end.y, e.layer_name).c_str(),
                                     _get_tstamp_short(s.tstamp).c_str());
-            #pragma omp critical
+            out.call = buf;
+            for (const auto& seg: runs[i])
             {
-                sub += subckt;
-                ckt += buf;
-                len += _pcb->get_segment_len(s);
-                v_Z0_td.insert(v_Z0_td.end(), v_Z0_td_.begin(), v_Z0_td_.end());
-                for (const auto& Z0_td: v_Z0_td_)
-                {
-                    td_sum += Z0_td.second;
-                }
+                out.len[0] += _pcb->get_segment_len(seg);
+            }
+        }
+        
+        for (const auto& out: v_ckt)
+        {
+            sub += _emit_models(out.models);
+            sub += out.subckt;
+            ckt += out.call;
+            len += out.len[0];
+            v_Z0_td.insert(v_Z0_td.end(), out.Z0_td[0].begin(), out.Z0_td[0].end());
+            for (const auto& Z0_td: out.Z0_td[0])
+            {
+                td_sum += Z0_td.second;
             }
         }
     }
     
     /* 生成过孔参数 */
-    for (auto& v: vias)
     {
         std::string via_call;
-        float td = 0;
-        if (_via_tl_mode)
+        std::vector<float> v_td;
+        sub += _gen_vias_ckt(vias, refs_mat, refs_id, via_call, v_td);
+        for (const auto& td: v_td)
         {
-            sub += _gen_via_Z0_ckt(v, refs_mat, refs_id, via_call, td);
+            td_sum += td;
         }
-        else
+        for (auto& v: vias)
         {
-            sub += _gen_via_model_ckt(v, refs_mat, via_call, td);
+            len += _pcb->get_via_conn_len(v);
         }
-        td_sum += td;
-        len += _pcb->get_via_conn_len(v);
         ckt += via_call;
     }
 
@@ -787,53 +783,48 @@ bool z_extractor::gen_subckt_coupled_tl(std::uint32_t net_id0, std::uint32_t net
         {
             auto& s0 = *it0;
             bool _brk = false;
-            for (auto& s_list1: v_segments1)
+            /* 先批量筛掉距离太远的走线 剩下的按原来的顺序逐条判断 */
+            std::vector<std::pair<std::list<pcb::segment> *, std::list<pcb::segment>::iterator> > cands;
+            _get_coupled_candidates(s0, v_segments1, cands);
+            for (auto& cand: cands)
             {
-                for (auto it1 = s_list1.begin(); it1 != s_list1.end(); it1++)
+                auto& s_list1 = *cand.first;
+                auto it1 = cand.second;
+                auto& s1 = *it1;
+                if (_is_coupled(s0, s1, _coupled_max_gap, _coupled_min_len))
                 {
-                    auto& s1 = *it1;
-                    if (_is_coupled(s0, s1, _coupled_max_gap, _coupled_min_len))
+                    double aox1;
+                    double aoy1;
+                    double aox2;
+                    double aoy2;
+                    double box1;
+                    double boy1;
+                    double box2;
+                    double boy2;
+                    
+                    if (_get_coupled_overlap(s0, s1, aox1, aoy1, aox2, aoy2, box1, boy1, box2, boy2))
                     {
-                        double aox1;
-                        double aoy1;
-                        double aox2;
-                        double aoy2;
-                        double box1;
-                        double boy1;
-                        double box2;
-                        double boy2;
+                        std::list<pcb::segment> ss0;
+                        std::list<pcb::segment> ss1;
+                        _split_segment(s0, ss0, aox1, aoy1, aox2, aoy2);
+                        _split_segment(s1, ss1, box1, boy1, box2, boy2);
+                        double couple_len = (s0.is_arc())? _pcb->get_segment_len(ss0.front()): calc_dist(aox1, aoy1, aox2, aoy2);
+                        coupler_segment.emplace(1.0 / couple_len, std::pair<pcb::segment, pcb::segment>(ss0.front(), ss1.front()));
+                        
+                        ss0.pop_front();
+                        ss1.pop_front();
+                        
+                        s_list0.erase(it0);
+                        
+                        s_list0.splice(s_list0.end(), ss0);
+                        s_list1.splice(s_list1.end(), ss1);
+                        s_list1.erase(it1);
                         
-                        if (calc_parallel_lines_overlap(s0.start.x, s0.start.y, s0.end.x, s0.end.y,
-                                                        s1.start.x, s1.start.y, s1.end.x, s1.end.y,
-                                                        aox1, aoy1, aox2, aoy2,
-                                                        box1, boy1, box2, boy2))
-                        {
-                            std::list<pcb::segment> ss0;
-                            std::list<pcb::segment> ss1;
-                            _split_segment(s0, ss0, aox1, aoy1, aox2, aoy2);
-                            _split_segment(s1, ss1, box1, boy1, box2, boy2);
-                            double couple_len = calc_dist(aox1, aoy1, aox2, aoy2);
-                            coupler_segment.emplace(1.0 / couple_len, std::pair<pcb::segment, pcb::segment>(ss0.front(), ss1.front()));
-                            
-                            ss0.pop_front();
-                            ss1.pop_front();
-                            
-                            s_list0.erase(it0);
-                            
-                            s_list0.splice(s_list0.end(), ss0);
-                            s_list1.splice(s_list1.end(), ss1);
-                            s_list1.erase(it1);
-                            
-                            it0 = s_list0.begin();
-                            _brk = true;
-                            break;
-                        }
+                        it0 = s_list0.begin();
+                        _brk = true;
+                        break;
                     }
                 }
-                if (_brk)
-                {
-                    break;
-                }
             }
             if (!_brk)
             {
@@ -952,16 +943,15 @@ bool z_extractor::gen_subckt_coupled_tl(std::uint32_t net_id0, std::uint32_t net
         v_coupler_segment.push_back(ss_item.second);
     }
     
+    std::vector<segment_ckt> v_cpl_ckt(v_coupler_segment.size());
     #pragma omp parallel for
     for (std::uint32_t i = 0; i < v_coupler_segment.size(); i++)
     {
         pcb::segment& s0 = v_coupler_segment[i].first;
         pcb::segment& s1 = v_coupler_segment[i].second;
+        segment_ckt& out = v_cpl_ckt[i];
         
-        std::vector<std::pair<float, float> > v_Z0_td_[2];
-        std::vector<std::pair<float, float> > v_Zodd_td_;
-        std::vector<std::pair<float, float> > v_Zeven_td_;
-        std::string subckt = _gen_segment_coupled_Z0_ckt_openmp(("CPL" + _get_tstamp_short(s0.tstamp)).c_str(), s0, s1, refs_mat, v_Z0_td_, v_Zodd_td_, v_Zeven_td_);
+        out.subckt = _gen_segment_coupled_Z0_ckt_openmp(("CPL" + _get_tstamp_short(s0.tstamp)).c_str(), s0, s1, refs_mat, out.Z0_td, out.Zodd_td, out.Zeven_td);
         
         
         char buf[512] = {0};
@@ -971,24 +961,28 @@ bool z_extractor::gen_subckt_coupled_tl(std::uint32_t net_id0, std::uint32_t net
                         _pos2net(s1.start.x, s1.start.y, s1.layer_name).c_str(),
                         _pos2net(s1.end.x, s1.end.y, s1.layer_name).c_str(),
                         _get_tstamp_short(s0.tstamp).c_str());
-        #pragma omp critical
+        out.call = buf;
+        out.len[0] = _pcb->get_segment_len(s0);
+        out.len[1] = _pcb->get_segment_len(s1);
+    }
+    
+    for (const auto& out: v_cpl_ckt)
+    {
+        sub += out.subckt;
+        ckt += out.call;
+        len[0] += out.len[0];
+        len[1] += out.len[1];
+        
+        v_Z0_td[0].insert(v_Z0_td[0].end(), out.Z0_td[0].begin(), out.Z0_td[0].end());
+        v_Z0_td[1].insert(v_Z0_td[1].end(), out.Z0_td[1].begin(), out.Z0_td[1].end());
+        v_Zodd_td.insert(v_Zodd_td.end(), out.Zodd_td.begin(), out.Zodd_td.end());
+        v_Zeven_td.insert(v_Zeven_td.end(), out.Zeven_td.begin(), out.Zeven_td.end());
+        
+        for (std::uint32_t i = 0; i < sizeof(net_ids) / sizeof(net_ids[0]); i++)
         {
-            sub += subckt;
-            ckt += buf;
-            len[0] += _pcb->get_segment_len(s0);
-            len[1] += _pcb->get_segment_len(s1);
-            
-            v_Z0_td[0].insert(v_Z0_td[0].end(), v_Z0_td_[0].begin(), v_Z0_td_[0].end());
-            v_Z0_td[1].insert(v_Z0_td[1].end(), v_Z0_td_[1].begin(), v_Z0_td_[1].end());
-            v_Zodd_td.insert(v_Zodd_td.end(), v_Zodd_td_.begin(), v_Zodd_td_.end());
-            v_Zeven_td.insert(v_Zeven_td.end(), v_Zeven_td_.begin(), v_Zeven_td_.end());
-            
-            for (std::uint32_t i = 0; i < sizeof(net_ids) / sizeof(net_ids[0]); i++)
+            for (const auto& Z0_td: out.Z0_td[i])
             {
-                for (const auto& Z0_td: v_Z0_td_[i])
-                {
-                    td_sum[i] += Z0_td.second;
-                }
+                td_sum[i] += Z0_td.second;
             }
         }
     }
@@ -1000,30 +994,42 @@ bool z_extractor::gen_subckt_coupled_tl(std::uint32_t net_id0, std::uint32_t net
         std::string ckt_net_name;
         std::vector<pcb::segment> v_list(s_list.begin(), s_list.end());
         
+        std::vector<std::vector<pcb::segment> > runs;
+        _merge_segments(v_list, runs);
+        
+        std::vector<segment_ckt> v_ckt(runs.size());
         #pragma omp parallel for
-        for (std::uint32_t i = 0; i < v_list.size(); i++)
+        for (std::uint32_t i = 0; i < runs.size(); i++)
         {
             char buf[512];
-            pcb::segment& s = v_list[i];
-            std::string tstamp = _get_tstamp_short(s.tstamp);
-            std::string subckt;
-            std::vector<std::pair<float, float> > v_Z0_td_;
+            const pcb::segment& s = runs[i].front();
+            const pcb::segment& e = runs[i].back();
+            segment_ckt& out = v_ckt[i];
             
             std::uint32_t idx = (s.net == net_id0)? 0: 1;
-            subckt = _gen_segment_Z0_ckt_openmp(("ZO" + _get_tstamp_short(s.tstamp)).c_str(), s, refs_mat, v_Z0_td_);
+            out.subckt = _gen_segment_Z0_ckt_openmp(("ZO" + _get_tstamp_short(s.tstamp)).c_str(), runs[i], refs_mat, out.Z0_td[idx], out.models);
             
             sprintf(buf, "X%s %s %s ZO%s\n", _get_tstamp_short(s.tstamp).c_str(),
                                     _pos2net(s.start.x, s.start.y, s.layer_name).c_str(),
-                                    _pos2net(s.end.x, s.end.y, s.layer_name).c_str(),
+                                    _pos2net(e.end.x, e.end.y, e.layer_name).c_str(),
                                     _get_tstamp_short(s.tstamp).c_str());
-                                    
-            #pragma omp critical
+            out.call = buf;
+            for (const auto& seg: runs[i])
             {
-                sub += subckt;
-                ckt += buf;
-                len[idx] += _pcb->get_segment_len(s);
-                v_Z0_td[idx].insert(v_Z0_td[idx].end(), v_Z0_td_.begin(), v_Z0_td_.end());
-                for (const auto& Z0_td: v_Z0_td_)
+                out.len[idx] += _pcb->get_segment_len(seg);
+            }
+        }
+        
+        for (const auto& out: v_ckt)
+        {
+            sub += _emit_models(out.models);
+            sub += out.subckt;
+            ckt += out.call;
+            for (std::uint32_t idx = 0; idx < 2; idx++)
+            {
+                len[idx] += out.len[idx];
+                v_Z0_td[idx].insert(v_Z0_td[idx].end(), out.Z0_td[idx].begin(), out.Z0_td[idx].end());
+                for (const auto& Z0_td: out.Z0_td[idx])
                 {
                     td_sum[idx] += Z0_td.second;
                 }
@@ -1036,24 +1042,18 @@ bool z_extractor::gen_subckt_coupled_tl(std::uint32_t net_id0, std::uint32_t net
     for (std::uint32_t i = 0; i < sizeof(net_ids) / sizeof(net_ids[0]); i++)
     {
         std::list<pcb::via> vias = _pcb->get_vias(net_ids[i]);
-    
-        for (auto& v: vias)
+        std::string via_call;
+        std::vector<float> v_td;
+        sub += _gen_vias_ckt(vias, refs_mat, refs_id, via_call, v_td);
+        for (const auto& td: v_td)
         {
-            std::string via_call;
-            float td = 0;
-            if (_via_tl_mode)
-            {
-                sub += _gen_via_Z0_ckt(v, refs_mat, refs_id, via_call, td);
-            }
-            else
-            {
-                sub += _gen_via_model_ckt(v, refs_mat, via_call, td);
-            }
-            
             td_sum[i] += td;
+        }
+        for (auto& v: vias)
+        {
             len[i] += _pcb->get_via_conn_len(v);
-            ckt += via_call;
         }
+        ckt += via_call;
     }
     
     ckt += ".ends\n";
@@ -1138,46 +1138,351 @@ std::string z_extractor::gen_zone_fasthenry(std::uint32_t net_id, std::set<z_ext
 }
 #endif
 
-void z_extractor::set_calc(std::uint32_t type)
+bool z_extractor::gen_ir_drop(const std::string& footprint, const std::string& pad_number, std::vector<ir_load>& loads,
+                                float grid_size, std::map<std::string, cv::Mat>& j_map)
 {
-    if (type == Z0_calc::Z0_CALC_MMTL)
+    pcb::pad src;
+    if (!_pcb->get_pad(footprint, pad_number, src))
     {
-        std::int32_t thread_nums = omp_get_max_threads();
-        _Z0_calc.clear();
-        for (std::int32_t i = 0; i < thread_nums; i++)
-        {
-            std::shared_ptr<Z0_calc> calc = Z0_calc::create(Z0_calc::Z0_CALC_MMTL);
-            char name[32];
-            sprintf(name, "mmtl_tmp%d", i);
-            calc->set_tmp_name(name);
-            _Z0_calc.push_back(calc);
-        }
+        printf("not found %s.%s\n", footprint.c_str(), pad_number.c_str());
+        return false;
     }
-    else if (type == Z0_calc::Z0_CALC_ATLC)
+    
+    std::uint32_t net_id = src.net;
+    std::list<pcb::pad> pads = _pcb->get_pads(net_id);
+    std::vector<std::list<pcb::segment> > v_segments = _pcb->get_segments_sort(net_id);
+    std::list<pcb::via> vias = _pcb->get_vias(net_id);
+    
+    ir_drop ir;
+    
+    /* 覆铜网格 铜占一半以上的格子作为一个节点 */
+    struct zone_grid
     {
-        std::int32_t thread_nums = omp_get_max_threads();
-        _Z0_calc.clear();
-        for (std::int32_t i = 0; i < thread_nums; i++)
+        std::int32_t cols;
+        std::int32_t rows;
+        /* 格子中铜的比例 和格子对应的节点 没有节点为-1 */
+        std::vector<float> fill;
+        std::vector<std::int32_t> node;
+    };
+    
+    float cell = _cvt_img_len(grid_size);
+    if (cell < 1)
+    {
+        cell = 1;
+    }
+    float img_cols = _get_pcb_img_cols();
+    float img_rows = _get_pcb_img_rows();
+    std::int32_t cols = ceil(img_cols / cell);
+    std::int32_t rows = ceil(img_rows / cell);
+    
+    std::map<std::string, cv::Mat> zone_mat;
+    std::map<std::string, zone_grid> grids;
+    _create_refs_mat({net_id}, zone_mat, false);
+    for (const auto& mat: zone_mat)
+    {
+        const cv::Mat& img = mat.second;
+        zone_grid& g = grids[mat.first];
+        g.cols = cols;
+        g.rows = rows;
+        g.fill.assign((std::size_t)cols * rows, 0);
+        g.node.assign((std::size_t)cols * rows, -1);
+        
+        #pragma omp parallel for
+        for (std::int32_t row = 0; row < rows; row++)
         {
-            std::shared_ptr<Z0_calc> calc = Z0_calc::create(Z0_calc::Z0_CALC_ATLC);
-            char name[32];
-            sprintf(name, "mmtl_tmp%d", i);
-            calc->set_tmp_name(name);
-            _Z0_calc.push_back(calc);
+            std::int32_t y1 = row * cell;
+            std::int32_t y2 = std::min((std::int32_t)((row + 1) * cell), img.rows);
+            for (std::int32_t col = 0; col < cols; col++)
+            {
+                std::int32_t x1 = col * cell;
+                std::int32_t x2 = std::min((std::int32_t)((col + 1) * cell), img.cols);
+                if (x2 <= x1 || y2 <= y1)
+                {
+                    continue;
+                }
+                g.fill[row * cols + col] = cv::countNonZero(img(cv::Rect(x1, y1, x2 - x1, y2 - y1))) / (float)((x2 - x1) * (y2 - y1));
+            }
+        }
+        
+        for (std::int32_t i = 0; i < cols * rows; i++)
+        {
+            if (g.fill[i] >= 0.5)
+            {
+                g.node[i] = ir.add_node();
+            }
+        }
+        
+        /* 相邻格子之间的方块电阻 */
+        double g_sheet = _conductivity * _pcb->get_layer_thickness(mat.first) * 0.001;
+        for (std::int32_t row = 0; row < rows; row++)
+        {
+            for (std::int32_t col = 0; col < cols; col++)
+            {
+                std::int32_t i = row * cols + col;
+                if (g.node[i] < 0)
+                {
+                    continue;
+                }
+                if (col + 1 < cols && g.node[i + 1] >= 0)
+                {
+                    ir.add_conductance(g.node[i], g.node[i + 1], g_sheet * (g.fill[i] + g.fill[i + 1]) * 0.5);
+                }
+                if (row + 1 < rows && g.node[i + cols] >= 0)
+                {
+                    ir.add_conductance(g.node[i], g.node[i + cols], g_sheet * (g.fill[i] + g.fill[i + cols]) * 0.5);
+                }
+            }
         }
     }
-    else if (type == Z0_calc::Z0_CALC_FDM)
+    
+    /* 走线端点 过孔 焊盘的节点 落在覆铜格子上的直接使用格子的节点 */
+    std::map<std::string, std::int32_t> point_nodes;
+    auto get_node = [&](float x, float y, const std::string& layer)
     {
-        std::int32_t thread_nums = omp_get_max_threads();
-        _Z0_calc.clear();
-        for (std::int32_t i = 0; i < thread_nums; i++)
+        std::string name = _pos2net(x, y, layer);
+        auto it = point_nodes.find(name);
+        if (it != point_nodes.end())
         {
-            std::shared_ptr<Z0_calc> calc = Z0_calc::create(Z0_calc::Z0_CALC_FDM);
-            _Z0_calc.push_back(calc);
+            return it->second;
         }
-    }
-}
-
+        
+        std::int32_t node = -1;
+        auto g = grids.find(layer);
+        if (g != grids.end())
+        {
+            std::int32_t col = _cvt_img_x(x) / cell;
+            std::int32_t row = _cvt_img_y(y) / cell;
+            if (col >= 0 && col < cols && row >= 0 && row < rows)
+            {
+                node = g->second.node[row * cols + col];
+            }
+        }
+        if (node < 0)
+        {
+            node = ir.add_node();
+        }
+        point_nodes.emplace(name, node);
+        return node;
+    };
+    
+    /* 孔壁电导 */
+    auto barrel_g = [&](float drill, const std::string& start, const std::string& end)
+    {
+        double ro = drill * 0.5;
+        double ri = std::max(0., ro - _via_plating);
+        double h = _pcb->get_layer_distance(start, end);
+        return _conductivity * M_PI * (ro * ro - ri * ri) * 0.001 / std::max(h, 0.001);
+    };
+    
+    struct seg_branch
+    {
+        const pcb::segment *s;
+        std::int32_t n1;
+        std::int32_t n2;
+        double g;
+    };
+    std::vector<seg_branch> seg_branches;
+    for (const auto& s_list: v_segments)
+    {
+        for (const auto& s: s_list)
+        {
+            seg_branch b;
+            b.s = &s;
+            b.n1 = get_node(s.start.x, s.start.y, s.layer_name);
+            b.n2 = get_node(s.end.x, s.end.y, s.layer_name);
+            float len = std::max(_pcb->get_segment_len(s), _segment_min_len);
+            b.g = _conductivity * s.width * _pcb->get_layer_thickness(s.layer_name) * 0.001 / len;
+            ir.add_conductance(b.n1, b.n2, b.g);
+            seg_branches.push_back(b);
+        }
+    }
+    
+    for (const auto& v: vias)
+    {
+        std::vector<std::string> layers = _pcb->get_via_layers(v);
+        for (std::int32_t i = 0; i < (std::int32_t)layers.size() - 1; i++)
+        {
+            ir.add_conductance(get_node(v.at.x, v.at.y, layers[i]), get_node(v.at.x, v.at.y, layers[i + 1]),
+                                barrel_g(v.drill, layers[i], layers[i + 1]));
+        }
+    }
+    
+    /* 同一个封装里编号相同的焊盘(如多个GND焊盘)各有自己的节点 */
+    std::map<std::string, std::vector<std::int32_t> > pad_nodes;
+    for (const auto& pad: pads)
+    {
+        float x;
+        float y;
+        _pcb->get_pad_pos(pad, x, y);
+        std::vector<std::string> layers = _pcb->get_pad_layers(pad);
+        if (layers.empty())
+        {
+            continue;
+        }
+        
+        for (std::int32_t i = 0; i < (std::int32_t)layers.size() - 1; i++)
+        {
+            float drill = (pad.drill > 0)? pad.drill: std::min(pad.size_w, pad.size_h);
+            ir.add_conductance(get_node(x, y, layers[i]), get_node(x, y, layers[i + 1]),
+                                barrel_g(drill, layers[i], layers[i + 1]));
+        }
+        pad_nodes[pad.footprint + "." + pad.pad_number].push_back(get_node(x, y, layers.front()));
+        
+        if (pad.footprint == src.footprint && pad.pad_number == src.pad_number)
+        {
+            for (const auto& layer: layers)
+            {
+                ir.set_voltage(get_node(x, y, layer), 0);
+            }
+        }
+    }
+    
+    for (auto& load: loads)
+    {
+        auto it = pad_nodes.find(load.footprint + "." + load.pad_number);
+        if (it == pad_nodes.end())
+        {
+            printf("err: %s.%s is not on net %s.\n", load.footprint.c_str(), load.pad_number.c_str(), _pcb->get_net_name(net_id).c_str());
+            return false;
+        }
+        for (auto node: it->second)
+        {
+            ir.add_current(node, -load.current / it->second.size());
+        }
+    }
+    
+    std::vector<double> v;
+    bool converged = ir.solve(v);
+    log_info("ir drop: nodes:%d iterations:%d\n", ir.nodes(), ir.get_iter());
+    if (!converged)
+    {
+        printf("err: ir drop not converged after %d iterations.\n", ir.get_iter());
+        return false;
+    }
+    
+    /* 没有铜连接到电源的负载电压为0 不能当作没有压降 */
+    for (auto& load: loads)
+    {
+        load.drop = 0;
+        for (auto node: pad_nodes[load.footprint + "." + load.pad_number])
+        {
+            if (!ir.is_connected(node))
+            {
+                printf("err: %s.%s no connection.\n", load.footprint.c_str(), load.pad_number.c_str());
+                return false;
+            }
+            load.drop = std::max(load.drop, (float)-v[node]);
+        }
+    }
+    
+    /* 电流密度 格子的电流取两侧边上电流的平均 */
+    j_map.clear();
+    for (const auto& grid: grids)
+    {
+        const zone_grid& g = grid.second;
+        double g_sheet = _conductivity * _pcb->get_layer_thickness(grid.first) * 0.001;
+        float area = grid_size * _pcb->get_layer_thickness(grid.first);
+        cv::Mat j(rows, cols, CV_32FC1, cv::Scalar(0));
+        
+        auto edge_current = [&](std::int32_t i1, std::int32_t i2)
+        {
+            if (g.node[i1] < 0 || g.node[i2] < 0)
+            {
+                return 0.;
+            }
+            return g_sheet * (g.fill[i1] + g.fill[i2]) * 0.5 * (v[g.node[i1]] - v[g.node[i2]]);
+        };
+        
+        #pragma omp parallel for
+        for (std::int32_t row = 0; row < rows; row++)
+        {
+            for (std::int32_t col = 0; col < cols; col++)
+            {
+                std::int32_t i = row * cols + col;
+                if (g.node[i] < 0)
+                {
+                    continue;
+                }
+                double ix = ((col > 0)? edge_current(i - 1, i): 0) + ((col + 1 < cols)? edge_current(i, i + 1): 0);
+                double iy = ((row > 0)? edge_current(i - cols, i): 0) + ((row + 1 < rows)? edge_current(i, i + cols): 0);
+                j.at<float>(row, col) = sqrt(ix * ix + iy * iy) * 0.5 / area;
+            }
+        }
+        j_map.emplace(grid.first, j);
+    }
+    
+    /* 走线的电流密度画到对应层上 */
+    for (const auto& b: seg_branches)
+    {
+        const pcb::segment& s = *b.s;
+        if (j_map.count(s.layer_name) == 0)
+        {
+            j_map.emplace(s.layer_name, cv::Mat(rows, cols, CV_32FC1, cv::Scalar(0)));
+        }
+        float j = fabs(b.g * (v[b.n1] - v[b.n2])) / (s.width * _pcb->get_layer_thickness(s.layer_name));
+        cv::Point p1(_cvt_img_x(s.start.x) / cell, _cvt_img_y(s.start.y) / cell);
+        cv::Point p2(_cvt_img_x(s.end.x) / cell, _cvt_img_y(s.end.y) / cell);
+        std::int32_t thickness = std::max(1, (std::int32_t)(s.width / grid_size));
+        
+        /* 只在走线的外接矩形里画 不为每条走线分配整板大小的图 */
+        std::int32_t margin = thickness / 2 + 2;
+        std::int32_t x1 = std::max(std::min(p1.x, p2.x) - margin, 0);
+        std::int32_t y1 = std::max(std::min(p1.y, p2.y) - margin, 0);
+        std::int32_t x2 = std::min(std::max(p1.x, p2.x) + margin + 1, cols);
+        std::int32_t y2 = std::min(std::max(p1.y, p2.y) + margin + 1, rows);
+        if (x2 <= x1 || y2 <= y1)
+        {
+            continue;
+        }
+        cv::Rect roi(x1, y1, x2 - x1, y2 - y1);
+        cv::Mat line(roi.height, roi.width, CV_32FC1, cv::Scalar(0));
+        cv::line(line, cv::Point(p1.x - x1, p1.y - y1), cv::Point(p2.x - x1, p2.y - y1), cv::Scalar(j), thickness, cv::LINE_4);
+        cv::Mat dst = j_map[s.layer_name](roi);
+        cv::max(dst, line, dst);
+    }
+    return true;
+}
+
+
+void z_extractor::set_calc(std::uint32_t type)
+{
+    if (type == Z0_calc::Z0_CALC_MMTL)
+    {
+        std::int32_t thread_nums = omp_get_max_threads();
+        _Z0_calc.clear();
+        for (std::int32_t i = 0; i < thread_nums; i++)
+        {
+            std::shared_ptr<Z0_calc> calc = Z0_calc::create(Z0_calc::Z0_CALC_MMTL);
+            char name[32];
+            sprintf(name, "mmtl_tmp%d", i);
+            calc->set_tmp_name(name);
+            _Z0_calc.push_back(calc);
+        }
+    }
+    else if (type == Z0_calc::Z0_CALC_ATLC)
+    {
+        std::int32_t thread_nums = omp_get_max_threads();
+        _Z0_calc.clear();
+        for (std::int32_t i = 0; i < thread_nums; i++)
+        {
+            std::shared_ptr<Z0_calc> calc = Z0_calc::create(Z0_calc::Z0_CALC_ATLC);
+            calc->set_convergence(_fdm_rel_tol, _fdm_max_iter);
+            _Z0_calc.push_back(calc);
+        }
+    }
+    else if (type == Z0_calc::Z0_CALC_FDM)
+    {
+        std::int32_t thread_nums = omp_get_max_threads();
+        _Z0_calc.clear();
+        for (std::int32_t i = 0; i < thread_nums; i++)
+        {
+            std::shared_ptr<Z0_calc> calc = Z0_calc::create(Z0_calc::Z0_CALC_FDM);
+            calc->set_convergence(_fdm_rel_tol, _fdm_max_iter);
+            _Z0_calc.push_back(calc);
+        }
+    }
+}
+
 
 
 std::string z_extractor::_get_tstamp_short(const std::string& tstamp)
@@ -1190,6 +1495,32 @@ std::string z_extractor::_get_tstamp_short(const std::string& tstamp)
     return tstamp;
 }
 
+std::string z_extractor::_get_model_name(const char *prefix, const std::string& params)
+{
+    /* FNV-1a */
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (auto c: params)
+    {
+        hash = (hash ^ (std::uint8_t)c) * 1099511628211ULL;
+    }
+    char buf[64] = {0};
+    sprintf(buf, "%s%016llx", prefix, (unsigned long long)hash);
+    return buf;
+}
+
+std::string z_extractor::_emit_models(const std::vector<std::string>& models)
+{
+    std::string str;
+    for (const auto& model: models)
+    {
+        if (_tl_models.insert(model).second)
+        {
+            str += model;
+        }
+    }
+    return str;
+}
+
 
 std::string z_extractor::_format_net(const std::string& name)
 {
@@ -1236,25 +1567,13 @@ std::string z_extractor::_gen_pad_net_name(const std::string& footprint, const s
 }
 
 
-void z_extractor::_get_zone_cond(std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, std::map<std::string, std::list<cond> >& conds, float& grid_size)
+void z_extractor::_get_zone_cond(std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, const std::map<std::string, std::vector<pcb::point> >& refine_pts,
+                                    std::map<std::string, std::list<cond> >& conds, float& grid_size)
 {
     std::uint32_t area = 0;
-
     for (const auto& mat: zone_mat)
     {
-        const cv::Mat& img = mat.second;
-        for(std::int32_t y = 0;y < img.rows; y++)
-        {
-            for(std::int32_t x = 0; x < img.cols; x++)
-            {
-                if (img.at<std::uint8_t>(y, x) > 0)
-                {
-                    area++;
-
-
-                }
-            }
-        }
+        area += cv::countNonZero(mat.second);
     }
     
     
@@ -1267,8 +1586,30 @@ void z_extractor::_get_zone_cond(std::uint32_t net_id, const std::map<std::strin
         img_grid_size = _cvt_img_len(grid_size);
     }
     
-    std::uint32_t w_n = _get_pcb_img_cols() / img_grid_size;
-    std::uint32_t h_n = _get_pcb_img_rows() / img_grid_size;
+    float img_cols = _get_pcb_img_cols();
+    float img_rows = _get_pcb_img_rows();
+    std::int32_t w_n = img_cols / img_grid_size;
+    std::int32_t h_n = img_rows / img_grid_size;
+    if (w_n <= 0 || h_n <= 0)
+    {
+        return;
+    }
+    
+    /* 基本网格线在图像中的坐标 */
+    std::vector<std::int32_t> xs(w_n + 1);
+    std::vector<std::int32_t> ys(h_n + 1);
+    for (std::int32_t x = 0; x <= w_n; x++)
+    {
+        xs[x] = x * img_cols / w_n;
+    }
+    for (std::int32_t y = 0; y <= h_n; y++)
+    {
+        ys[y] = y * img_rows / h_n;
+    }
+    
+    std::int32_t max_level = std::max(0, _zone_mesh_level);
+    std::int32_t block = 1 << max_level;
+    std::int32_t stride = w_n + 1;
     
     for (const auto& mat: zone_mat)
     {
@@ -1281,80 +1622,362 @@ void z_extractor::_get_zone_cond(std::uint32_t net_id, const std::map<std::strin
         
         std::list<cond>& cond_list = conds[mat.first];
         
-        for (std::uint32_t y = 0; y < h_n; y++)
+        static const std::vector<pcb::point> no_pts;
+        const std::vector<pcb::point>& pts = refine_pts.count(mat.first)? refine_pts.find(mat.first)->second: no_pts;
+        
+        /* 每个基本格子中铜的像素数的积分 sum[y * stride + x]为左上角(x, y)个格子的总和 */
+        std::vector<std::int32_t> sum((std::size_t)stride * (h_n + 1), 0);
+        for (std::int32_t y = 0; y < h_n; y++)
         {
-            for (std::uint32_t x = 0; x < w_n; x++)
+            std::int32_t row_sum = 0;
+            for (std::int32_t x = 0; x < w_n; x++)
             {
-                std::uint32_t x1 = x * _get_pcb_img_cols() / w_n;
-                std::uint32_t y1 = y * _get_pcb_img_rows() / h_n;
-                std::uint32_t x2 = (x + 1) * _get_pcb_img_cols() / w_n;
-                std::uint32_t y2 = (y + 1) * _get_pcb_img_rows() / h_n;
-                
-                cv::Rect r(x1, y1, x2 - x1, y2 - y1);
-                cv::Mat roi = img(r);
-                
-                std::uint32_t count = 0;
-                for(std::int32_t i = 0;i < roi.rows; i++)
+                cv::Rect r(xs[x], ys[y], xs[x + 1] - xs[x], ys[y + 1] - ys[y]);
+                row_sum += cv::countNonZero(img(r));
+                sum[(y + 1) * stride + x + 1] = sum[y * stride + x + 1] + row_sum;
+            }
+        }
+        
+        auto block_count = [&](std::int32_t x1, std::int32_t y1, std::int32_t x2, std::int32_t y2)
+        {
+            return sum[y2 * stride + x2] - sum[y1 * stride + x2] - sum[y2 * stride + x1] + sum[y1 * stride + x1];
+        };
+        
+        /* 大格子四周还要有一圈铜 并且离连接点的距离不小于格子的边长
+         * 这样格子从边缘和连接点往外逐级变大 电流集中的地方保持细网格
+         */
+        auto need_refine = [&](std::int32_t x, std::int32_t y, std::int32_t n)
+        {
+            if (!_zone_refine)
+            {
+                return false;
+            }
+            if (x == 0 || y == 0 || x + n + 1 > w_n || y + n + 1 > h_n)
+            {
+                return true;
+            }
+            std::int32_t pixels = (xs[x + n + 1] - xs[x - 1]) * (ys[y + n + 1] - ys[y - 1]);
+            if (block_count(x - 1, y - 1, x + n + 1, y + n + 1) != pixels)
+            {
+                return true;
+            }
+            
+            float left = _cvt_pcb_x(xs[x]);
+            float right = _cvt_pcb_x(xs[x + n]);
+            float top = _cvt_pcb_y(ys[y]);
+            float bottom = _cvt_pcb_y(ys[y + n]);
+            float size = std::max(right - left, bottom - top);
+            for (const auto& p: pts)
+            {
+                float dx = std::max(0.f, std::max(left - p.x, p.x - right));
+                float dy = std::max(0.f, std::max(top - p.y, p.y - bottom));
+                if (dx * dx + dy * dy < size * size)
                 {
-                    for(std::int32_t j = 0; j < roi.cols; j++)
-                    {
-                        if (roi.at<std::uint8_t>(i, j) > 0)
-                        {
-                            count++;
-                        }
-                    }
+                    return true;
                 }
-                
-                if (count >= (std::uint32_t)roi.rows * roi.cols * 0.7)
+            }
+            return false;
+        };
+        
+        /* 四叉树 全部是铜的区域合并成大格子 否则往下细分 最小的格子跟均匀网格一样按70%判断 */
+        struct leaf
+        {
+            std::int32_t x;
+            std::int32_t y;
+            std::int32_t level;
+        };
+        std::vector<leaf> leaves;
+        std::vector<leaf> stack;
+        for (std::int32_t y = 0; y < h_n; y += block)
+        {
+            for (std::int32_t x = 0; x < w_n; x += block)
+            {
+                stack.push_back(leaf{x, y, max_level});
+            }
+        }
+        
+        while (!stack.empty())
+        {
+            leaf l = stack.back();
+            stack.pop_back();
+            if (l.x >= w_n || l.y >= h_n)
+            {
+                continue;
+            }
+            
+            std::int32_t n = 1 << l.level;
+            std::int32_t x2 = std::min(l.x + n, w_n);
+            std::int32_t y2 = std::min(l.y + n, h_n);
+            std::int32_t count = block_count(l.x, l.y, x2, y2);
+            std::int32_t pixels = (xs[x2] - xs[l.x]) * (ys[y2] - ys[l.y]);
+            
+            if (l.level == 0)
+            {
+                if (count >= pixels * 0.7)
                 {
-                    //cv::line(img2, cv::Point(x1, y1), cv::Point(x2, y2), cv::Scalar(255, 255, 255));
-                    float w_ratio = 1;
-                    pcb::point p;
-                    cond c;
-                    c.start.x = _cvt_pcb_x(x1);
-                    c.start.y = _cvt_pcb_y(y1);
-                    c.end.x = _cvt_pcb_x(x2);
-                    c.end.y = _cvt_pcb_y(y1);
-                    //c.w = _cvt_pcb_len(y2 - y1) * w_ratio;
-                    c.w = grid_size * w_ratio;
-                    cond_list.push_back(c);
-                    
-                    c.start.x = _cvt_pcb_x(x1);
-                    c.start.y = _cvt_pcb_y(y1);
-                    c.end.x = _cvt_pcb_x(x1);
-                    c.end.y = _cvt_pcb_y(y2);
-                    //c.w = _cvt_pcb_len(x2 - x1) * w_ratio;
-                    c.w = grid_size * w_ratio;
-                    cond_list.push_back(c);
-                    
-                #if 0
-                    c.start.x = _cvt_pcb_x(x2);
-                    c.start.y = _cvt_pcb_y(y1);
-                    c.end.x = _cvt_pcb_x(x2);
-                    c.end.y = _cvt_pcb_y(y2);
-                    //c.w = _cvt_pcb_len(x2 - x1) * w_ratio;
-                    c.w = grid_size * w_ratio;
+                    leaves.push_back(l);
+                }
+            }
+            else if (x2 == l.x + n && y2 == l.y + n && count == pixels && !need_refine(l.x, l.y, n))
+            {
+                leaves.push_back(l);
+            }
+            else
+            {
+                n >>= 1;
+                stack.push_back(leaf{l.x + n, l.y + n, l.level - 1});
+                stack.push_back(leaf{l.x, l.y + n, l.level - 1});
+                stack.push_back(leaf{l.x + n, l.y, l.level - 1});
+                stack.push_back(leaf{l.x, l.y, l.level - 1});
+            }
+        }
+        
+        std::sort(leaves.begin(), leaves.end(), [](const leaf& a, const leaf& b)
+            {
+                return (a.y != b.y)? a.y < b.y: a.x < b.x;
+            });
+        
+        /* 大格子的边在相邻小格子的角点处断开 使网格节点相连 */
+        std::vector<std::uint8_t> corner((std::size_t)stride * (h_n + 1), 0);
+        for (const auto& l: leaves)
+        {
+            std::int32_t n = 1 << l.level;
+            corner[l.y * stride + l.x] = 1;
+            corner[l.y * stride + l.x + n] = 1;
+            corner[(l.y + n) * stride + l.x] = 1;
+            corner[(l.y + n) * stride + l.x + n] = 1;
+        }
+        
+        for (const auto& l: leaves)
+        {
+            std::int32_t n = 1 << l.level;
+            cond c;
+            c.w = grid_size * n;
+            
+            /* 上边 */
+            std::int32_t x1 = l.x;
+            for (std::int32_t x = l.x + 1; x <= l.x + n; x++)
+            {
+                if (corner[l.y * stride + x])
+                {
+                    c.start.x = _cvt_pcb_x(xs[x1]);
+                    c.start.y = _cvt_pcb_y(ys[l.y]);
+                    c.end.x = _cvt_pcb_x(xs[x]);
+                    c.end.y = _cvt_pcb_y(ys[l.y]);
                     cond_list.push_back(c);
-                    
-                    c.start.x = _cvt_pcb_x(x1);
-                    c.start.y = _cvt_pcb_y(y2);
-                    c.end.x = _cvt_pcb_x(x2);
-                    c.end.y = _cvt_pcb_y(y2);
-                    //c.w = _cvt_pcb_len(y2 - y1) * w_ratio;
-                    c.w = grid_size * w_ratio;
+                    x1 = x;
+                }
+            }
+            
+            /* 左边 */
+            std::int32_t y1 = l.y;
+            for (std::int32_t y = l.y + 1; y <= l.y + n; y++)
+            {
+                if (corner[y * stride + l.x])
+                {
+                    c.start.x = _cvt_pcb_x(xs[l.x]);
+                    c.start.y = _cvt_pcb_y(ys[y1]);
+                    c.end.x = _cvt_pcb_x(xs[l.x]);
+                    c.end.y = _cvt_pcb_y(ys[y]);
                     cond_list.push_back(c);
-                #endif
+                    y1 = y;
+                }
+            }
+        }
+        log_debug("zone %s cells:%u conds:%u\n", mat.first.c_str(), (std::uint32_t)leaves.size(), (std::uint32_t)cond_list.size());
+    }
+}
+
+
+
+bool z_extractor::_build_rl_model(fasthenry& henry, std::uint32_t net_id)
+{
+    if (_pcb->check_segments(net_id) == false)
+    {
+        return false;
+    }
+    
+    std::list<pcb::pad> pads = _pcb->get_pads(net_id);
+    std::vector<std::list<pcb::segment> > v_segments = _pcb->get_segments_sort(net_id);
+    std::list<pcb::via> vias = _pcb->get_vias(net_id);
+    
+    if (_rl_fmax > _freq)
+    {
+        henry.set_freq_sweep(_freq, _rl_fmax, _rl_ndec);
+    }
+    else
+    {
+        henry.set_freq(_freq);
+    }
+    henry.set_conductivity(_conductivity);
+    std::map<std::string, cv::Mat> zone_mat;
+    std::map<std::string, std::list<cond> > conds;
+    bool have_zones = !_pcb->get_zones(net_id).empty();
+    float grid_size = 1;
+    if (have_zones)
+    {
+        /* 走线 过孔 焊盘跟覆铜的连接点附近电流集中 网格需要加密 */
+        std::map<std::string, std::vector<pcb::point> > refine_pts;
+        if (_zone_refine)
+        {
+            for (const auto& s_list: v_segments)
+            {
+                for (const auto& s: s_list)
+                {
+                    refine_pts[s.layer_name].push_back(s.start);
+                    refine_pts[s.layer_name].push_back(s.end);
                 }
             }
+            for (const auto& v: vias)
+            {
+                for (const auto& layer: _pcb->get_via_layers(v))
+                {
+                    refine_pts[layer].push_back(v.at);
+                }
+            }
+            for (const auto& pad: pads)
+            {
+                float x;
+                float y;
+                _pcb->get_pad_pos(pad, x, y);
+                for (const auto& layer: _pcb->get_pad_layers(pad))
+                {
+                    refine_pts[layer].push_back(pcb::point(x, y));
+                }
+            }
+        }
+        
+        _create_refs_mat({net_id}, zone_mat, false);
+        _add_zone(henry, net_id, zone_mat, refine_pts, conds, grid_size);
+    }
+    
+    for (auto& s_list: v_segments)
+    {
+        float z_val = _pcb->get_layer_z_axis(s_list.front().layer_name);
+        float h_val = _pcb->get_layer_thickness(s_list.front().layer_name);
+        
+        for (auto& s: s_list)
+        { 
+            henry.add_wire(_pos2net(s.start.x, s.start.y, s.layer_name), _pos2net(s.end.x, s.end.y, s.layer_name),
+                                _get_tstamp_short(s.tstamp),
+                                fasthenry::point(s.start.x, s.start.y, z_val),
+                                fasthenry::point(s.end.x, s.end.y, z_val), s.width, h_val);
+            if (have_zones)
+            {
+                _conn_to_zone(henry, s.start.x, s.start.y, zone_mat, s.layer_name, conds, grid_size);
+                _conn_to_zone(henry, s.end.x, s.end.y, zone_mat, s.layer_name, conds, grid_size);
+            }
+        }
+    }
+    
+    for (auto& v: vias)
+    {
+        std::vector<std::string> layers = _pcb->get_via_layers(v);
+        for (std::int32_t i = 0; i < (std::int32_t)layers.size() - 1; i++)
+        {
+            const std::string& start = layers[i];
+            const std::string& end = layers[i + 1];
+            
+            float z1 = _pcb->get_layer_z_axis(start);
+            float z2 = _pcb->get_layer_z_axis(end);
+            
+            henry.add_via(_pos2net(v.at.x, v.at.y, start), _pos2net(v.at.x, v.at.y, end),
+                                _format_net(_get_tstamp_short(v.tstamp) + start + end).c_str(),
+                                fasthenry::point(v.at.x, v.at.y, z1),
+                                fasthenry::point(v.at.x, v.at.y, z2), v.drill, v.size);
+            if (have_zones)
+            {
+                _conn_to_zone(henry, v.at.x, v.at.y, zone_mat, start, conds, grid_size);
+                _conn_to_zone(henry, v.at.x, v.at.y, zone_mat, end, conds, grid_size);
+            }
         }
     }
+
+    for (const auto& pad: pads)
+    {
+        float x;
+        float y;
+        _pcb->get_pad_pos(pad, x, y);
+        
+        std::vector<std::string> layers = _pcb->get_pad_layers(pad);
+        
+        if (layers.size() == 1)
+        {
+            const std::string& layer = layers.front();
+            float z = _pcb->get_layer_z_axis(layer);
+            henry.add_node(_pos2net(x, y, layer), fasthenry::point(x, y, z));
+                                
+            if (have_zones)
+            {
+                _conn_to_zone(henry, x, y, zone_mat, layer, conds, grid_size);
+            }
+        }
+        
+        for (std::uint32_t i = 1; i < layers.size(); i++)
+        {
+            const std::string& start = layers[i - 1];
+            const std::string& end = layers[i];
+            float z1 = _pcb->get_layer_z_axis(start);
+            float z2 = _pcb->get_layer_z_axis(end);
+            
+            henry.add_via(_pos2net(x, y, start), _pos2net(x, y, end),
+                                _format_net(_get_tstamp_short(pad.tstamp) + start + end).c_str(),
+                                fasthenry::point(x, y, z1),
+                                fasthenry::point(x, y, z2), 1, 1);
+            
+            if (have_zones)
+            {
+                _conn_to_zone(henry, x, y, zone_mat, start, conds, grid_size);
+                _conn_to_zone(henry, x, y, zone_mat, end, conds, grid_size);
+            }
+        }
+    }
+    
+    return true;
 }
 
 
+void z_extractor::_gen_rl_ckt(std::uint32_t net_id, const rl_port& port, double r, double l, const std::vector<double>& rk, const std::vector<double>& lk,
+                                std::string& ckt, std::string& call)
+{
+    char buf[512];
+    std::string comment;
+    std::string subckt_name = _format_net_name(_pcb->get_net_name(net_id) + "_" +
+                            port.footprint1 + "_" + port.footprint1_pad_number + "-" + 
+                            port.footprint2 + "_" + port.footprint2_pad_number) + " ";
+    
+    std::string ckt_pin1 = port.footprint1 + "_" + port.footprint1_pad_number;
+    std::string ckt_pin2 = port.footprint2 + "_" + port.footprint2_pad_number;
+    ckt = ".subckt " + subckt_name + " " + ckt_pin1 + " " + ckt_pin2 + "\n";
+    call = "X" + subckt_name + " " + ckt_pin1 + " " + ckt_pin2 + " " + subckt_name + "\n";
+    
+    comment = "****" + port.footprint1 + "." + port.footprint1_pad_number + "    " + port.footprint2 + "." + port.footprint2_pad_number +  "*****\n";
+    ckt = comment + ckt;
+    sprintf(buf, "R1 %s mid %lg\n", ckt_pin1.c_str(), r);
+    ckt += buf;
+    
+    /* 梯形网络 每一节为电阻电感并联 */
+    std::string node = "mid";
+    for (std::uint32_t i = 0; i < rk.size(); i++)
+    {
+        sprintf(buf, "n%u", i + 1);
+        std::string next = buf;
+        sprintf(buf, "R%u %s %s %lg\n", i + 2, node.c_str(), next.c_str(), rk[i]);
+        ckt += buf;
+        sprintf(buf, "L%u %s %s %lg\n", i + 2, node.c_str(), next.c_str(), lk[i]);
+        ckt += buf;
+        node = next;
+    }
+    sprintf(buf, "L1 %s %s %lg\n", node.c_str(), ckt_pin2.c_str(), l);
+    ckt += buf;
+    ckt += ".ends\n";
+}
+
 
-void z_extractor::_add_zone(fasthenry& henry, std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, std::map<std::string, std::list<cond> >& conds, float& grid_size)
+void z_extractor::_add_zone(fasthenry& henry, std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, const std::map<std::string, std::vector<pcb::point> >& refine_pts,
+                                std::map<std::string, std::list<cond> >& conds, float& grid_size)
 {
-    _get_zone_cond(net_id, zone_mat, conds, grid_size);
+    _get_zone_cond(net_id, zone_mat, refine_pts, conds, grid_size);
     
     for (const auto& cond: conds)
     {
@@ -1628,37 +2251,77 @@ float z_extractor::_get_via_anti_pad_diameter(const pcb::via& v,  const std::map
     }
     const cv::Mat& img = refs_mat.find(layer)->second;
     
-    float y = v.at.y - diameter * 0.5;
-    float y_end = v.at.y + diameter * 0.5;
-    while (y < y_end)
+    float dist = _get_nearest_copper_dist(img, v.at.x, v.at.y, diameter * 0.5);
+    if (dist * 2 < diameter)
+    {
+        diameter = dist * 2;
+    }
+    if (diameter <= v.size)
     {
+        diameter = v.size * 2;
+    }
+    return diameter;
+}
+
+
+float z_extractor::_get_nearest_copper_dist(const cv::Mat& img, float x, float y, float max_dist)
+{
+    /* 图像坐标 像素(col, row)覆盖[col - 0.5, col + 0.5) x [row - 0.5, row + 0.5) */
+    float fx = (x - _pcb->get_edge_left()) * _img_ratio;
+    float fy = (y - _pcb->get_edge_top()) * _img_ratio;
+    std::int32_t cx = _cvt_img_x(x);
+    std::int32_t cy = _cvt_img_y(y);
+    std::int32_t max_r = ceil(max_dist * _img_ratio) + 1;
+    
+    float min_d2 = FLT_MAX;
+    auto check = [&](std::int32_t col, std::int32_t row)
+    {
+        /* 图像以外当作铜 */
+        if (row >= 0 && row < img.rows && col >= 0 && col < img.cols
+            && img.at<std::uint8_t>(row, col) == 0)
+        {
+            return;
+        }
+        float dx = std::max(0.f, fabsf(col - fx) - 0.5f);
+        float dy = std::max(0.f, fabsf(row - fy) - 0.5f);
+        float d2 = dx * dx + dy * dy;
+        if (d2 < min_d2)
+        {
+            min_d2 = d2;
+        }
+    };
+    
+    /* 从中心往外一圈一圈查找 第k圈上的像素离中心至少k - 1个像素 */
+    for (std::int32_t k = 0; k <= max_r; k++)
+    {
+        if (k > 0 && (float)(k - 1) * (k - 1) >= min_d2)
+        {
+            break;
+        }
         
-        float x = v.at.x - diameter * 0.5;
-        float x_end = v.at.x + diameter * 0.5;
+        if (k == 0)
+        {
+            check(cx, cy);
+            continue;
+        }
         
-        while (x < x_end)
+        for (std::int32_t col = cx - k; col <= cx + k; col++)
         {
-            std::int32_t img_y = _cvt_img_y(y);
-            std::int32_t img_x = _cvt_img_x(x);
-            if (!(img_y >= 0 && img_y < img.rows
-                    && img_x >= 0 && img_x < img.cols)
-                || img.at<std::uint8_t>(_cvt_img_y(y), _cvt_img_x(x)) > 0)
-            {
-                float dist = calc_dist(x, y, v.at.x, v.at.y);
-                if (dist * 2 < diameter)
-                {
-                    diameter = dist * 2;
-                }
-            }
-            x += 0.01;
+            check(col, cy - k);
+            check(col, cy + k);
+        }
+        for (std::int32_t row = cy - k + 1; row <= cy + k - 1; row++)
+        {
+            check(cx - k, row);
+            check(cx + k, row);
         }
-        y += 0.01;
     }
-    if (diameter <= v.size)
+    
+    if (min_d2 == FLT_MAX)
     {
-        diameter = v.size * 2;
+        return max_dist;
     }
-    return diameter;
+    return std::min(max_dist, sqrtf(min_d2) / _img_ratio);
 }
 
 
@@ -1679,55 +2342,250 @@ float z_extractor::_calc_segment_l(const pcb::segment& s)
 }
 
 
-float z_extractor::_calc_via_l(const pcb::via& v, const std::string& layer_name1, const std::string& layer_name2)
+float z_extractor::_calc_via_l(const pcb::via& v, const std::string& layer_name1, const std::string& layer_name2)
+{
+    float h = _pcb->get_layer_distance(layer_name1, layer_name2);
+    return h / 5 * (1 + log(4.0 * h / v.drill));
+}
+
+
+void z_extractor::_calc_wideband_rlgc(const std::string& layer_name, float w, float c, float v, float& ro, float& rs, float& gd)
+{
+    const double MUE0 = 4 * M_PI * 1e-7;
+    const double C0 = 299792458.;
+    double w_m = w * 0.001;
+    double t_m = _pcb->get_layer_thickness(layer_name) * 0.001;
+    
+    /* 直流电阻 */
+    ro = 1.0 / (_conductivity * w_m * t_m);
+    
+    /* 趋肤效应 电流集中在导体表面 表面电阻 Rsurf = sqrt(pi * f * u0 / sigma) */
+    rs = sqrt(M_PI * MUE0 / _conductivity) / (2 * (w_m + t_m));
+    
+    /* 粗糙度 Hammerstad模型 K = 1 + 2 / pi * atan(1.4 * (roughness / delta)^2) 取_freq处的值 */
+    if (_roughness > 0 && _freq > 0)
+    {
+        double delta = 1.0 / sqrt(M_PI * _freq * MUE0 * _conductivity);
+        double k = _roughness * 0.001 / delta;
+        rs *= 1 + 2 / M_PI * atan(1.4 * k * k);
+    }
+    
+    /* 介质损耗 G = 2 * pi * f * C * tand_eff 按填充系数折算有效损耗角正切 */
+    float er = 1;
+    float tand = 0;
+    _pcb->get_cu_layer_substrate(layer_name, er, tand);
+    double er_eff = (C0 / v) * (C0 / v);
+    double tand_eff = tand;
+    if (er > 1.0001 && er_eff < er)
+    {
+        tand_eff = tand * er * (er_eff - 1) / (er_eff * (er - 1));
+        tand_eff = std::max(0., std::min(tand_eff, (double)tand));
+    }
+    gd = 2 * M_PI * c * 1e-12 * tand_eff;
+}
+
+
+bool z_extractor::_is_coupled(const pcb::segment& s1, const pcb::segment& s2, float coupled_max_gap, float coupled_min_len)
+{
+    if (s1.is_arc() != s2.is_arc())
+    {
+        return false;
+    }
+    
+    /* 圆弧只和同心的圆弧耦合 */
+    if (s1.is_arc())
+    {
+        double cx1;
+        double cy1;
+        double r1;
+        double cx2;
+        double cy2;
+        double r2;
+        calc_arc_center_radius(s1.start.x, s1.start.y, s1.mid.x, s1.mid.y, s1.end.x, s1.end.y, cx1, cy1, r1);
+        calc_arc_center_radius(s2.start.x, s2.start.y, s2.mid.x, s2.mid.y, s2.end.x, s2.end.y, cx2, cy2, r2);
+        if (calc_dist(cx1, cy1, cx2, cy2) > _arc_center_epsilon)
+        {
+            return false;
+        }
+        
+        float gap = fabs(r1 - r2) - s1.width * 0.5 - s2.width * 0.5;
+        if (gap > coupled_max_gap)
+        {
+            return false;
+        }
+        
+        float ovlen = calc_concentric_arcs_overlap_len(s1.start.x, s1.start.y, s1.mid.x, s1.mid.y, s1.end.x, s1.end.y,
+                                                        s2.start.x, s2.start.y, s2.mid.x, s2.mid.y, s2.end.x, s2.end.y);
+        return ovlen >= coupled_min_len;
+    }
+    
+    float a1 = calc_angle(s1.start.x, s1.start.y, s1.end.x, s1.end.y);
+    float a2 = calc_angle(s2.start.x, s2.start.y, s2.end.x, s2.end.y);
+    float a22 = calc_angle(s2.end.x, s2.end.y, s2.start.x, s2.start.y);
+    if (fabs(a1 - a2) > _float_epsilon && fabs(a1 - a22) > _float_epsilon)
+    {
+        return false;
+    }
+    float dist = calc_p2line_dist(s1.start.x, s1.start.y, s1.end.x, s1.end.y, s2.start.x, s2.start.y);
+    float gap = dist - s1.width * 0.5 - s2.width * 0.5;
+    if (gap > coupled_max_gap)
+    {
+        return false;
+    }
+    
+    float ovlen = calc_parallel_lines_overlap_len(s1.start.x, s1.start.y, s1.end.x, s1.end.y,
+                                        s2.start.x, s2.start.y, s2.end.x, s2.end.y);
+    if (ovlen < coupled_min_len)
+    {
+        return false;
+    }
+    return true;
+}
+
+
+
+bool z_extractor::_get_coupled_overlap(const pcb::segment& s0, const pcb::segment& s1,
+                                        double& aox1, double& aoy1, double& aox2, double& aoy2,
+                                        double& box1, double& boy1, double& box2, double& boy2)
+{
+    if (s0.is_arc())
+    {
+        return calc_concentric_arcs_overlap(s0.start.x, s0.start.y, s0.mid.x, s0.mid.y, s0.end.x, s0.end.y,
+                                            s1.start.x, s1.start.y, s1.mid.x, s1.mid.y, s1.end.x, s1.end.y,
+                                            aox1, aoy1, aox2, aoy2,
+                                            box1, boy1, box2, boy2);
+    }
+    return calc_parallel_lines_overlap(s0.start.x, s0.start.y, s0.end.x, s0.end.y,
+                                        s1.start.x, s1.start.y, s1.end.x, s1.end.y,
+                                        aox1, aoy1, aox2, aoy2,
+                                        box1, boy1, box2, boy2);
+}
+
+
+void z_extractor::_get_coupled_candidates(const pcb::segment& s0, std::vector<std::list<pcb::segment> >& v_segments1,
+                                            std::vector<std::pair<std::list<pcb::segment> *, std::list<pcb::segment>::iterator> >& cands)
+{
+    std::vector<std::pair<std::list<pcb::segment> *, std::list<pcb::segment>::iterator> > all;
+    for (auto& s_list1: v_segments1)
+    {
+        for (auto it1 = s_list1.begin(); it1 != s_list1.end(); it1++)
+        {
+            if (it1->is_arc() == s0.is_arc())
+            {
+                all.push_back(std::make_pair(&s_list1, it1));
+            }
+        }
+    }
+    
+    std::int32_t n = all.size();
+    std::vector<double> dist(n);
+    /* 留一点余量 最终以_is_coupled为准 */
+    const double slack = 0.001;
+    if (s0.is_arc())
+    {
+        /* 圆心距离 */
+        std::vector<double> x1(n);
+        std::vector<double> y1(n);
+        std::vector<double> x2(n);
+        std::vector<double> y2(n);
+        std::vector<double> x3(n);
+        std::vector<double> y3(n);
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            const pcb::segment& s1 = *all[i].second;
+            x1[i] = s1.start.x;
+            y1[i] = s1.start.y;
+            x2[i] = s1.mid.x;
+            y2[i] = s1.mid.y;
+            x3[i] = s1.end.x;
+            y3[i] = s1.end.y;
+        }
+        std::vector<double> cx(n);
+        std::vector<double> cy(n);
+        std::vector<double> radius(n);
+        calc_arc_center_radius_batch(x1.data(), y1.data(), x2.data(), y2.data(), x3.data(), y3.data(), n, cx.data(), cy.data(), radius.data());
+        
+        double cx0;
+        double cy0;
+        double radius0;
+        calc_arc_center_radius(s0.start.x, s0.start.y, s0.mid.x, s0.mid.y, s0.end.x, s0.end.y, cx0, cy0, radius0);
+        calc_dist_batch(cx0, cy0, cx.data(), cy.data(), n, dist.data());
+        
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            if (dist[i] <= _arc_center_epsilon + slack)
+            {
+                cands.push_back(all[i]);
+            }
+        }
+    }
+    else
+    {
+        /* 起点到s0所在直线的距离 */
+        std::vector<double> xs(n);
+        std::vector<double> ys(n);
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            xs[i] = all[i].second->start.x;
+            ys[i] = all[i].second->start.y;
+        }
+        calc_p2line_dist_batch(s0.start.x, s0.start.y, s0.end.x, s0.end.y, xs.data(), ys.data(), n, dist.data());
+        
+        for (std::int32_t i = 0; i < n; i++)
+        {
+            if (dist[i] - s0.width * 0.5 - all[i].second->width * 0.5 <= _coupled_max_gap + slack)
+            {
+                cands.push_back(all[i]);
+            }
+        }
+    }
+}
+
+
+float z_extractor::_get_segment_pos(const pcb::segment& s, float x, float y)
 {
-    float h = _pcb->get_layer_distance(layer_name1, layer_name2);
-    return h / 5 * (1 + log(4.0 * h / v.drill));
+    if (s.is_arc())
+    {
+        return calc_arc_pos(s.start.x, s.start.y, s.mid.x, s.mid.y, s.end.x, s.end.y, x, y);
+    }
+    return calc_dist(x, y, s.start.x, s.start.y);
 }
 
 
-bool z_extractor::_is_coupled(const pcb::segment& s1, const pcb::segment& s2, float coupled_max_gap, float coupled_min_len)
+float z_extractor::_get_sample_step(const pcb::segment& s, float box_w)
 {
-    if (s1.is_arc() || s2.is_arc())
-    {
-        return false;
-    }
-    
-    float a1 = calc_angle(s1.start.x, s1.start.y, s1.end.x, s1.end.y);
-    float a2 = calc_angle(s2.start.x, s2.start.y, s2.end.x, s2.end.y);
-    float a22 = calc_angle(s2.end.x, s2.end.y, s2.start.x, s2.start.y);
-    if (fabs(a1 - a2) > _float_epsilon && fabs(a1 - a22) > _float_epsilon)
-    {
-        return false;
-    }
-    float dist = calc_p2line_dist(s1.start.x, s1.start.y, s1.end.x, s1.end.y, s2.start.x, s2.start.y);
-    float gap = dist - s1.width * 0.5 - s2.width * 0.5;
-    if (gap > coupled_max_gap)
+    if (!s.is_arc())
     {
-        return false;
+        return _Z0_step;
     }
     
-    float ovlen = calc_parallel_lines_overlap_len(s1.start.x, s1.start.y, s1.end.x, s1.end.y,
-                                        s2.start.x, s2.start.y, s2.end.x, s2.end.y);
-    if (ovlen < coupled_min_len)
+    /* 截面绕圆心转动 截面外侧移动的距离不超过_Z0_step */
+    double cx;
+    double cy;
+    double radius;
+    calc_arc_center_radius(s.start.x, s.start.y, s.mid.x, s.mid.y, s.end.x, s.end.y, cx, cy, radius);
+    if (radius <= 0)
     {
-        return false;
+        return _Z0_step;
     }
-    return true;
+    return _Z0_step * radius / (radius + box_w * 0.5);
 }
 
 
-
 void z_extractor::_split_segment(const pcb::segment& s, std::list<pcb::segment>& ss, float x1, float y1, float x2, float y2)
 {
-    float d1 = calc_dist(x1, y1, s.start.x, s.start.y);
-    float d2 = calc_dist(x2, y2, s.start.x, s.start.y);
+    /* 按沿走线的距离排序 圆弧的分段需要重新计算中点 */
+    float len = _pcb->get_segment_len(s);
+    float d1 = _get_segment_pos(s, x1, y1);
+    float d2 = _get_segment_pos(s, x2, y2);
     
     float limit = 0.0254;
     
     std::uint32_t idx = 0;
     std::vector<pcb::point> ps;
+    std::vector<float> offset;
     ps.push_back(s.start);
+    offset.push_back(0);
     if (d1 < d2)
     {
         if (d1 > limit)
@@ -1736,19 +2594,21 @@ void z_extractor::_split_segment(const pcb::segment& s, std::list<pcb::segment>&
             p.x = x1;
             p.y = y1;
             ps.push_back(p);
+            offset.push_back(d1);
             idx = 1;
         }
         else
         {
             idx = 0;
         }
-        float d = calc_dist(x2, y2, s.end.x, s.end.y);
+        float d = len - d2;
         if (d > limit)
         {
             pcb::point p;
             p.x = x2;
             p.y = y2;
             ps.push_back(p);
+            offset.push_back(d2);
         }
     }
     else
@@ -1759,23 +2619,26 @@ void z_extractor::_split_segment(const pcb::segment& s, std::list<pcb::segment>&
             p.x = x2;
             p.y = y2;
             ps.push_back(p);
+            offset.push_back(d2);
             idx = 1;
         }
         else
         {
             idx = 0;
         }
-        float d = calc_dist(x1, y1, s.end.x, s.end.y);
+        float d = len - d1;
         if (d > limit)
         {
             pcb::point p;
             p.x = x1;
             p.y = y1;
             ps.push_back(p);
+            offset.push_back(d1);
         }
     }
     
     ps.push_back(s.end);
+    offset.push_back(len);
     
     const char *str[] = {"0", "1", "2", "3", "4"};
     for (std::uint32_t i = 0; i < ps.size() - 1; i++)
@@ -1784,6 +2647,10 @@ void z_extractor::_split_segment(const pcb::segment& s, std::list<pcb::segment>&
         tmp.tstamp = str[i] + tmp.tstamp;
         tmp.start = ps[i];
         tmp.end = ps[i + 1];
+        if (s.is_arc())
+        {
+            _pcb->get_segment_pos(s, (offset[i] + offset[i + 1]) * 0.5, tmp.mid.x, tmp.mid.y);
+        }
         if (i == idx)
         {
             ss.push_front(tmp);
@@ -1796,17 +2663,104 @@ void z_extractor::_split_segment(const pcb::segment& s, std::list<pcb::segment>&
 }
 
 
-std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name, pcb::segment& s, const std::map<std::string, cv::Mat>& refs_mat, std::vector<std::pair<float, float> >& v_Z0_td)
+bool z_extractor::_segment_can_merge(const pcb::segment& s0, const pcb::segment& s1,
+                                     const std::list<pcb::pad>& pads, const std::list<pcb::via>& vias, const std::list<pcb::segment>& segments)
+{
+    if (s0.layer_name != s1.layer_name
+        || fabs(s0.width - s1.width) > _float_epsilon
+        || fabs(s0.end.x - s1.start.x) > _float_epsilon
+        || fabs(s0.end.y - s1.start.y) > _float_epsilon)
+    {
+        return false;
+    }
+    
+    /* 连接点在焊盘里 */
+    for (const auto& p: pads)
+    {
+        if (_pcb->segment_is_inside_pad(s0, p) & 2)
+        {
+            return false;
+        }
+    }
+    
+    /* 连接点上有过孔 */
+    for (const auto& v: vias)
+    {
+        if (calc_dist(v.at.x, v.at.y, s0.end.x, s0.end.y) < v.size * 0.5)
+        {
+            return false;
+        }
+    }
+    
+    /* 连接点上有分支 */
+    std::uint32_t conn = 0;
+    for (const auto& s: segments)
+    {
+        if (s.layer_name != s0.layer_name)
+        {
+            continue;
+        }
+        if ((fabs(s.start.x - s0.end.x) < _float_epsilon && fabs(s.start.y - s0.end.y) < _float_epsilon)
+            || (fabs(s.end.x - s0.end.x) < _float_epsilon && fabs(s.end.y - s0.end.y) < _float_epsilon))
+        {
+            conn++;
+        }
+    }
+    return conn <= 2;
+}
+
+
+void z_extractor::_merge_segments(const std::vector<pcb::segment>& v_list, std::vector<std::vector<pcb::segment> >& runs)
+{
+    /* v_list都在同一个网络 焊盘 过孔和走线只取一次 */
+    std::list<pcb::pad> pads;
+    std::list<pcb::via> vias;
+    std::list<pcb::segment> segments;
+    if (_segment_merge && !v_list.empty())
+    {
+        pads = _pcb->get_pads(v_list.front().net);
+        vias = _pcb->get_vias(v_list.front().net);
+        segments = _pcb->get_segments(v_list.front().net);
+    }
+    
+    for (const auto& s: v_list)
+    {
+        if (_segment_merge && !runs.empty() && _segment_can_merge(runs.back().back(), s, pads, vias, segments))
+        {
+            runs.back().push_back(s);
+        }
+        else
+        {
+            runs.push_back(std::vector<pcb::segment>(1, s));
+        }
+    }
+}
+
+
+std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name, const std::vector<pcb::segment>& ss, const std::map<std::string, cv::Mat>& refs_mat,
+                                                    std::vector<std::pair<float, float> >& v_Z0_td, std::vector<std::string>& models)
 {
 #if DBG_IMG
     cv::Mat img(_get_pcb_img_rows(), _get_pcb_img_cols(), CV_8UC1, cv::Scalar(0, 0, 0));
-    _draw_segment(img, s, 255, 255, 255);
+    for (auto s: ss)
+    {
+        _draw_segment(img, s, 255, 255, 255);
+    }
     cv::imshow("img", img);
                     
 #endif
 
     std::string cir;
-    float s_len = _pcb->get_segment_len(s);
+    /* 同一组走线的层和线宽相同 每条走线在组里的起始位置 */
+    const pcb::segment& s = ss.front();
+    std::vector<float> seg_offset;
+    float s_len = 0;
+    for (const auto& seg: ss)
+    {
+        seg_offset.push_back(s_len);
+        s_len += _pcb->get_segment_len(seg);
+    }
+    
     if (s_len < _segment_min_len)
     {
         return  ".subckt " + cir_name + " pin1 pin2\nR1 pin1 pin2 0\n.ends\n";
@@ -1835,15 +2789,23 @@ std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name,
     
     std::vector<Z0_item> Z0s;
     
-    
-    for (float i = 0; i < s_len; i += _Z0_step)
+    /* 按弧长采样 圆弧上的步长随曲率减小 */
+    float step = _Z0_step;
+    std::uint32_t seg_idx = 0;
+    for (float i = 0; i < s_len; i += step)
     {
         Z0_item tmp;
         tmp.pos = i;
         Z0s.push_back(tmp);
+        
+        while (seg_idx + 1 < ss.size() && i >= seg_offset[seg_idx + 1])
+        {
+            seg_idx++;
+        }
+        step = _get_sample_step(ss[seg_idx], box_w);
     }
     
-    if (Z0s.size() > 1 && s_len - Z0s.back().pos < 0.5 * _Z0_step)
+    if (Z0s.size() > 1 && s_len - Z0s.back().pos < 0.5 * step)
     {
         Z0s.back().pos = s_len;
     }
@@ -1854,6 +2816,9 @@ std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name,
         Z0s.push_back(tmp);
     }
     
+    /* 每组走线开始时清空截面缓存 结果不依赖线程调度和线程数
+     * 同一组内直线和圆弧的截面仍能命中缓存
+     */
     std::int32_t thread_num = omp_get_thread_num();
     std::shared_ptr<Z0_calc>& calc = _Z0_calc[thread_num];
     calc->clean_all();
@@ -1872,10 +2837,18 @@ std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name,
             calc->add_elec(0, y + box_y_offset, box_w, _pcb->get_layer_thickness(l), _pcb->get_layer_epsilon_r(l));
         }
         
+        /* 找到pos所在的走线 拐角处用前一条走线的终点 */
+        std::uint32_t k = 0;
+        while (k + 1 < ss.size() && pos > seg_offset[k + 1])
+        {
+            k++;
+        }
+        float seg_pos = std::min(pos - seg_offset[k], _pcb->get_segment_len(ss[k]));
+        
         std::set<std::string> elec_add;
         for (auto& refs: refs_mat)
         {
-            std::list<std::pair<float, float> >  grounds = _get_segment_ref_plane(s, refs.second, pos, s.width * _Z0_w_ratio);
+            std::list<std::pair<float, float> >  grounds = _get_segment_ref_plane(ss[k], refs.second, seg_pos, s.width * _Z0_w_ratio);
             
             for (auto& g: grounds)
             {
@@ -1912,8 +2885,17 @@ std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name,
         item.r = r;
     }
 
-    int pin = 1;
-    int idx = 1;
+    /* 参数相同(按有效位数量化后)的模型整个库只输出一次 模型名由参数的哈希得到 与生成顺序无关
+     * 相邻两段的模型相同时合并成一段 ltra的长度在模型里 不合并
+     */
+    struct tl_section
+    {
+        std::string model;
+        float Z0;
+        float td;
+        float dist;
+    };
+    std::vector<tl_section> sections;
     char strbuf[512];
     
     Z0_item begin = Z0s[0];
@@ -1933,45 +2915,86 @@ std::string z_extractor::_gen_segment_Z0_ckt_openmp(const std::string& cir_name,
             }
             
             v_Z0_td.push_back(std::pair<float, float>(begin.Z0, td));
-        #if 0
-            if (td >= 0.001)
+            
+            /* 宽带模型和耦合线一样只由_lossless_tl决定是否有损 */
+            float ro = 0;
+            float rs = 0;
+            float gd = 0;
+            float g = 0;
+            if (_wideband_model != WIDEBAND_NONE && !_lossless_tl)
             {
-                sprintf(strbuf, "T%d pin%d 0 pin%d 0 Z0=%g TD=%gNS\n", idx++, pin, pin + 1, begin.Z0, td);
+                _calc_wideband_rlgc(s.layer_name, s.width, begin.c, begin.v, ro, rs, gd);
+                if (_wideband_model == WIDEBAND_NGSPICE)
+                {
+                    r = ro + rs * sqrt(_freq);
+                    g = gd * _freq;
+                }
             }
-            else
+            
+            if (_wideband_model == WIDEBAND_HSPICE)
             {
-                sprintf(strbuf, "L%d pin%d pin%d %gnH\n", idx++, pin, pin + 1, last_l * dist * 0.001);
+                sprintf(strbuf, "W MODELTYPE=RLGC N=1 Lo=%.4g Co=%.4g Ro=%.4g Go=0 Rs=%.4g Gd=%.4g",
+                            begin.l * 1e-9, begin.c * 1e-12, ro, rs, gd);
             }
-        #else
-            if (!_ltra_model)
+            else if (!_ltra_model)
             {
-                sprintf(strbuf, "***Z0:%g TD:%gNS***\n"
-                            "Y%d pin%d 0 pin%d 0 ymod%d LEN=%g\n"
-                            ".MODEL ymod%d txl R=%g L=%gnH G=0 C=%gpF length=1\n",
-                            begin.Z0, td,
-                            idx, pin, pin + 1, idx, dist * 0.001,
-                            idx, r, begin.l, begin.c
-                            );
+                sprintf(strbuf, "txl R=%.4g L=%.4gnH G=%.4g C=%.4gpF length=1", r, begin.l, g, begin.c);
             }
             else
             {
+                sprintf(strbuf, "LTRA R=%.4g L=%.4gnH G=%.4g C=%.4gpF LEN=%g", r, begin.l, g, begin.c, dist * 0.001);
+            }
             
-                sprintf(strbuf, "***Z0:%g TD:%gNS***\n"
-                            "O%d pin%d 0 pin%d 0 ltra%d\n"
-                            ".MODEL ltra%d LTRA R=%g L=%gnH G=0 C=%gpF LEN=%g\n",
-                            begin.Z0, td,
-                            idx, pin, pin + 1, idx,
-                            idx, r, begin.l, begin.c, dist * 0.001
-                            );
-            }
-            idx++;
-        #endif
-            pin++;
-            cir += strbuf;
+            std::string model = _get_model_name((_wideband_model == WIDEBAND_HSPICE)? "wmod": (_ltra_model? "ltra": "ymod"), strbuf);
+            if (!sections.empty() && sections.back().model == model && !_ltra_model)
+            {
+                sections.back().td += td;
+                sections.back().dist += dist;
+            }
+            else
+            {
+                models.push_back(".MODEL " + model + " " + strbuf + "\n");
+                tl_section sec;
+                sec.model = model;
+                sec.Z0 = begin.Z0;
+                sec.td = td;
+                sec.dist = dist;
+                sections.push_back(sec);
+            }
             begin = end;
         }
     }
     
+    int pin = 1;
+    int idx = 1;
+    for (const auto& sec: sections)
+    {
+        if (_wideband_model == WIDEBAND_HSPICE)
+        {
+            sprintf(strbuf, "***Z0:%g TD:%gNS***\n"
+                        "W%d pin%d 0 pin%d 0 N=1 L=%g RLGCmodel=%s\n",
+                        sec.Z0, sec.td,
+                        idx, pin, pin + 1, sec.dist * 0.001, sec.model.c_str());
+        }
+        else if (!_ltra_model)
+        {
+            sprintf(strbuf, "***Z0:%g TD:%gNS***\n"
+                        "Y%d pin%d 0 pin%d 0 %s LEN=%g\n",
+                        sec.Z0, sec.td,
+                        idx, pin, pin + 1, sec.model.c_str(), sec.dist * 0.001);
+        }
+        else
+        {
+            sprintf(strbuf, "***Z0:%g TD:%gNS***\n"
+                        "O%d pin%d 0 pin%d 0 %s\n",
+                        sec.Z0, sec.td,
+                        idx, pin, pin + 1, sec.model.c_str());
+        }
+        idx++;
+        pin++;
+        cir += strbuf;
+    }
+    
     cir += ".ends\n";
     sprintf(strbuf, ".subckt %s pin1 pin%d\n", cir_name.c_str(), pin);
     return  strbuf + cir;
@@ -1990,15 +3013,34 @@ std::string z_extractor::_gen_segment_coupled_Z0_ckt_openmp(const std::string& c
         std::swap(s1.start, s1.end);
     }
     
+    /* s为两条线的中心线 同心圆弧交叠部分的起点终点和中点都在同一条半径上 */
     pcb::segment s;
     s.start.x = (s0.start.x + s1.start.x) * 0.5;
     s.start.y = (s0.start.y + s1.start.y) * 0.5;
     s.end.x = (s0.end.x + s1.end.x) * 0.5;
     s.end.y = (s0.end.y + s1.end.y) * 0.5;
-    s.width = calc_p2line_dist(s0.start.x, s0.start.y, s0.end.x, s0.end.y, s1.start.x, s1.start.y);
+    
+    bool s0_is_left = false;
+    if (s0.is_arc())
+    {
+        s.mid.x = (s0.mid.x + s1.mid.x) * 0.5;
+        s.mid.y = (s0.mid.y + s1.mid.y) * 0.5;
+        s.width = calc_dist(s0.start.x, s0.start.y, s1.start.x, s1.start.y);
+        
+        float x_left = 0;
+        float y_left = 0;
+        float x_right = 0;
+        float y_right = 0;
+        _pcb->get_segment_perpendicular(s, 0, s.width, x_left, y_left, x_right, y_right);
+        s0_is_left = calc_dist(s0.start.x, s0.start.y, x_left, y_left) < calc_dist(s0.start.x, s0.start.y, x_right, y_right);
+    }
+    else
+    {
+        s.width = calc_p2line_dist(s0.start.x, s0.start.y, s0.end.x, s0.end.y, s1.start.x, s1.start.y);
+        s0_is_left = ((s.start.y - s.end.y) * s0.start.x + (s.end.x - s.start.x) * s0.start.y + s.start.x * s.end.y - s.end.x * s.start.y) > 0;
+    }
     
     float s_len = _pcb->get_segment_len(s);
-    bool s0_is_left = ((s.start.y - s.end.y) * s0.start.x + (s.end.x - s.start.x) * s0.start.y + s.start.x * s.end.y - s.end.x * s.start.y) > 0;
 
     std::vector<std::string> layers = _pcb->get_all_dielectric_layer();
     float box_w = std::min(std::max(s0.width, s1.width) * _Z0_w_ratio, s.width * _Z0_w_ratio);
@@ -2026,14 +3068,15 @@ std::string z_extractor::_gen_segment_coupled_Z0_ckt_openmp(const std::string& c
     
     std::vector<Z0_item> ss_Z0s;
     
-    for (float i = 0; i < s_len; i += _Z0_step)
+    float step = _get_sample_step(s, box_w);
+    for (float i = 0; i < s_len; i += step)
     {
         Z0_item tmp;
         tmp.pos = i;
         ss_Z0s.push_back(tmp);
     }
     
-    if (ss_Z0s.size() > 1 && s_len - ss_Z0s.back().pos < 0.5 * _Z0_step)
+    if (ss_Z0s.size() > 1 && s_len - ss_Z0s.back().pos < 0.5 * step)
     {
         ss_Z0s.back().pos = s_len;
     }
@@ -2170,18 +3213,69 @@ std::string z_extractor::_gen_segment_coupled_Z0_ckt_openmp(const std::string& c
     }
     
     char strbuf[512];
+    float ro[2] = {0, 0};
+    float rs[2] = {0, 0};
+    float gd[2] = {0, 0};
+    float gd12 = 0;
+    float c12 = (c_matrix[0][1] + c_matrix[1][0]) * 0.5;
+    float l12 = (l_matrix[0][1] + l_matrix[1][0]) * 0.5;
+    if (_wideband_model != WIDEBAND_NONE && !_lossless_tl)
+    {
+        _calc_wideband_rlgc(s0.layer_name, s0.width, c_matrix[0][0], 1 / sqrt(l_matrix[0][0] * 1e-9 * c_matrix[0][0] * 1e-12), ro[0], rs[0], gd[0]);
+        _calc_wideband_rlgc(s1.layer_name, s1.width, c_matrix[1][1], 1 / sqrt(l_matrix[1][1] * 1e-9 * c_matrix[1][1] * 1e-12), ro[1], rs[1], gd[1]);
+        
+        /* Gd与电容矩阵成比例 互电导取两根线的平均损耗 */
+        gd12 = (c_matrix[0][0] > 0 && c_matrix[1][1] > 0)? c12 * (gd[0] / c_matrix[0][0] + gd[1] / c_matrix[1][1]) * 0.5: 0;
+    }
+    
+    if (_wideband_model == WIDEBAND_HSPICE)
+    {
+        sprintf(strbuf, "***Zodd:%g Zeven:%g Zdiff:%g Zcomm:%g***\n"
+                        "W1 pin1 pin3 0 pin2 pin4 0 N=2 L=%g RLGCmodel=wmod\n"
+                        ".MODEL wmod W MODELTYPE=RLGC N=2\n"
+                        "+Lo=%g %g %g\n"
+                        "+Co=%g %g %g\n"
+                        "+Ro=%g 0 %g\n"
+                        "+Go=0 0 0\n"
+                        "+Rs=%g 0 %g\n"
+                        "+Gd=%g %g %g\n",
+                        Zodd, Zeven, Zodd * 2, Zeven * 0.5,
+                        s_len * 0.001,
+                        l_matrix[0][0] * 1e-9, l12 * 1e-9, l_matrix[1][1] * 1e-9,
+                        c_matrix[0][0] * 1e-12, c12 * 1e-12, c_matrix[1][1] * 1e-12,
+                        ro[0], ro[1],
+                        rs[0], rs[1],
+                        gd[0], gd12, gd[1]);
+        cir += strbuf;
+        cir += ".ends\n";
+        sprintf(strbuf, ".subckt %s pin1 pin2  pin3 pin4\n", cir_name.c_str());
+        return  strbuf + cir;
+    }
+    
+    /* ngspice没有频变的传输线模型 R和G取_freq处的值 */
+    float cpl_g[2][2] = {{0, 0}, {0, 0}};
+    if (_wideband_model == WIDEBAND_NGSPICE && !_lossless_tl)
+    {
+        r_matrix[0][0] = ro[0] + rs[0] * sqrt(_freq);
+        r_matrix[1][1] = ro[1] + rs[1] * sqrt(_freq);
+        cpl_g[0][0] = gd[0] * _freq;
+        cpl_g[0][1] = gd12 * _freq;
+        cpl_g[1][1] = gd[1] * _freq;
+    }
+    
     sprintf(strbuf, "***Zodd:%g Zeven:%g Zdiff:%g Zcomm:%g***\n"
                     "P1 pin1 pin3 0 pin2 pin4 0 PLINE\n"
                     ".model PLINE CPL length=%g\n"
                     "+R=%g 0 %g\n"
                     "+L=%gnH %gnH %gnH\n"
-                    "+G=0 0 0\n"
+                    "+G=%g %g %g\n"
                     "+C=%gpF %gpF %gpF\n",
                     Zodd, Zeven, Zodd * 2, Zeven * 0.5,
                     s_len * 0.001,
                     r_matrix[0][0], r_matrix[1][1],
-                    l_matrix[0][0], (l_matrix[0][1] + l_matrix[1][0]) * 0.5, l_matrix[1][1],
-                    c_matrix[0][0], (c_matrix[0][1] + c_matrix[1][0]) * 0.5, c_matrix[1][1]);
+                    l_matrix[0][0], l12, l_matrix[1][1],
+                    cpl_g[0][0], cpl_g[0][1], cpl_g[1][1],
+                    c_matrix[0][0], c12, c_matrix[1][1]);
     cir += strbuf;
     
     cir += ".ends\n";
@@ -2189,24 +3283,281 @@ std::string z_extractor::_gen_segment_coupled_Z0_ckt_openmp(const std::string& c
     return  strbuf + cir;
 }
 
-std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::Mat>& refs_mat, const std::vector<std::uint32_t>& refs_id, std::string& call, float& td)
+std::string z_extractor::_gen_vias_ckt(const std::list<pcb::via>& vias, const std::map<std::string, cv::Mat>& refs_mat, const std::vector<std::uint32_t>& refs_id,
+                                        std::string& call, std::vector<float>& td)
+{
+    std::string sub;
+    std::vector<pcb::via> v_vias(vias.begin(), vias.end());
+    std::vector<std::string> keys(v_vias.size());
+    std::vector<std::vector<float> > anti_pad_d(v_vias.size());
+    std::vector<std::list<pcb::via> > ret_vias(v_vias.size());
+    
+    /* 只有传输线模型需要回流过孔 */
+    if (_via_tl_mode)
+    {
+        _build_via_grid(refs_id);
+    }
+    
+    #pragma omp parallel for
+    for (std::int32_t i = 0; i < (std::int32_t)v_vias.size(); i++)
+    {
+        _get_via_env(v_vias[i], refs_mat, _via_tl_mode, anti_pad_d[i], ret_vias[i]);
+        keys[i] = _get_via_signature(v_vias[i], anti_pad_d[i], ret_vias[i]);
+    }
+    
+    /* 库中没有的模型才需要计算 */
+    std::vector<std::int32_t> new_idx;
+    std::vector<via_model *> new_models;
+    for (std::int32_t i = 0; i < (std::int32_t)v_vias.size(); i++)
+    {
+        if (_via_models.count(keys[i]) == 0)
+        {
+            char buf[32] = {0};
+            sprintf(buf, "VIAM%u", (std::uint32_t)_via_models.size());
+            via_model& m = _via_models[keys[i]];
+            m.name = buf;
+            new_idx.push_back(i);
+            new_models.push_back(&m);
+        }
+    }
+    
+    /* 每个求解器实例使用独立的临时目录 可以并行 */
+    #pragma omp parallel for
+    for (std::int32_t i = 0; i < (std::int32_t)new_idx.size(); i++)
+    {
+        std::int32_t idx = new_idx[i];
+        via_model& m = *new_models[i];
+        if (_via_tl_mode)
+        {
+            m.ckt = _gen_via_Z0_ckt(v_vias[idx], anti_pad_d[idx], ret_vias[idx], m.name, m.td);
+        }
+        else
+        {
+            m.ckt = _gen_via_model_ckt(v_vias[idx], anti_pad_d[idx], m.name, m.td);
+        }
+    }
+    log_debug("vias:%u new via models:%u\n", (std::uint32_t)v_vias.size(), (std::uint32_t)new_models.size());
+    
+    td.resize(v_vias.size());
+    for (std::int32_t i = 0; i < (std::int32_t)v_vias.size(); i++)
+    {
+        const pcb::via& v = v_vias[i];
+        via_model& m = _via_models[keys[i]];
+        if (!m.emitted)
+        {
+            m.emitted = true;
+            sub += m.ckt;
+        }
+        
+        call += "XVIA" + _get_tstamp_short(v.tstamp) + " ";
+        std::vector<std::string> conn_layers = _pcb->get_via_conn_layers(v);
+        for (const auto& layer_name: conn_layers)
+        {
+            call += _pos2net(v.at.x, v.at.y, layer_name) + " ";
+        }
+        call += m.name + "\n";
+        td[i] = m.td;
+    }
+    return sub;
+}
+
+
+void z_extractor::_get_via_env(const pcb::via& v, const std::map<std::string, cv::Mat>& refs_mat, bool use_ret_vias,
+                                std::vector<float>& anti_pad_d, std::list<pcb::via>& ret_vias)
+{
+    std::vector<std::string> layers = _pcb->get_via_layers(v);
+    std::vector<float> layer_anti_pad_d;
+    for (const auto& layer_name: layers)
+    {
+        layer_anti_pad_d.push_back(_get_via_anti_pad_diameter(v, refs_mat, layer_name));
+    }
+    
+    anti_pad_d.clear();
+    for (std::int32_t i = 0; i < (std::int32_t)layers.size() - 1; i++)
+    {
+        float d = std::min(layer_anti_pad_d[i], layer_anti_pad_d[i + 1]);
+        anti_pad_d.push_back(round(d / _via_quantum) * _via_quantum);
+    }
+    
+    ret_vias.clear();
+    if (!use_ret_vias)
+    {
+        return;
+    }
+    
+    float box_w = v.drill * 10;
+    std::vector<const pcb::via *> near_vias;
+    _query_via_grid(v.at.x, v.at.y, box_w, near_vias);
+    for (const auto ref_via: near_vias)
+    {
+        float dist = calc_dist(ref_via->at.x, ref_via->at.y, v.at.x, v.at.y);
+        if (dist < box_w - ref_via->drill)
+        {
+            pcb::via ret;
+            ret.at.x = round((ref_via->at.x - v.at.x) / _via_quantum) * _via_quantum;
+            ret.at.y = round((ref_via->at.y - v.at.y) / _via_quantum) * _via_quantum;
+            ret.drill = ref_via->drill;
+            ret.size = ref_via->size;
+            ret_vias.push_back(ret);
+        }
+    }
+    
+    ret_vias.sort([](const pcb::via& a, const pcb::via& b)
+        {
+            if (a.at.x != b.at.x)
+            {
+                return a.at.x < b.at.x;
+            }
+            if (a.at.y != b.at.y)
+            {
+                return a.at.y < b.at.y;
+            }
+            return a.drill < b.drill;
+        });
+}
+
+
+void z_extractor::_build_via_grid(const std::vector<std::uint32_t>& refs_id)
+{
+    via_grid& g = _via_grid;
+    if (!g.start.empty() && g.refs_id == refs_id)
+    {
+        return;
+    }
+    
+    std::list<pcb::via> vias = _pcb->get_vias(refs_id);
+    g.refs_id = refs_id;
+    g.vias.assign(vias.begin(), vias.end());
+    g.cell = _via_grid_cell;
+    
+    float x_min = FLT_MAX;
+    float y_min = FLT_MAX;
+    float x_max = -FLT_MAX;
+    float y_max = -FLT_MAX;
+    for (const auto& v: g.vias)
+    {
+        x_min = std::min(x_min, v.at.x);
+        y_min = std::min(y_min, v.at.y);
+        x_max = std::max(x_max, v.at.x);
+        y_max = std::max(y_max, v.at.y);
+    }
+    if (g.vias.empty())
+    {
+        x_min = x_max = y_min = y_max = 0;
+    }
+    g.x0 = x_min;
+    g.y0 = y_min;
+    g.cols = (std::int32_t)((x_max - x_min) / g.cell) + 1;
+    g.rows = (std::int32_t)((y_max - y_min) / g.cell) + 1;
+    
+    /* 先统计每个格子的过孔数 再按格子顺序排列过孔的下标 */
+    std::vector<std::int32_t> cell_id(g.vias.size());
+    g.start.assign((std::size_t)g.cols * g.rows + 1, 0);
+    for (std::uint32_t i = 0; i < g.vias.size(); i++)
+    {
+        std::int32_t col = (std::int32_t)((g.vias[i].at.x - g.x0) / g.cell);
+        std::int32_t row = (std::int32_t)((g.vias[i].at.y - g.y0) / g.cell);
+        cell_id[i] = row * g.cols + col;
+        g.start[cell_id[i] + 1]++;
+    }
+    for (std::uint32_t i = 1; i < g.start.size(); i++)
+    {
+        g.start[i] += g.start[i - 1];
+    }
+    
+    std::vector<std::uint32_t> pos(g.start.begin(), g.start.end() - 1);
+    g.idx.resize(g.vias.size());
+    for (std::uint32_t i = 0; i < g.vias.size(); i++)
+    {
+        g.idx[pos[cell_id[i]]++] = i;
+    }
+    log_debug("ref vias:%u grid:%dx%d\n", (std::uint32_t)g.vias.size(), g.cols, g.rows);
+}
+
+
+void z_extractor::_query_via_grid(float x, float y, float radius, std::vector<const pcb::via *>& vias)
+{
+    const via_grid& g = _via_grid;
+    vias.clear();
+    if (g.vias.empty())
+    {
+        return;
+    }
+    
+    std::int32_t col_min = std::max(0, (std::int32_t)floor((x - radius - g.x0) / g.cell));
+    std::int32_t col_max = std::min(g.cols - 1, (std::int32_t)floor((x + radius - g.x0) / g.cell));
+    std::int32_t row_min = std::max(0, (std::int32_t)floor((y - radius - g.y0) / g.cell));
+    std::int32_t row_max = std::min(g.rows - 1, (std::int32_t)floor((y + radius - g.y0) / g.cell));
+    
+    for (std::int32_t row = row_min; row <= row_max; row++)
+    {
+        for (std::int32_t col = col_min; col <= col_max; col++)
+        {
+            std::int32_t c = row * g.cols + col;
+            for (std::uint32_t k = g.start[c]; k < g.start[c + 1]; k++)
+            {
+                const pcb::via& v = g.vias[g.idx[k]];
+                if (calc_dist(v.at.x, v.at.y, x, y) < radius)
+                {
+                    vias.push_back(&v);
+                }
+            }
+        }
+    }
+}
+
+
+std::string z_extractor::_get_via_signature(const pcb::via& v, const std::vector<float>& anti_pad_d, const std::list<pcb::via>& ret_vias)
+{
+    char buf[128] = {0};
+    std::string key;
+    
+    sprintf(buf, "%d %.4f %.4f", _via_tl_mode? 1: 0, v.drill, v.size);
+    key = buf;
+    
+    key += " |";
+    std::vector<std::string> layers = _pcb->get_via_layers(v);
+    for (const auto& layer_name: layers)
+    {
+        key += " " + layer_name;
+    }
+    
+    key += " |";
+    std::vector<std::string> conn_layers = _pcb->get_via_conn_layers(v);
+    for (const auto& layer_name: conn_layers)
+    {
+        key += " " + layer_name;
+    }
+    
+    key += " |";
+    for (const auto& d: anti_pad_d)
+    {
+        sprintf(buf, " %ld", lround(d / _via_quantum));
+        key += buf;
+    }
+    
+    key += " |";
+    for (const auto& ret: ret_vias)
+    {
+        sprintf(buf, " %ld,%ld,%.4f", lround(ret.at.x / _via_quantum), lround(ret.at.y / _via_quantum), ret.drill);
+        key += buf;
+    }
+    return key;
+}
+
+
+std::string z_extractor::_gen_via_Z0_ckt(const pcb::via& v, const std::vector<float>& anti_pad_d, const std::list<pcb::via>& ret_vias, const std::string& name, float& td)
 {
     char buf[2048] = {0};
     std::string ckt;
-    ckt = ".subckt VIA" + _get_tstamp_short(v.tstamp) + " ";
-    call = "XVIA" + _get_tstamp_short(v.tstamp) + " ";
+    ckt = ".subckt " + name + " ";
     
-    std::list<pcb::via> vias = _pcb->get_vias(refs_id);
     std::vector<std::string> conn_layers = _pcb->get_via_conn_layers(v);
     for (std::int32_t i = 0; i < (std::int32_t)conn_layers.size(); i++)
     {
-        const std::string& layer_name = conn_layers[i];
-        ckt += _pos2net(v.at.x, v.at.y, layer_name) + " ";
-        call += _pos2net(v.at.x, v.at.y, layer_name) + " ";
+        ckt += _format_layer_name(conn_layers[i]) + " ";
     }
-    
     ckt += "\n";
-    call += "VIA" + _get_tstamp_short(v.tstamp) + "\n";
     
     float radius = v.drill * 0.5;
     float box_w = v.drill * 10;
@@ -2215,6 +3566,7 @@ std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::
     float atlc_pix_unit = thickness * 0.5;
     
     fdm_Z0_calc fdm_;
+    fdm_.set_convergence(_fdm_rel_tol, _fdm_max_iter);
     fdm_.set_precision(atlc_pix_unit);
     fdm_.set_box_size(box_w, box_h);
     
@@ -2227,9 +3579,7 @@ std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::
         const std::string& end = layers[i + 1];
         
         float h = _pcb->get_layer_distance(start, end);
-        float start_anti_pad_d = _get_via_anti_pad_diameter(v, refs_mat, start);
-        float end_anti_pad_d = _get_via_anti_pad_diameter(v, refs_mat, end);
-        float anti_pad_diameter = std::min(start_anti_pad_d, end_anti_pad_d);
+        float anti_pad_diameter = anti_pad_d[i];
         
         float max_d = sqrt(h * h + anti_pad_diameter * 0.5 * anti_pad_diameter * 0.5);
         float er = _pcb->get_layer_epsilon_r(start, end);
@@ -2246,13 +3596,10 @@ std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::
         fdm_.add_elec(0, -box_h, box_w, box_h * 2, er);
         fdm_.add_ring_wire(0, 0, radius, thickness);
         
-        for (const auto& ref_via: vias)
+        /* 回流过孔的坐标已经是相对于过孔中心的 */
+        for (const auto& ref_via: ret_vias)
         {
-            float dist = calc_dist(ref_via.at.x, ref_via.at.y, v.at.x, v.at.y);
-            if (dist < box_w - ref_via.drill)
-            {
-                fdm_.add_ring_ground(ref_via.at.x - v.at.x, ref_via.at.y - v.at.y, ref_via.drill * 0.5, thickness);
-            }
+            fdm_.add_ring_ground(ref_via.at.x, ref_via.at.y, ref_via.drill * 0.5, thickness);
         }
         
         fdm_.add_ground(0, max_d, thickness, v.drill);
@@ -2268,7 +3615,7 @@ std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::
                         "Y%u %s 0 %s 0 ymod%u LEN=%g\n"
                         ".MODEL ymod%u txl R=0 L=%gnH G=0 C=%gpF length=1\n",
                         Z0, td_,
-                        id, _pos2net(v.at.x, v.at.y, start).c_str(), _pos2net(v.at.x, v.at.y, end).c_str(), id, h * 0.001,
+                        id, _format_layer_name(start).c_str(), _format_layer_name(end).c_str(), id, h * 0.001,
                         id, l, c
                         );
         }
@@ -2278,7 +3625,7 @@ std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::
                         "O%u %s 0 %s 0 ltra%u\n"
                         ".MODEL ltra%u LTRA R=0 L=%gnH G=0 C=%gpF LEN=%g\n",
                         Z0, td_,
-                        id, _pos2net(v.at.x, v.at.y, start).c_str(), _pos2net(v.at.x, v.at.y, end).c_str(), id,
+                        id, _format_layer_name(start).c_str(), _format_layer_name(end).c_str(), id,
                         id, l, c, h * 0.001
                         );
         }
@@ -2290,23 +3637,18 @@ std::string z_extractor::_gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::
 }
 
 
-std::string z_extractor::_gen_via_model_ckt(pcb::via& v, std::map<std::string, cv::Mat>& refs_mat, std::string& call, float& td)
+std::string z_extractor::_gen_via_model_ckt(const pcb::via& v, const std::vector<float>& anti_pad_d, const std::string& name, float& td)
 {
     char buf[2048] = {0};
     std::string ckt;
-    ckt = ".subckt VIA" + _get_tstamp_short(v.tstamp) + " ";
-    call = "XVIA" + _get_tstamp_short(v.tstamp) + " ";
+    ckt = ".subckt " + name + " ";
     
     std::vector<std::string> conn_layers = _pcb->get_via_conn_layers(v);
     for (std::int32_t i = 0; i < (std::int32_t)conn_layers.size(); i++)
     {
-        const std::string& layer_name = conn_layers[i];
-        ckt += _pos2net(v.at.x, v.at.y, layer_name) + " ";
-        call += _pos2net(v.at.x, v.at.y, layer_name) + " ";
+        ckt += _format_layer_name(conn_layers[i]) + " ";
     }
-    
     ckt += "\n";
-    call += "VIA" + _get_tstamp_short(v.tstamp) + "\n";
     
     
     fasthenry henry;
@@ -2321,8 +3663,8 @@ std::string z_extractor::_gen_via_model_ckt(pcb::via& v, std::map<std::string, c
         const std::string& end = layers[i + 1];
         float z_start = _pcb->get_layer_z_axis(start);
         float z_end = _pcb->get_layer_z_axis(end);
-        henry.add_via(_pos2net(v.at.x, v.at.y, start), _pos2net(v.at.x, v.at.y, end),
-                        _format_net(_get_tstamp_short(v.tstamp) + start + end).c_str(),
+        henry.add_via(_format_layer_name(start), _format_layer_name(end),
+                        _format_net(name + start + end).c_str(),
                         fasthenry::point(v.at.x, v.at.y, z_start),
                         fasthenry::point(v.at.x, v.at.y, z_end), v.drill, v.size);
     }
@@ -2331,9 +3673,7 @@ std::string z_extractor::_gen_via_model_ckt(pcb::via& v, std::map<std::string, c
     {
         const std::string& start = layers[i];
         const std::string& end = layers[i + 1];
-        float start_anti_pad_d = _get_via_anti_pad_diameter(v, refs_mat, start);
-        float end_anti_pad_d = _get_via_anti_pad_diameter(v, refs_mat, end);
-        float anti_pad_diameter = std::min(start_anti_pad_d, end_anti_pad_d);
+        float anti_pad_diameter = anti_pad_d[i];
         
         float h = _pcb->get_layer_distance(start, end);
         float er = _pcb->get_layer_epsilon_r(start, end);
@@ -2342,16 +3682,16 @@ std::string z_extractor::_gen_via_model_ckt(pcb::via& v, std::map<std::string, c
         //float l = h / 5 * (1 + log(4 * h / v.drill)); //nH
         double r = 0;
         double l = 0;
-        henry.calc_impedance(_pos2net(v.at.x, v.at.y, start), _pos2net(v.at.x, v.at.y, end), r, l);
+        henry.calc_impedance(_format_layer_name(start), _format_layer_name(end), r, l);
         l = l * 1e9;
         td += sqrt(l * c * 0.001);
         
         sprintf(buf, "Cl%u %s 0 %gpF\n"
                         "L%u %s %s %gnH\n"
                         "Cr%u %s 0 %gpF\n",
-                        id, _pos2net(v.at.x, v.at.y, start).c_str(), c * 0.5,
-                        id, _pos2net(v.at.x, v.at.y, start).c_str(), _pos2net(v.at.x, v.at.y, end).c_str(), l,
-                        id, _pos2net(v.at.x, v.at.y, end).c_str(), c * 0.5);
+                        id, _format_layer_name(start).c_str(), c * 0.5,
+                        id, _format_layer_name(start).c_str(), _format_layer_name(end).c_str(), l,
+                        id, _format_layer_name(end).c_str(), c * 0.5);
         id++;
         ckt += buf;
     }
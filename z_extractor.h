@@ -33,6 +33,13 @@ class fasthenry;
 class z_extractor
 {
 public:
+    enum
+    {
+        WIDEBAND_NONE = 0,
+        WIDEBAND_HSPICE,
+        WIDEBAND_NGSPICE,
+    };
+    
     struct cond
     {
         cond(): w(0), h(0) {}
@@ -41,6 +48,66 @@ public:
         float w;
         float h;
     };
+    
+    /* 过孔模型 几何参数相同的过孔共用一个子电路 */
+    struct via_model
+    {
+        via_model(): td(0), emitted(false) {}
+        std::string name;
+        std::string ckt;
+        float td;
+        /* 子电路是否已经输出过 */
+        bool emitted;
+    };
+    
+    /* 一条(或一对耦合)走线生成的子电路和调用 并行生成后按顺序拼接 */
+    struct segment_ckt
+    {
+        segment_ckt() { len[0] = len[1] = 0; }
+        std::string subckt;
+        std::string call;
+        float len[2];
+        std::vector<std::pair<float, float> > Z0_td[2];
+        std::vector<std::pair<float, float> > Zodd_td;
+        std::vector<std::pair<float, float> > Zeven_td;
+        std::vector<std::string> models;
+    };
+    
+    /* 参考过孔的均匀网格索引 用于查找信号过孔周围的回流过孔
+     * 第i个格子中的过孔为 vias[idx[start[i]]] ... vias[idx[start[i + 1] - 1]]
+     */
+    struct via_grid
+    {
+        via_grid(): x0(0), y0(0), cell(1), cols(0), rows(0) {}
+        std::vector<std::uint32_t> refs_id;
+        std::vector<pcb::via> vias;
+        std::vector<std::uint32_t> start;
+        std::vector<std::uint32_t> idx;
+        float x0;
+        float y0;
+        float cell;
+        std::int32_t cols;
+        std::int32_t rows;
+    };
+    /* 直流压降的负载 */
+    struct ir_load
+    {
+        ir_load(): current(0), drop(0) {}
+        std::string footprint;
+        std::string pad_number;
+        /* 负载电流 A */
+        float current;
+        /* 计算结果 相对于源焊盘的压降 V 编号相同的多个焊盘平分电流 取压降最大的 */
+        float drop;
+    };
+    /* 多端口RL提取的端口 从footprint1.footprint1_pad_number到footprint2.footprint2_pad_number */
+    struct rl_port
+    {
+        std::string footprint1;
+        std::string footprint1_pad_number;
+        std::string footprint2;
+        std::string footprint2_pad_number;
+    };
 public:
     z_extractor(std::shared_ptr<pcb>& pcb);
     ~z_extractor();
@@ -49,6 +116,11 @@ public:
     bool gen_subckt_rl(const std::string& footprint1, const std::string& footprint1_pad_number,
                         const std::string& footprint2, const std::string& footprint2_pad_number,
                         std::string& ckt, std::string& call, float& r, float& l);
+    /* 同一网络的所有端口共用一个模型 只调用一次fasthenry
+     * ckts calls为每个端口的子电路 r l按行优先存放 r[i * n + j] l[i * n + j] 非对角线为端口之间的互阻互感
+     */
+    bool gen_subckt_rl(const std::vector<rl_port>& ports, std::vector<std::string>& ckts, std::vector<std::string>& calls,
+                        std::vector<double>& r, std::vector<double>& l);
     bool gen_subckt(std::uint32_t net_id, std::string& ckt, std::set<std::string>& footprint, std::string& call);
     
     /*bool gen_subckt(std::vector<std::uint32_t> net_ids, std::vector<std::set<std::string> > mutual_ind_tstamp,
@@ -63,9 +135,19 @@ public:
     
     std::string gen_zone_fasthenry(std::uint32_t net_id, std::set<pcb::point>& points);
     
+    /* 直流压降 footprint.pad_number为电源焊盘 所有负载都从电源取电流
+     * 覆铜按grid_size(mm)划分网格 j_map为每层的电流密度(A/mm^2) 每个像素对应一个网格
+     */
+    bool gen_ir_drop(const std::string& footprint, const std::string& pad_number, std::vector<ir_load>& loads,
+                        float grid_size, std::map<std::string, cv::Mat>& j_map);
+    
     
     void set_freq(float freq) { _freq = freq; }
+    /* RL提取从_freq扫频到fmax 每十倍频程ndec个点 结果拟合成RL梯形网络 fmax不大于_freq时只计算_freq一个频点 */
+    void set_rl_sweep(float fmax, std::int32_t ndec) { _rl_fmax = fmax; _rl_ndec = ndec; }
     void set_calc(std::uint32_t type = Z0_calc::Z0_CALC_MMTL);
+    /* fdm迭代求解的收敛条件 rel_tol为电容的相对精度 max_iter为最大迭代次数 0表示不限制 */
+    void set_fdm_convergence(float rel_tol, std::int32_t max_iter) { _fdm_rel_tol = rel_tol; _fdm_max_iter = max_iter; }
     void set_step(float step) { _Z0_step = step; }
     void set_coupled_max_gap(float dist) { _coupled_max_gap = dist; }
     void set_coupled_min_len(float len) { _coupled_min_len = len; }
@@ -74,6 +156,19 @@ public:
     void enable_ltra_model(bool b) { _ltra_model = b; }
     void enable_via_tl_mode(bool b) { _via_tl_mode = b; }
     void enable_openmp(bool b) { _enable_openmp = b; }
+    /* 覆铜网格最多合并的层数 每层格子边长加倍 0为均匀网格 */
+    void set_zone_mesh_level(std::int32_t level) { _zone_mesh_level = level; }
+    /* 覆铜边缘和连接点附近保持细网格 格子随距离逐级变大 */
+    void enable_zone_refine(bool b) { _zone_refine = b; }
+    /* 宽带RLGC模型 R包含趋肤效应 G由损耗角正切得到
+     * WIDEBAND_HSPICE 导出HSPICE W-element 仅HSPICE可用
+     * WIDEBAND_NGSPICE ngspice没有频变传输线 R和G取set_freq频率处的值导出txl/ltra/cpl
+     */
+    void set_wideband_model(std::uint32_t mode) { _wideband_model = mode; }
+    /* 铜箔表面粗糙度(RMS) 单位mm */
+    void set_roughness(float roughness) { _roughness = roughness; }
+    /* 同层同线宽且连接点上没有焊盘、过孔和分支的相邻走线合并成一条传输线 */
+    void enable_segment_merge(bool b) { _segment_merge = b; }
     
     
     static std::string format_net_name(const std::string& net_name) { return _format_net_name(net_name); }
@@ -84,6 +179,10 @@ public:
     
 private:
     std::string _get_tstamp_short(const std::string& tstamp);
+    /* 由模型参数的哈希生成模型名 参数相同的模型名字也相同 */
+    std::string _get_model_name(const char *prefix, const std::string& params);
+    /* 返回库中还没有输出过的模型 */
+    std::string _emit_models(const std::vector<std::string>& models);
     static std::string _format_net(const std::string& name);
     std::string _pos2net(float x, float y, const std::string& layer);
     static std::string _format_net_name(const std::string& net_name);
@@ -92,9 +191,18 @@ private:
     
     
     
-    void _get_zone_cond(std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, std::map<std::string, std::list<cond> >& conds, float& grid_size);
+    /* 构建整个网络的fasthenry模型 */
+    bool _build_rl_model(fasthenry& henry, std::uint32_t net_id);
+    /* rk lk为梯形网络中每一节并联的电阻电感 为空时只有r l串联 */
+    void _gen_rl_ckt(std::uint32_t net_id, const rl_port& port, double r, double l, const std::vector<double>& rk, const std::vector<double>& lk,
+                        std::string& ckt, std::string& call);
+    
+    /* refine_pts为各层上跟覆铜的连接点 */
+    void _get_zone_cond(std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, const std::map<std::string, std::vector<pcb::point> >& refine_pts,
+                            std::map<std::string, std::list<cond> >& conds, float& grid_size);
     //void _get_zone_cond(const z_extractor::zone& z, std::list<cond>& conds, std::set<z_extractor::pcb_point>& points);
-    void _add_zone(fasthenry& henry, std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, std::map<std::string, std::list<cond> >& conds, float& grid_size);
+    void _add_zone(fasthenry& henry, std::uint32_t net_id, const std::map<std::string, cv::Mat>& zone_mat, const std::map<std::string, std::vector<pcb::point> >& refine_pts,
+                    std::map<std::string, std::list<cond> >& conds, float& grid_size);
     void _conn_to_zone(fasthenry& henry, float x, float y, std::map<std::string, cv::Mat>& zone_mat, const std::string& layer_name, std::map<std::string, std::list<cond> >& conds, float grid_size);
     
     void _draw_segment(cv::Mat& img, pcb::segment& s, std::uint8_t b, std::uint8_t g, std::uint8_t r);
@@ -109,6 +217,8 @@ private:
     
     /* 获取过孔反焊盘直径 */
     float _get_via_anti_pad_diameter(const pcb::via& v, const std::map<std::string, cv::Mat>& refs_mat, std::string layer);
+    /* (x, y)到img中最近的铜(非0像素或图像以外)的距离 超过max_dist时返回max_dist 单位mm */
+    float _get_nearest_copper_dist(const cv::Mat& img, float x, float y, float max_dist);
     
     
     
@@ -120,19 +230,57 @@ private:
     /* 单位 nH */
     float _calc_via_l(const pcb::via& s, const std::string& layer_name1, const std::string& layer_name2);
     
+    /* 宽带RLGC模型参数 R(f) = ro + rs * sqrt(f)  G(f) = gd * f
+     * w:线宽(mm) c:单位长度电容(pF/m) v:传播速度(m/s)
+     * ro:欧/m rs:欧/(m*sqrt(Hz)) gd:S/(m*Hz)
+     */
+    void _calc_wideband_rlgc(const std::string& layer_name, float w, float c, float v, float& ro, float& rs, float& gd);
+    
     
     bool _is_coupled(const pcb::segment& s1, const pcb::segment& s2, float coupled_max_gap, float coupled_min_len);
+    /* 批量计算v_segments1中可能与s0耦合的走线 按原来的顺序输出 */
+    void _get_coupled_candidates(const pcb::segment& s0, std::vector<std::list<pcb::segment> >& v_segments1,
+                                    std::vector<std::pair<std::list<pcb::segment> *, std::list<pcb::segment>::iterator> >& cands);
+    /* 耦合走线交叠部分的端点 直线按平行线 圆弧按同心圆弧 */
+    bool _get_coupled_overlap(const pcb::segment& s0, const pcb::segment& s1,
+                                double& aox1, double& aoy1, double& aox2, double& aoy2,
+                                double& box1, double& boy1, double& box2, double& boy2);
+    /* 走线上的点(x, y)沿走线到起点的距离 */
+    float _get_segment_pos(const pcb::segment& s, float x, float y);
+    /* 阻抗采样步长 圆弧按截面外侧的移动距离缩小步长 */
+    float _get_sample_step(const pcb::segment& s, float box_w);
     void _split_segment(const pcb::segment& s, std::list<pcb::segment>& ss, float x1, float y1, float x2, float y2);
     
-    std::string _gen_segment_Z0_ckt_openmp(const std::string& cir_name, pcb::segment& s, const std::map<std::string, cv::Mat>& refs_mat,
-                                            std::vector<std::pair<float, float> >& v_Z0_td);
+    /* s0的终点和s1的起点相连 可以当作同一条传输线 pads vias segments为s0所在网络的焊盘 过孔和走线 */
+    bool _segment_can_merge(const pcb::segment& s0, const pcb::segment& s1,
+                            const std::list<pcb::pad>& pads, const std::list<pcb::via>& vias, const std::list<pcb::segment>& segments);
+    /* 把首尾相连的走线分组 每组生成一条传输线 不合并时每组只有一条走线 */
+    void _merge_segments(const std::vector<pcb::segment>& v_list, std::vector<std::vector<pcb::segment> >& runs);
+    
+    /* ss为首尾相连的一组走线 按总长度生成一条传输线
+     * models为走线用到的传输线模型(.MODEL行) 由调用者去重后输出
+     */
+    std::string _gen_segment_Z0_ckt_openmp(const std::string& cir_name, const std::vector<pcb::segment>& ss, const std::map<std::string, cv::Mat>& refs_mat,
+                                            std::vector<std::pair<float, float> >& v_Z0_td, std::vector<std::string>& models);
     std::string _gen_segment_coupled_Z0_ckt_openmp(const std::string& cir_name, pcb::segment& s0, pcb::segment& s1, const std::map<std::string, cv::Mat>& refs_mat,
                                                     std::vector<std::pair<float, float> > v_Z0_td[2],
                                                     std::vector<std::pair<float, float> >& v_Zodd_td,
                                                     std::vector<std::pair<float, float> >& v_Zeven_td);
     
-    std::string _gen_via_Z0_ckt(pcb::via& v, std::map<std::string, cv::Mat>& refs_mat, const std::vector<std::uint32_t>& refs_id, std::string& call, float& td);
-    std::string _gen_via_model_ckt(pcb::via& v, std::map<std::string, cv::Mat>& refs_mat, std::string& call, float& td);
+    /* 生成vias的子电路调用 返回新建的过孔模型子电路 td为每个过孔的延时 */
+    std::string _gen_vias_ckt(const std::list<pcb::via>& vias, const std::map<std::string, cv::Mat>& refs_mat, const std::vector<std::uint32_t>& refs_id,
+                                std::string& call, std::vector<float>& td);
+    /* 过孔的反焊盘直径(每对相邻层一个)和box_w范围内的回流过孔(坐标相对于过孔中心) 都按0.01mm取整 */
+    void _get_via_env(const pcb::via& v, const std::map<std::string, cv::Mat>& refs_mat, bool use_ret_vias,
+                        std::vector<float>& anti_pad_d, std::list<pcb::via>& ret_vias);
+    /* refs_id跟上次不同时才重建 */
+    void _build_via_grid(const std::vector<std::uint32_t>& refs_id);
+    /* 返回到(x, y)距离小于radius的参考过孔 */
+    void _query_via_grid(float x, float y, float radius, std::vector<const pcb::via *>& vias);
+    std::string _get_via_signature(const pcb::via& v, const std::vector<float>& anti_pad_d, const std::list<pcb::via>& ret_vias);
+    
+    std::string _gen_via_Z0_ckt(const pcb::via& v, const std::vector<float>& anti_pad_d, const std::list<pcb::via>& ret_vias, const std::string& name, float& td);
+    std::string _gen_via_model_ckt(const pcb::via& v, const std::vector<float>& anti_pad_d, const std::string& name, float& td);
     
     
     float _cvt_img_x(float x) { return round((x - _pcb->get_edge_left()) * _img_ratio); }
@@ -156,6 +304,10 @@ private:
     bool _ltra_model;
     bool _via_tl_mode;
     bool _enable_openmp;
+    std::uint32_t _wideband_model;
+    bool _segment_merge;
+    std::int32_t _zone_mesh_level;
+    bool _zone_refine;
     
     float _img_ratio;
     
@@ -163,6 +315,12 @@ private:
     
     std::vector<std::shared_ptr<Z0_calc> > _Z0_calc;
     
+    /* 以过孔特征为键的过孔模型库 */
+    std::map<std::string, via_model> _via_models;
+    /* 已经输出过的传输线模型 */
+    std::set<std::string> _tl_models;
+    via_grid _via_grid;
+    
     const float _resistivity = 0.0172;
     /* 小于这个长度的走线不计算阻抗 使用0欧电阻连接 */
     const float _segment_min_len = 0.01;
@@ -170,10 +328,23 @@ private:
     const float _Z0_threshold = 0.5;
     /* td小于该值的传输线 只导出无损模型 */
     const float _td_threshold = 0.001;
+    /* 过孔孔壁的镀铜厚度 mm */
+    const float _via_plating = 0.025;
+    /* 过孔特征中长度的取整精度 */
+    const float _via_quantum = 0.01;
+    /* 回流过孔网格的格子大小 跟过孔的计算范围(10倍孔径)相当 */
+    const float _via_grid_cell = 2.0;
     /* 仅仅是坐标精度 */
     const float _float_epsilon = 0.00005;
+    /* 圆心距离小于这个值认为是同心圆弧 */
+    const float _arc_center_epsilon = 0.005;
     float _conductivity;
     float _freq;
+    float _rl_fmax;
+    std::int32_t _rl_ndec;
+    float _fdm_rel_tol;
+    std::int32_t _fdm_max_iter;
+    float _roughness;
     
     std::shared_ptr<pcb> _pcb;
 };